@@ -0,0 +1,81 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_ADAPTIVE_PERIOD_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_ADAPTIVE_PERIOD_INCLUDED
+// ISO C++ 98 headers.
+#include <algorithm>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! Polling period that drops to its minimum when something happens
+    //! and doubles after each stable poll, up to its maximum.
+    class AdaptivePeriod
+    {
+    public:
+      AdaptivePeriod(void):
+        m_min(1),
+        m_max(1),
+        m_period(1),
+        m_last(Clock::get())
+      { }
+
+      //! Set the period bounds. A maximum not above the minimum gives a
+      //! fixed period.
+      //! @param[in] min minimum period (s).
+      //! @param[in] max maximum period (s).
+      void
+      setBounds(double min, double max)
+      {
+        m_min = min;
+        m_max = std::max(min, max);
+        m_period = min;
+      }
+
+      //! @return current period (s).
+      double
+      getPeriod(void) const
+      {
+        return m_period;
+      }
+
+      //! @return true if a poll is due.
+      bool
+      overflow(void) const
+      {
+        return Clock::get() - m_last >= m_period;
+      }
+
+      //! A poll was made.
+      //! @param[in] stable nothing changed since the previous poll.
+      void
+      reset(bool stable)
+      {
+        m_last = Clock::get();
+        m_period = stable ? std::min(m_period * 2, m_max) : m_min;
+      }
+
+      //! Something changed, poll again within the minimum period.
+      void
+      shorten(void)
+      {
+        m_period = m_min;
+      }
+
+    private:
+      //! Minimum period (s).
+      double m_min;
+      //! Maximum period (s).
+      double m_max;
+      //! Current period (s).
+      double m_period;
+      //! Time of the last poll.
+      double m_last;
+    };
+  }
+}
+#endif
@@ -0,0 +1,242 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_COMMAND_STATS_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_COMMAND_STATS_INCLUDED
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! Upper bounds of command latency histogram bins (ms), the last
+    //! bin holds everything slower.
+    static const double c_latency_bins[] = {10, 50, 100, 250, 500, 1000, 2500, 5000};
+    //! Number of command latency histogram bins.
+    static const unsigned c_latency_bin_count = sizeof(c_latency_bins) / sizeof(c_latency_bins[0]) + 1;
+
+    //! Time and serial traffic spent on each AT command and in each
+    //! connection state. Commands are keyed by name and type, without
+    //! arguments: 'AT+CGACT=1,1' and 'AT+CGACT?' count as '+CGACT=' and
+    //! '+CGACT?'.
+    class CommandStats
+    {
+    public:
+      //! Statistics of one command.
+      struct Command
+      {
+        // Completed commands.
+        unsigned count;
+        // Error replies.
+        unsigned errors;
+        // Timeouts.
+        unsigned timeouts;
+        // Total latency (ms).
+        double total;
+        // Maximum latency (ms).
+        double max;
+        // Latency histogram.
+        unsigned bins[c_latency_bin_count];
+        // Bytes sent.
+        unsigned tx;
+        // Bytes received.
+        unsigned rx;
+      };
+
+      //! Statistics by command.
+      typedef std::map<std::string, Command> Commands;
+
+      CommandStats(void):
+        m_start(-1),
+        m_tx(0),
+        m_rx(0),
+        m_state(-1),
+        m_state_time(0)
+      { }
+
+      //! A command was sent.
+      //! @param[in] command command, without the 'AT' prefix.
+      //! @param[in] bytes bytes sent.
+      void
+      begin(const std::string& command, unsigned bytes)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        m_command = getKey(command);
+        m_start = Clock::get();
+        m_tx += bytes;
+        m_commands[m_command].tx += bytes;
+      }
+
+      //! The command in progress completed.
+      //! @param[in] error command failed.
+      void
+      end(bool error)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        if (m_start < 0)
+          return;
+
+        double latency = (Clock::get() - m_start) * 1000.0;
+        Command& cmd = m_commands[m_command];
+        ++cmd.count;
+        cmd.total += latency;
+        cmd.max = std::max(cmd.max, latency);
+        if (error)
+          ++cmd.errors;
+
+        unsigned bin = 0;
+        while (bin < c_latency_bin_count - 1 && latency >= c_latency_bins[bin])
+          ++bin;
+        ++cmd.bins[bin];
+        m_start = -1;
+      }
+
+      //! The command in progress timed out.
+      void
+      timeout(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        if (m_start < 0)
+          return;
+
+        ++m_commands[m_command].timeouts;
+        m_start = -1;
+      }
+
+      //! Count raw bytes sent outside of commands.
+      void
+      addSent(unsigned bytes)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        m_tx += bytes;
+        if (m_start >= 0)
+          m_commands[m_command].tx += bytes;
+      }
+
+      //! Count bytes received. Bytes received while a command is in
+      //! progress are accounted to it, including unsolicited ones.
+      void
+      addReceived(unsigned bytes)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        m_rx += bytes;
+        if (m_start >= 0)
+          m_commands[m_command].rx += bytes;
+      }
+
+      //! Account the time spent in the previous connection state.
+      //! @param[in] state current connection state.
+      void
+      setState(int state)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        account();
+        m_state = state;
+      }
+
+      //! Get a copy of the statistics since the start.
+      //! @param[out] commands statistics by command.
+      //! @param[out] states time in each connection state (s).
+      //! @param[out] tx bytes sent.
+      //! @param[out] rx bytes received.
+      void
+      get(Commands& commands, std::vector<double>& states, double& tx, double& rx)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        account();
+        commands = m_commands;
+        states = m_states;
+        tx = m_tx;
+        rx = m_rx;
+      }
+
+      //! Get the serial traffic since the start.
+      //! @param[out] tx bytes sent.
+      //! @param[out] rx bytes received.
+      void
+      getTraffic(double& tx, double& rx)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        tx = m_tx;
+        rx = m_rx;
+      }
+
+      //! Format the statistics of a command in one line.
+      //! @param[in] cmd command statistics.
+      //! @return summary.
+      static std::string
+      format(const Command& cmd)
+      {
+        std::string str = String::str("n=%u avg=%.0f max=%.0f to=%u err=%u tx=%u rx=%u hist=",
+                                      cmd.count, cmd.count ? cmd.total / cmd.count : 0.0,
+                                      cmd.max, cmd.timeouts, cmd.errors, cmd.tx, cmd.rx);
+        for (unsigned i = 0; i < c_latency_bin_count; ++i)
+          str += String::str(i ? ",%u" : "%u", cmd.bins[i]);
+        return str;
+      }
+
+    private:
+      //! Statistics by command.
+      Commands m_commands;
+      //! Command in progress.
+      std::string m_command;
+      //! Time the command in progress was sent, negative if none.
+      double m_start;
+      //! Bytes sent.
+      double m_tx;
+      //! Bytes received.
+      double m_rx;
+      //! Time spent in each connection state (s).
+      std::vector<double> m_states;
+      //! Current connection state.
+      int m_state;
+      //! Time the current connection state was last accounted.
+      double m_state_time;
+      //! Lock for statistics, updated by the engine and reader threads.
+      Concurrency::Mutex m_lock;
+
+      //! Add the time since the last call to the current state.
+      void
+      account(void)
+      {
+        double now = Clock::get();
+        if (m_state >= 0)
+        {
+          if ((std::size_t)m_state >= m_states.size())
+            m_states.resize(m_state + 1, 0.0);
+          m_states[m_state] += now - m_state_time;
+        }
+
+        m_state_time = now;
+      }
+
+      //! Strip arguments from each command in a command line.
+      static std::string
+      getKey(const std::string& command)
+      {
+        std::string key;
+        bool args = false;
+        for (std::size_t i = 0; i < command.size(); ++i)
+        {
+          char c = command[i];
+          if (c == ';')
+            args = false;
+          else if (args)
+            continue;
+          else if (c == '=')
+            args = command.compare(i + 1, 1, "?") != 0;
+
+          key.push_back(c);
+        }
+        return key;
+      }
+    };
+  }
+}
+#endif
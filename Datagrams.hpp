@@ -0,0 +1,245 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_DATAGRAMS_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_DATAGRAMS_INCLUDED
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "PacketDecoder.hpp"
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! Maximum datagram size accepted by +USOST (bytes).
+    static const std::size_t c_udp_max_datagram = 1024;
+    //! Maximum number of datagrams waiting to be sent.
+    static const std::size_t c_udp_max_queue = 32;
+
+    //! Batches serialized IMC messages into datagrams and keeps traffic
+    //! counters. Messages are added by the task thread and datagrams are
+    //! taken by the modem command engine.
+    class Datagrams
+    {
+    public:
+      //! Traffic since the last call to getStatistics().
+      struct Statistics
+      {
+        // Messages sent.
+        unsigned msgs_out;
+        // Messages received.
+        unsigned msgs_in;
+        // Messages dropped (too large or queue full).
+        unsigned dropped;
+        // Outgoing throughput (bytes/s).
+        double rate_out;
+        // Incoming throughput (bytes/s).
+        double rate_in;
+        // Average time from queuing to sending a message (ms).
+        double latency_avg;
+        // Maximum time from queuing to sending a message (ms).
+        double latency_max;
+      };
+
+      Datagrams(void):
+        m_batch_time(0)
+      {
+        clearCounters();
+        m_period_start = Clock::get();
+      }
+
+      //! Serialize and queue a message. Messages go in the current batch
+      //! until it is full.
+      //! @param[in] msg message.
+      //! @return false if the message was dropped.
+      bool
+      push(const IMC::Message* msg)
+      {
+        std::size_t size = msg->getSerializationSize();
+        Concurrency::ScopedMutex l(m_lock);
+        if (size > c_udp_max_datagram)
+        {
+          ++m_dropped;
+          return false;
+        }
+
+        if (m_batch.size() + size > c_udp_max_datagram)
+          closeBatch();
+
+        if (m_batch.empty())
+          m_batch_time = Clock::get();
+
+        std::size_t offset = m_batch.size();
+        m_batch.resize(offset + size);
+        IMC::Packet::serialize(msg, (uint8_t*)&m_batch[offset], size);
+        m_batch_times.push_back(Clock::get());
+        return true;
+      }
+
+      //! Take the next datagram to send: a full batch, or the current
+      //! one once it is older than the batch period.
+      //! @param[in] period batch period (s).
+      //! @param[out] data datagram.
+      //! @param[out] msgs messages in the datagram.
+      //! @return false if there is nothing to send yet.
+      bool
+      pop(double period, std::string& data, unsigned& msgs)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        if (m_ready.empty() && !m_batch.empty() && Clock::get() - m_batch_time >= period)
+          closeBatch();
+
+        if (m_ready.empty())
+          return false;
+
+        double now = Clock::get();
+        Batch& batch = m_ready.front();
+        for (std::size_t i = 0; i < batch.times.size(); ++i)
+        {
+          double latency = (now - batch.times[i]) * 1000.0;
+          m_latency_sum += latency;
+          m_latency_max = std::max(m_latency_max, latency);
+        }
+
+        msgs = batch.times.size();
+        m_msgs_out += msgs;
+        m_bytes_out += batch.data.size();
+        data.swap(batch.data);
+        m_ready.pop_front();
+        return true;
+      }
+
+      //! Count a datagram taken with pop() that the modem failed to send
+      //! as dropped instead of sent.
+      //! @param[in] msgs messages in the datagram.
+      //! @param[in] bytes datagram size.
+      void
+      addLost(unsigned msgs, std::size_t bytes)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        m_msgs_out -= std::min(m_msgs_out, msgs);
+        m_bytes_out -= std::min(m_bytes_out, (double)bytes);
+        m_dropped += msgs;
+      }
+
+      //! Count a received datagram.
+      //! @param[in] msgs messages in the datagram.
+      //! @param[in] bytes datagram size.
+      void
+      addReceived(unsigned msgs, std::size_t bytes)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        m_msgs_in += msgs;
+        m_bytes_in += bytes;
+      }
+
+      //! Drop everything waiting to be sent.
+      void
+      clear(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        closeBatch();
+        for (std::size_t i = 0; i < m_ready.size(); ++i)
+          m_dropped += m_ready[i].times.size();
+        m_ready.clear();
+      }
+
+      void
+      getStatistics(Statistics& stats)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        double now = Clock::get();
+        double elapsed = std::max(now - m_period_start, 1e-3);
+
+        stats.msgs_out = m_msgs_out;
+        stats.msgs_in = m_msgs_in;
+        stats.dropped = m_dropped;
+        stats.rate_out = m_bytes_out / elapsed;
+        stats.rate_in = m_bytes_in / elapsed;
+        stats.latency_avg = m_msgs_out ? m_latency_sum / m_msgs_out : 0;
+        stats.latency_max = m_latency_max;
+
+        clearCounters();
+        m_period_start = now;
+      }
+
+    private:
+      //! Datagram waiting to be sent.
+      struct Batch
+      {
+        // Serialized messages.
+        std::string data;
+        // Time each message was queued.
+        std::vector<double> times;
+      };
+
+      //! Batch being filled.
+      std::string m_batch;
+      //! Time each message in the current batch was queued.
+      std::vector<double> m_batch_times;
+      //! Time the current batch was started.
+      double m_batch_time;
+      //! Datagrams waiting to be sent.
+      std::deque<Batch> m_ready;
+      //! Start of the statistics period.
+      double m_period_start;
+      //! Messages sent.
+      unsigned m_msgs_out;
+      //! Messages received.
+      unsigned m_msgs_in;
+      //! Messages dropped.
+      unsigned m_dropped;
+      //! Bytes sent.
+      double m_bytes_out;
+      //! Bytes received.
+      double m_bytes_in;
+      //! Sum of message latencies (ms).
+      double m_latency_sum;
+      //! Maximum message latency (ms).
+      double m_latency_max;
+      //! Lock for batches and counters.
+      Concurrency::Mutex m_lock;
+
+      //! Move the current batch to the send queue, dropping the oldest
+      //! datagram if the queue is full.
+      void
+      closeBatch(void)
+      {
+        if (m_batch.empty())
+          return;
+
+        if (m_ready.size() >= c_udp_max_queue)
+        {
+          m_dropped += m_ready.front().times.size();
+          m_ready.pop_front();
+        }
+
+        m_ready.push_back(Batch());
+        m_ready.back().data.swap(m_batch);
+        m_ready.back().times.swap(m_batch_times);
+        m_batch.clear();
+        m_batch_times.clear();
+      }
+
+      void
+      clearCounters(void)
+      {
+        m_msgs_out = 0;
+        m_msgs_in = 0;
+        m_dropped = 0;
+        m_bytes_out = 0;
+        m_bytes_in = 0;
+        m_latency_sum = 0;
+        m_latency_max = 0;
+      }
+    };
+  }
+}
+#endif
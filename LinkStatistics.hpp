@@ -0,0 +1,138 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_LINK_STATISTICS_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_LINK_STATISTICS_INCLUDED
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    //! Rolling latency statistics over the last probes sent to the
+    //! remote side, received or lost.
+    class LinkStatistics
+    {
+    public:
+      //! Statistics of the probes in the window.
+      struct Summary
+      {
+        // Number of probes.
+        unsigned samples;
+        // Minimum round trip time (ms).
+        double min;
+        // Average round trip time (ms).
+        double avg;
+        // Maximum round trip time (ms).
+        double max;
+        // Mean difference between consecutive round trip times (ms).
+        double jitter;
+        // 95th percentile of round trip time (ms).
+        double p95;
+        // Fraction of lost probes.
+        double loss;
+      };
+
+      //! Constructor.
+      //! @param[in] window number of probes to keep.
+      LinkStatistics(unsigned window = 50):
+        m_window(window)
+      { }
+
+      void
+      setWindow(unsigned window)
+      {
+        m_window = std::max(window, 1u);
+        while (m_samples.size() > m_window)
+          m_samples.pop_front();
+      }
+
+      //! Add a received probe.
+      //! @param[in] rtt round trip time (ms).
+      void
+      addReply(double rtt)
+      {
+        add(rtt);
+      }
+
+      //! Add a lost probe.
+      void
+      addLoss(void)
+      {
+        add(-1.0);
+      }
+
+      void
+      clear(void)
+      {
+        m_samples.clear();
+      }
+
+      //! Compute the statistics of the probes in the window. Round trip
+      //! times are zero when no probe was received.
+      //! @param[out] summary statistics.
+      void
+      getSummary(Summary& summary) const
+      {
+        std::vector<double> rtts;
+        rtts.reserve(m_samples.size());
+
+        double sum = 0;
+        double diffs = 0;
+        double last = -1.0;
+        unsigned pairs = 0;
+
+        for (std::size_t i = 0; i < m_samples.size(); ++i)
+        {
+          double rtt = m_samples[i];
+          if (rtt < 0)
+            continue;
+
+          if (last >= 0)
+          {
+            diffs += std::fabs(rtt - last);
+            ++pairs;
+          }
+
+          last = rtt;
+          sum += rtt;
+          rtts.push_back(rtt);
+        }
+
+        summary.samples = m_samples.size();
+        summary.loss = m_samples.empty() ? 0 : 1.0 - (double)rtts.size() / m_samples.size();
+        summary.jitter = pairs ? diffs / pairs : 0;
+
+        if (rtts.empty())
+        {
+          summary.min = summary.avg = summary.max = summary.p95 = 0;
+          return;
+        }
+
+        std::sort(rtts.begin(), rtts.end());
+        summary.min = rtts.front();
+        summary.max = rtts.back();
+        summary.avg = sum / rtts.size();
+        //! Nearest rank percentile.
+        std::size_t rank = (std::size_t)std::ceil(0.95 * rtts.size());
+        summary.p95 = rtts[std::max<std::size_t>(rank, 1) - 1];
+      }
+
+    private:
+      //! Round trip times of the last probes, negative if lost.
+      std::deque<double> m_samples;
+      //! Number of probes to keep.
+      unsigned m_window;
+
+      void
+      add(double rtt)
+      {
+        m_samples.push_back(rtt);
+        if (m_samples.size() > m_window)
+          m_samples.pop_front();
+      }
+    };
+  }
+}
+#endif
@@ -0,0 +1,179 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_MODEM_STARTER_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_MODEM_STARTER_INCLUDED
+// ISO C++ 98 headers.
+#include <string>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "SerialTrace.hpp"
+#include "TobyL2.hpp"
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! Modem bring-up parameters.
+    struct StarterConfig
+    {
+      // Serial port device.
+      std::string uart_dev;
+      // Serial port baud rate.
+      unsigned uart_baud;
+      // Maximum time to wait for the serial device (s).
+      double dev_tout;
+      // Maximum time to wait for the modem to answer (s).
+      double ready_tout;
+      // APN name.
+      std::string apn;
+      // SIM PIN.
+      std::string pin;
+      // Time at which the power channel was seen turning on.
+      double power_on_time;
+    };
+
+    //! Brings a modem up off the task thread, which keeps serving the
+    //! other modems: waits for the serial device, opens it and
+    //! initializes the modem. The serial port and driver are handed to
+    //! the task with take() once done, whether the bring-up failed or
+    //! not.
+    class ModemStarter: public Concurrency::Thread
+    {
+    public:
+      //! Constructor.
+      //! @param[in] task parent task.
+      //! @param[in] config bring-up parameters.
+      //! @param[in] uart serial port, NULL to open the device.
+      //! @param[in] trace trace recording the opened device, or NULL.
+      //! @param[in] queue SMS queue.
+      //! @param[in] datagrams IMC datagrams.
+      //! @param[in] uploads file uploads, or NULL.
+      ModemStarter(Tasks::Task* task, const StarterConfig& config, IO::Handle* uart, SerialTrace* trace,
+                   SmsQueue* queue, Datagrams* datagrams, Uploads* uploads):
+        m_task(task),
+        m_config(config),
+        m_uart(uart),
+        m_trace(trace),
+        m_queue(queue),
+        m_datagrams(datagrams),
+        m_uploads(uploads),
+        m_driver(NULL),
+        m_done(false)
+      { }
+
+      //! Check if the bring-up ended.
+      //! @param[out] error failure description, empty on success.
+      //! @return true if the bring-up ended.
+      bool
+      isDone(std::string& error)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        error = m_error;
+        return m_done;
+      }
+
+      //! Hand over the serial port and driver, once done or stopped.
+      //! @param[out] uart serial port, or NULL.
+      //! @return initialized driver, NULL if the bring-up failed.
+      TobyL2*
+      take(IO::Handle*& uart)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        uart = m_uart;
+        TobyL2* driver = m_driver;
+        m_uart = NULL;
+        m_driver = NULL;
+        return driver;
+      }
+
+    private:
+      //! Parent task.
+      Tasks::Task* m_task;
+      //! Bring-up parameters.
+      StarterConfig m_config;
+      //! Serial port.
+      IO::Handle* m_uart;
+      //! Trace of the serial port, or NULL.
+      SerialTrace* m_trace;
+      //! Shared queues, owned by the task.
+      SmsQueue* m_queue;
+      Datagrams* m_datagrams;
+      Uploads* m_uploads;
+      //! Driver, NULL until initialized.
+      TobyL2* m_driver;
+      //! Failure description.
+      std::string m_error;
+      //! Bring-up ended.
+      bool m_done;
+      //! Lock for results.
+      Concurrency::Mutex m_lock;
+
+      //! Wait for the kernel to detect and bring the device up.
+      void
+      waitForDevice(void)
+      {
+        Time::Counter<double> timer(m_config.dev_tout);
+        while (!Path(m_config.uart_dev).exists())
+        {
+          if (timer.overflow() || isStopping())
+            throw std::runtime_error(String::str(DTR("device %s not found"), m_config.uart_dev.c_str()));
+
+          Delay::wait(0.1);
+        }
+
+        m_task->debug("device %s found after %.1f s", m_config.uart_dev.c_str(),
+                      Clock::get() - m_config.power_on_time);
+      }
+
+      void
+      run(void)
+      {
+        IO::Handle* uart = NULL;
+        TobyL2* driver = NULL;
+        std::string error;
+
+        try
+        {
+          {
+            Concurrency::ScopedMutex l(m_lock);
+            uart = m_uart;
+          }
+
+          if (uart == NULL)
+          {
+            waitForDevice();
+            uart = new SerialPort(m_config.uart_dev, m_config.uart_baud);
+            if (m_trace != NULL)
+              uart = new TraceRecorder(uart, m_trace);
+
+            Concurrency::ScopedMutex l(m_lock);
+            m_uart = uart;
+          }
+
+          driver = new TobyL2(m_task, uart, m_queue, m_datagrams, m_uploads, m_config.ready_tout);
+          driver->initTobyL2(m_config.apn, m_config.pin);
+        }
+        catch (std::exception& e)
+        {
+          error = e.what();
+        }
+
+        if (!error.empty() && driver != NULL)
+        {
+          driver->stopAndJoin();
+          delete driver;
+          driver = NULL;
+        }
+
+        Concurrency::ScopedMutex l(m_lock);
+        m_driver = driver;
+        m_error = error;
+        m_done = true;
+      }
+    };
+  }
+}
+#endif
@@ -0,0 +1,280 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_PACKET_DECODER_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_PACKET_DECODER_INCLUDED
+// ISO C++ 98 headers.
+#include <cstring>
+#include <map>
+#include <string>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! IMC packet header size (bytes).
+    static const std::size_t c_imc_header_size = 20;
+    //! IMC packet footer size (bytes).
+    static const std::size_t c_imc_footer_size = 2;
+    //! Offset of the message identifier in the IMC packet header.
+    static const std::size_t c_imc_id_offset = 2;
+    //! Offset of the payload size in the IMC packet header.
+    static const std::size_t c_imc_size_offset = 4;
+    //! IMC synchronization number.
+    static const uint16_t c_imc_sync = 0xfe54;
+    //! Maximum size of a bundle of IMC packets sent or received over SMS
+    //! or UDP (bytes). Larger messages are refused when sent.
+    static const std::size_t c_bundle_max_size = 8192;
+
+    //! Decodes bundles of back-to-back IMC packets received in one SMS
+    //! or datagram. Payloads are decoded into a fixed buffer and packets
+    //! are deserialized into one message object per identifier, reused
+    //! across bundles, so decoding does not allocate once warm. A bundle
+    //! is rejected as a whole if it does not split exactly into packets.
+    class PacketDecoder
+    {
+    public:
+      PacketDecoder(void):
+        m_size(0),
+        m_offset(0),
+        m_rejected(0)
+      { }
+
+      ~PacketDecoder(void)
+      {
+        std::map<uint16_t, IMC::Message*>::iterator itr = m_messages.begin();
+        for (; itr != m_messages.end(); ++itr)
+          delete itr->second;
+      }
+
+      //! Load a binary bundle.
+      //! @param[in] data bundle.
+      //! @param[in] size bundle size.
+      //! @return false if the bundle is too large or malformed.
+      bool
+      assign(const uint8_t* data, std::size_t size)
+      {
+        clear();
+        if (size > c_bundle_max_size)
+          return false;
+
+        std::memcpy(m_buffer, data, size);
+        m_size = size;
+        return check();
+      }
+
+      //! Load a Base64 encoded bundle.
+      //! @param[in] text Base64 text, line breaks are ignored.
+      //! @return false if the text is not Base64, or the bundle is too
+      //! large or malformed.
+      bool
+      decodeBase64(const std::string& text)
+      {
+        clear();
+        uint32_t bits = 0;
+        unsigned count = 0;
+        unsigned padding = 0;
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+          char c = text[i];
+          int value = -1;
+          if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+          else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+          else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+          else if (c == '+')
+            value = 62;
+          else if (c == '/')
+            value = 63;
+          else if (c == '=')
+            value = 0;
+          else if (c == '\r' || c == '\n')
+            continue;
+
+          //! Padding only at the end of the text.
+          if (value < 0 || (padding > 0 && c != '='))
+            return reject();
+
+          if (c == '=')
+            ++padding;
+
+          bits = (bits << 6) | value;
+          if (++count % 4 != 0)
+            continue;
+
+          if (padding > 2 || m_size + 3 - padding > c_bundle_max_size)
+            return reject();
+
+          m_buffer[m_size++] = bits >> 16;
+          if (padding < 2)
+            m_buffer[m_size++] = bits >> 8;
+          if (padding < 1)
+            m_buffer[m_size++] = bits;
+          bits = 0;
+        }
+
+        if (count == 0 || count % 4 != 0)
+          return reject();
+
+        return check();
+      }
+
+      //! Load a hexadecimal encoded bundle.
+      //! @param[in] text hexadecimal text.
+      //! @return false if the text is not hexadecimal, or the bundle is
+      //! too large or malformed.
+      bool
+      decodeHex(const std::string& text)
+      {
+        clear();
+        if (text.size() % 2 != 0 || text.size() / 2 > c_bundle_max_size)
+          return reject();
+
+        for (std::size_t i = 0; i < text.size(); i += 2)
+        {
+          int high = getNibble(text[i]);
+          int low = getNibble(text[i + 1]);
+          if (high < 0 || low < 0)
+            return reject();
+
+          m_buffer[m_size++] = (high << 4) | low;
+        }
+
+        return check();
+      }
+
+      //! Deserialize the next packet of the bundle. Corrupt packets are
+      //! skipped and counted.
+      //! @return message, valid until the next call, or NULL at the end
+      //! of the bundle.
+      const IMC::Message*
+      next(void)
+      {
+        while (m_offset < m_size)
+        {
+          const uint8_t* ptr = m_buffer + m_offset;
+          std::size_t length = getLength(ptr);
+          m_offset += length;
+
+          uint16_t id = getField(ptr, c_imc_id_offset);
+
+          try
+          {
+            IMC::Message*& msg = m_messages[id];
+            if (msg == NULL)
+              msg = IMC::Factory::produce(id);
+
+            if (msg != NULL)
+              return IMC::Packet::deserialize(ptr, length, msg);
+          }
+          catch (...) //InvalidMessageId || InvalidCrc
+          { }
+
+          ++m_rejected;
+        }
+
+        return NULL;
+      }
+
+      //! @return number of corrupt packets skipped since the last call.
+      unsigned
+      getRejected(void)
+      {
+        unsigned rejected = m_rejected;
+        m_rejected = 0;
+        return rejected;
+      }
+
+    private:
+      //! Decoded bundle.
+      uint8_t m_buffer[c_bundle_max_size];
+      //! Bundle size.
+      std::size_t m_size;
+      //! Offset of the next packet.
+      std::size_t m_offset;
+      //! Corrupt packets skipped.
+      unsigned m_rejected;
+      //! Reusable messages by identifier.
+      std::map<uint16_t, IMC::Message*> m_messages;
+
+      void
+      clear(void)
+      {
+        m_size = 0;
+        m_offset = 0;
+      }
+
+      //! Drop a malformed bundle, so that next() finds no packets.
+      //! @return false.
+      bool
+      reject(void)
+      {
+        clear();
+        return false;
+      }
+
+      static int
+      getNibble(char c)
+      {
+        if (c >= '0' && c <= '9')
+          return c - '0';
+        if (c >= 'a' && c <= 'f')
+          return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+          return c - 'A' + 10;
+        return -1;
+      }
+
+      //! Read a 16 bit header field in the byte order of the packet,
+      //! given by its synchronization number, whatever the host order.
+      static uint16_t
+      getField(const uint8_t* ptr, std::size_t offset)
+      {
+        //! Little endian packets start with the low byte of the number.
+        if (ptr[0] == (c_imc_sync & 0xff))
+          return ptr[offset] | (ptr[offset + 1] << 8);
+
+        return (ptr[offset] << 8) | ptr[offset + 1];
+      }
+
+      //! Get the size of a packet from its header.
+      static std::size_t
+      getLength(const uint8_t* ptr)
+      {
+        return c_imc_header_size + getField(ptr, c_imc_size_offset) + c_imc_footer_size;
+      }
+
+      //! Check that the bundle splits exactly into packets.
+      bool
+      check(void)
+      {
+        std::size_t offset = 0;
+        while (offset < m_size)
+        {
+          const uint8_t* ptr = m_buffer + offset;
+          if (m_size - offset < c_imc_header_size + c_imc_footer_size)
+            return reject();
+
+          bool little = ptr[0] == (c_imc_sync & 0xff) && ptr[1] == (c_imc_sync >> 8);
+          bool big = ptr[0] == (c_imc_sync >> 8) && ptr[1] == (c_imc_sync & 0xff);
+          if (!little && !big)
+            return reject();
+
+          std::size_t length = getLength(ptr);
+          if (length > m_size - offset)
+            return reject();
+
+          offset += length;
+        }
+
+        m_offset = 0;
+        return m_size > 0;
+      }
+    };
+  }
+}
+#endif
@@ -0,0 +1,524 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_PDU_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_PDU_INCLUDED
+// ISO C++ 98 headers.
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    //! Septets in a single SMS with GSM 7 bit default alphabet.
+    static const unsigned c_pdu_max_septets = 160;
+    //! Septets in each part of a concatenated SMS (7 septets of UDH).
+    static const unsigned c_pdu_concat_septets = 153;
+    //! Octets in a single SMS with 8 bit data.
+    static const unsigned c_pdu_max_octets = 140;
+    //! Octets in each part of a concatenated SMS with 8 bit data.
+    static const unsigned c_pdu_concat_octets = 134;
+    //! Maximum number of parts of a concatenated SMS.
+    static const unsigned c_pdu_max_parts = 255;
+    //! GSM 7 bit escape to extension table.
+    static const uint8_t c_gsm7_escape = 0x1b;
+    //! Data coding scheme for GSM 7 bit default alphabet.
+    static const uint8_t c_dcs_gsm7 = 0x00;
+    //! Data coding scheme for 8 bit data.
+    static const uint8_t c_dcs_8bit = 0x04;
+
+    //! SMS protocol data unit (3GPP TS 23.040) encoding of SMS-SUBMIT and
+    //! decoding of SMS-DELIVER messages, used in PDU mode (+CMGF=0).
+    class Pdu
+    {
+    public:
+      //! Decoded SMS-DELIVER.
+      struct Deliver
+      {
+        // Originating address.
+        std::string origin;
+        // Text (UTF-8) or binary data.
+        std::string data;
+        // True if the data coding scheme is 8 bit data.
+        bool binary;
+        // Concatenated message reference.
+        unsigned ref;
+        // Number of parts, 1 if not concatenated.
+        unsigned total;
+        // Sequence number of this part (starting at 1).
+        unsigned seq;
+      };
+
+      //! Encode text with the GSM 7 bit default alphabet. Characters
+      //! outside the alphabet are replaced by '?'.
+      //! @param[in] text text to encode.
+      //! @param[out] septets encoded septets.
+      static void
+      encodeText(const std::string& text, std::vector<uint8_t>& septets)
+      {
+        septets.clear();
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+          uint8_t c = text[i];
+          switch (c)
+          {
+            case '@': septets.push_back(0x00); break;
+            case '$': septets.push_back(0x02); break;
+            case '_': septets.push_back(0x11); break;
+            case '`': septets.push_back('\''); break;
+            case '^': escape(septets, 0x14); break;
+            case '{': escape(septets, 0x28); break;
+            case '}': escape(septets, 0x29); break;
+            case '\\': escape(septets, 0x2f); break;
+            case '[': escape(septets, 0x3c); break;
+            case '~': escape(septets, 0x3d); break;
+            case ']': escape(septets, 0x3e); break;
+            case '|': escape(septets, 0x40); break;
+            default:
+              if (c == '\n' || c == '\r' || (c >= 0x20 && c < 0x7f))
+                septets.push_back(c);
+              else
+                septets.push_back('?');
+              break;
+          }
+        }
+      }
+
+      //! Split encoded text in the parts of a concatenated SMS, without
+      //! breaking escape sequences.
+      //! @param[in] septets encoded text.
+      //! @param[out] parts septets of each part.
+      static void
+      split(const std::vector<uint8_t>& septets, std::vector<std::vector<uint8_t> >& parts)
+      {
+        parts.clear();
+        if (septets.size() <= c_pdu_max_septets)
+        {
+          parts.push_back(septets);
+          return;
+        }
+
+        std::size_t begin = 0;
+        while (begin < septets.size())
+        {
+          std::size_t end = std::min(begin + c_pdu_concat_septets, septets.size());
+          if (end < septets.size() && septets[end - 1] == c_gsm7_escape)
+            --end;
+
+          parts.push_back(std::vector<uint8_t>(septets.begin() + begin, septets.begin() + end));
+          begin = end;
+        }
+      }
+
+      //! Split binary data in the parts of a concatenated SMS.
+      //! @param[in] data data to send.
+      //! @param[out] parts octets of each part.
+      static void
+      splitData(const std::string& data, std::vector<std::vector<uint8_t> >& parts)
+      {
+        parts.clear();
+        if (data.size() <= c_pdu_max_octets)
+        {
+          parts.push_back(std::vector<uint8_t>(data.begin(), data.end()));
+          return;
+        }
+
+        for (std::size_t begin = 0; begin < data.size(); begin += c_pdu_concat_octets)
+        {
+          std::size_t end = std::min<std::size_t>(begin + c_pdu_concat_octets, data.size());
+          parts.push_back(std::vector<uint8_t>(data.begin() + begin, data.begin() + end));
+        }
+      }
+
+      //! Encode a SMS-SUBMIT.
+      //! @param[in] number destination number.
+      //! @param[in] user_data septets (GSM 7 bit) or octets (8 bit data).
+      //! @param[in] dcs data coding scheme.
+      //! @param[in] ref concatenated message reference.
+      //! @param[in] total total number of parts, 1 for a single SMS.
+      //! @param[in] seq sequence number of this part (starting at 1).
+      //! @param[out] tpdu_size size of the TPDU in octets (for +CMGS).
+      //! @return PDU hexadecimal string.
+      static std::string
+      encodeSubmit(const std::string& number, const std::vector<uint8_t>& user_data, uint8_t dcs,
+                   uint8_t ref, uint8_t total, uint8_t seq, unsigned& tpdu_size)
+      {
+        std::vector<uint8_t> tpdu;
+        bool concat = total > 1;
+
+        //! SMS-SUBMIT, no validity period, user data header indicator.
+        tpdu.push_back(concat ? 0x41 : 0x01);
+        //! Message reference assigned by the modem.
+        tpdu.push_back(0x00);
+        encodeAddress(number, tpdu);
+        //! Protocol identifier.
+        tpdu.push_back(0x00);
+        tpdu.push_back(dcs);
+
+        std::vector<uint8_t> udh;
+        if (concat)
+        {
+          //! Concatenated short message, 8 bit reference.
+          const uint8_t ie[] = {0x05, 0x00, 0x03, ref, total, seq};
+          udh.assign(ie, ie + sizeof(ie));
+        }
+
+        if (dcs == c_dcs_gsm7)
+        {
+          //! User data header is padded to a septet boundary.
+          unsigned udh_septets = (udh.size() * 8 + 6) / 7;
+          tpdu.push_back(udh_septets + user_data.size());
+          tpdu.insert(tpdu.end(), udh.begin(), udh.end());
+          packSeptets(user_data, udh_septets * 7 - udh.size() * 8, tpdu);
+        }
+        else
+        {
+          tpdu.push_back(udh.size() + user_data.size());
+          tpdu.insert(tpdu.end(), udh.begin(), udh.end());
+          tpdu.insert(tpdu.end(), user_data.begin(), user_data.end());
+        }
+
+        tpdu_size = tpdu.size();
+        //! Use SMSC stored in the SIM.
+        return "00" + toHex(tpdu);
+      }
+
+      //! Decode a SMS-DELIVER, as listed by +CMGL or read by +CMGR.
+      //! @param[in] hex PDU hexadecimal string, including SMSC address.
+      //! @param[out] deliver decoded message.
+      //! @return false if the PDU is malformed or not a SMS-DELIVER.
+      static bool
+      decodeDeliver(const std::string& hex, Deliver& deliver)
+      {
+        std::vector<uint8_t> pdu;
+        if (!fromHex(hex, pdu) || pdu.empty())
+          return false;
+
+        //! Skip SMSC address.
+        std::size_t pos = 1 + pdu[0];
+        if (pos >= pdu.size())
+          return false;
+
+        uint8_t first = pdu[pos++];
+        if ((first & 0x03) != 0x00)
+          return false;
+
+        if (!decodeAddress(pdu, pos, deliver.origin))
+          return false;
+
+        //! PID, DCS, service centre time stamp and user data length.
+        if (pos + 10 > pdu.size())
+          return false;
+
+        uint8_t dcs = pdu[pos + 1];
+        unsigned udl = pdu[pos + 9];
+        pos += 10;
+
+        unsigned alphabet = 0;
+        if ((dcs & 0xc0) == 0x00)
+          alphabet = (dcs >> 2) & 0x03;
+        else if ((dcs & 0xf0) == 0xf0)
+          alphabet = (dcs >> 2) & 0x01;
+
+        const uint8_t* ud = &pdu[0] + pos;
+        std::size_t ud_size = pdu.size() - pos;
+        std::size_t udh_size = 0;
+
+        deliver.ref = 0;
+        deliver.total = 1;
+        deliver.seq = 1;
+
+        if (first & 0x40)
+        {
+          if (ud_size == 0 || ud[0] + 1u > ud_size)
+            return false;
+
+          udh_size = ud[0] + 1;
+          decodeHeader(ud + 1, ud[0], deliver);
+        }
+
+        deliver.binary = (alphabet == 1);
+        deliver.data.clear();
+
+        if (alphabet == 0)
+        {
+          //! Septets, the first ones taken by the user data header.
+          if ((udl * 7 + 7) / 8 > ud_size)
+            return false;
+
+          unsigned skip = (udh_size * 8 + 6) / 7;
+          bool escaped = false;
+          for (unsigned i = skip; i < udl; ++i)
+          {
+            unsigned bit = i * 7;
+            unsigned value = ud[bit / 8] >> (bit % 8);
+            if (bit % 8 > 1)
+              value |= ud[bit / 8 + 1] << (8 - bit % 8);
+
+            appendSeptet(value & 0x7f, escaped, deliver.data);
+          }
+        }
+        else
+        {
+          if (udl > ud_size || udh_size > udl)
+            return false;
+
+          if (alphabet == 2)
+          {
+            for (std::size_t i = udh_size; i + 1 < udl; i += 2)
+              appendUtf8((ud[i] << 8) | ud[i + 1], deliver.data);
+          }
+          else
+          {
+            deliver.data.assign((const char*)ud + udh_size, udl - udh_size);
+          }
+        }
+
+        return true;
+      }
+
+      //! Encode bytes as an hexadecimal string.
+      //! @param[in] data bytes to encode.
+      //! @return hexadecimal string.
+      static std::string
+      toHex(const std::vector<uint8_t>& data)
+      {
+        static const char* c_digits = "0123456789ABCDEF";
+        std::string hex;
+        hex.reserve(data.size() * 2);
+        for (std::size_t i = 0; i < data.size(); ++i)
+        {
+          hex.push_back(c_digits[data[i] >> 4]);
+          hex.push_back(c_digits[data[i] & 0x0f]);
+        }
+        return hex;
+      }
+
+      //! Decode an hexadecimal string.
+      //! @param[in] hex hexadecimal string.
+      //! @param[out] data decoded bytes.
+      //! @return false if the string is not valid hexadecimal.
+      static bool
+      fromHex(const std::string& hex, std::vector<uint8_t>& data)
+      {
+        if (hex.size() % 2 != 0)
+          return false;
+
+        data.resize(hex.size() / 2);
+        for (std::size_t i = 0; i < data.size(); ++i)
+        {
+          int hi = nibble(hex[i * 2]);
+          int lo = nibble(hex[i * 2 + 1]);
+          if (hi < 0 || lo < 0)
+            return false;
+
+          data[i] = (hi << 4) | lo;
+        }
+        return true;
+      }
+
+    private:
+      static void
+      escape(std::vector<uint8_t>& septets, uint8_t c)
+      {
+        septets.push_back(c_gsm7_escape);
+        septets.push_back(c);
+      }
+
+      static int
+      nibble(char c)
+      {
+        if (c >= '0' && c <= '9')
+          return c - '0';
+        if (c >= 'A' && c <= 'F')
+          return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f')
+          return c - 'a' + 10;
+        return -1;
+      }
+
+      //! Encode a phone number as address length, type and semi-octets.
+      static void
+      encodeAddress(const std::string& number, std::vector<uint8_t>& out)
+      {
+        std::string digits;
+        for (std::size_t i = 0; i < number.size(); ++i)
+        {
+          if (number[i] >= '0' && number[i] <= '9')
+            digits.push_back(number[i]);
+        }
+
+        out.push_back(digits.size());
+        //! International or unknown type of number, ISDN numbering plan.
+        out.push_back((!number.empty() && number[0] == '+') ? 0x91 : 0x81);
+
+        for (std::size_t i = 0; i < digits.size(); i += 2)
+        {
+          uint8_t lo = digits[i] - '0';
+          uint8_t hi = (i + 1 < digits.size()) ? digits[i + 1] - '0' : 0x0f;
+          out.push_back((hi << 4) | lo);
+        }
+      }
+
+      //! Decode an originating address.
+      static bool
+      decodeAddress(const std::vector<uint8_t>& pdu, std::size_t& pos, std::string& address)
+      {
+        if (pos + 2 > pdu.size())
+          return false;
+
+        unsigned digits = pdu[pos];
+        uint8_t type = pdu[pos + 1];
+        std::size_t size = (digits + 1) / 2;
+        pos += 2;
+
+        if (pos + size > pdu.size())
+          return false;
+
+        address.clear();
+        if ((type & 0x70) == 0x50)
+        {
+          //! Alphanumeric address in GSM 7 bit default alphabet.
+          bool escaped = false;
+          for (unsigned i = 0; i < digits * 4 / 7; ++i)
+          {
+            unsigned bit = i * 7;
+            unsigned value = pdu[pos + bit / 8] >> (bit % 8);
+            if (bit % 8 > 1 && bit / 8 + 1 < size)
+              value |= pdu[pos + bit / 8 + 1] << (8 - bit % 8);
+
+            appendSeptet(value & 0x7f, escaped, address);
+          }
+        }
+        else
+        {
+          if ((type & 0x70) == 0x10)
+            address.push_back('+');
+
+          for (unsigned i = 0; i < digits; ++i)
+          {
+            uint8_t d = (i % 2) ? (pdu[pos + i / 2] >> 4) : (pdu[pos + i / 2] & 0x0f);
+            address.push_back(d < 10 ? '0' + d : '?');
+          }
+        }
+
+        pos += size;
+        return true;
+      }
+
+      //! Extract concatenation information from a user data header.
+      static void
+      decodeHeader(const uint8_t* udh, std::size_t size, Deliver& deliver)
+      {
+        std::size_t pos = 0;
+        while (pos + 2 <= size)
+        {
+          uint8_t iei = udh[pos];
+          uint8_t len = udh[pos + 1];
+          const uint8_t* ie = udh + pos + 2;
+          if (pos + 2 + len > size)
+            return;
+
+          if (iei == 0x00 && len == 3)
+          {
+            deliver.ref = ie[0];
+            deliver.total = ie[1];
+            deliver.seq = ie[2];
+          }
+          else if (iei == 0x08 && len == 4)
+          {
+            deliver.ref = (ie[0] << 8) | ie[1];
+            deliver.total = ie[2];
+            deliver.seq = ie[3];
+          }
+
+          pos += 2 + len;
+        }
+      }
+
+      //! Append a GSM 7 bit character as ASCII or UTF-8.
+      static void
+      appendSeptet(uint8_t septet, bool& escaped, std::string& out)
+      {
+        if (escaped)
+        {
+          escaped = false;
+          switch (septet)
+          {
+            case 0x14: out.push_back('^'); return;
+            case 0x28: out.push_back('{'); return;
+            case 0x29: out.push_back('}'); return;
+            case 0x2f: out.push_back('\\'); return;
+            case 0x3c: out.push_back('['); return;
+            case 0x3d: out.push_back('~'); return;
+            case 0x3e: out.push_back(']'); return;
+            case 0x40: out.push_back('|'); return;
+            case 0x65: appendUtf8(0x20ac, out); return;
+            default: out.push_back(' '); return;
+          }
+        }
+
+        switch (septet)
+        {
+          case 0x00: out.push_back('@'); return;
+          case 0x02: out.push_back('$'); return;
+          case 0x11: out.push_back('_'); return;
+          case c_gsm7_escape: escaped = true; return;
+          default:
+            break;
+        }
+
+        //! National characters map to '?', the rest matches ASCII.
+        if (septet == '\n' || septet == '\r' ||
+            (septet >= 0x20 && septet < 0x7f && septet != 0x24 && septet != 0x40 &&
+             (septet < 0x5b || septet > 0x60) && septet < 0x7b))
+          out.push_back(septet);
+        else
+          out.push_back('?');
+      }
+
+      //! Append an UCS-2 code point as UTF-8.
+      static void
+      appendUtf8(unsigned code, std::string& out)
+      {
+        if (code < 0x80)
+        {
+          out.push_back(code);
+        }
+        else if (code < 0x800)
+        {
+          out.push_back(0xc0 | (code >> 6));
+          out.push_back(0x80 | (code & 0x3f));
+        }
+        else
+        {
+          out.push_back(0xe0 | (code >> 12));
+          out.push_back(0x80 | ((code >> 6) & 0x3f));
+          out.push_back(0x80 | (code & 0x3f));
+        }
+      }
+
+      //! Pack septets into octets, least significant bit first.
+      //! @param[in] septets septets to pack.
+      //! @param[in] fill number of fill bits before the first septet.
+      //! @param[out] out packed octets are appended here.
+      static void
+      packSeptets(const std::vector<uint8_t>& septets, unsigned fill, std::vector<uint8_t>& out)
+      {
+        std::size_t base = out.size();
+        out.resize(base + (fill + septets.size() * 7 + 7) / 8, 0);
+
+        unsigned bit = fill;
+        for (std::size_t i = 0; i < septets.size(); ++i, bit += 7)
+        {
+          unsigned value = (septets[i] & 0x7f) << (bit % 8);
+          out[base + bit / 8] |= value & 0xff;
+          if ((value >> 8) != 0)
+            out[base + bit / 8 + 1] |= value >> 8;
+        }
+      }
+    };
+  }
+}
+#endif
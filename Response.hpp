@@ -0,0 +1,188 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_RESPONSE_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_RESPONSE_INCLUDED
+// ISO C++ 98 headers.
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    //! Maximum number of fields in a response line.
+    static const unsigned c_max_fields = 16;
+
+    //! Information response or URC line of the form
+    //! '+NAME: <f0>,<f1>,...'. Fields are views into the line buffer,
+    //! quoted fields may contain commas. No memory is allocated.
+    class Response
+    {
+    public:
+      //! View into a field of a response line.
+      struct Field
+      {
+        // First character.
+        const char* data;
+        // Number of characters.
+        std::size_t size;
+
+        bool
+        quoted(void) const
+        {
+          return size >= 2 && data[0] == '"' && data[size - 1] == '"';
+        }
+
+        //! @return field without surrounding quotes.
+        Field
+        unquote(void) const
+        {
+          Field f = *this;
+          if (quoted())
+          {
+            ++f.data;
+            f.size -= 2;
+          }
+          return f;
+        }
+
+        bool
+        equals(const char* str) const
+        {
+          return std::strlen(str) == size && std::memcmp(data, str, size) == 0;
+        }
+
+        //! Parse a decimal integer filling the whole field.
+        //! @param[out] value parsed value.
+        //! @return false if the field is not an integer or does not fit
+        //! in an int.
+        bool
+        toInt(int& value) const
+        {
+          std::size_t i = 0;
+          bool negative = false;
+          if (i < size && (data[i] == '-' || data[i] == '+'))
+            negative = (data[i++] == '-');
+
+          if (i == size)
+            return false;
+
+          int v = 0;
+          for (; i < size; ++i)
+          {
+            if (data[i] < '0' || data[i] > '9')
+              return false;
+            int digit = data[i] - '0';
+            if (v > (INT_MAX - digit) / 10)
+              return false;
+            v = v * 10 + digit;
+          }
+
+          value = negative ? -v : v;
+          return true;
+        }
+
+        std::string
+        str(void) const
+        {
+          return std::string(data, size);
+        }
+      };
+
+      //! Split a line if it starts with the given prefix.
+      //! @param[in] line response line, must outlive this object.
+      //! @param[in] prefix expected prefix, including the colon.
+      Response(const std::string& line, const char* prefix):
+        m_count(0),
+        m_valid(false)
+      {
+        std::size_t len = std::strlen(prefix);
+        if (line.size() < len || line.compare(0, len, prefix) != 0)
+          return;
+
+        m_valid = true;
+        const char* ptr = line.c_str() + len;
+        const char* end = line.c_str() + line.size();
+        while (ptr < end && *ptr == ' ')
+          ++ptr;
+
+        if (ptr == end)
+          return;
+
+        bool quote = false;
+        const char* begin = ptr;
+        for (; ptr <= end; ++ptr)
+        {
+          if (ptr < end && *ptr == '"')
+          {
+            quote = !quote;
+          }
+          else if (ptr == end || (*ptr == ',' && !quote))
+          {
+            if (m_count == c_max_fields)
+              return;
+
+            m_fields[m_count].data = begin;
+            m_fields[m_count].size = ptr - begin;
+            ++m_count;
+            begin = ptr + 1;
+          }
+        }
+      }
+
+      //! @return true if the line starts with the prefix.
+      bool
+      valid(void) const
+      {
+        return m_valid;
+      }
+
+      //! @return number of fields.
+      unsigned
+      size(void) const
+      {
+        return m_count;
+      }
+
+      const Field&
+      operator[](unsigned index) const
+      {
+        return m_fields[index];
+      }
+
+      //! Extract an integer field.
+      //! @param[in] index field index.
+      //! @param[out] value parsed value.
+      //! @return false if the field is missing or not an integer.
+      bool
+      getInt(unsigned index, int& value) const
+      {
+        return index < m_count && m_fields[index].toInt(value);
+      }
+
+      //! Extract a string field, without surrounding quotes.
+      //! @param[in] index field index.
+      //! @param[out] value field contents.
+      //! @return false if the field is missing.
+      bool
+      getString(unsigned index, std::string& value) const
+      {
+        if (index >= m_count)
+          return false;
+
+        Field f = m_fields[index].unquote();
+        value.assign(f.data, f.size);
+        return true;
+      }
+
+    private:
+      //! Fields of the line.
+      Field m_fields[c_max_fields];
+      //! Number of fields.
+      unsigned m_count;
+      //! Line starts with the prefix.
+      bool m_valid;
+    };
+  }
+}
+#endif
@@ -0,0 +1,564 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_SERIAL_TRACE_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_SERIAL_TRACE_INCLUDED
+// ISO C++ 98 headers.
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <unistd.h>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! Trace file signature.
+    static const uint32_t c_trace_magic = 0x43525453;
+    //! Maximum bytes in a trace record, the top bit of the length
+    //! holds the direction.
+    static const std::size_t c_trace_max_chunk = 0x7fff;
+    //! Maximum bytes kept in memory, whatever the window.
+    static const std::size_t c_trace_max_size = 8 * 1024 * 1024;
+    //! Time after the modem is opened always kept, so that replays
+    //! start with the initialization (s).
+    static const double c_trace_head_time = 60.0;
+    //! Maximum bytes kept after the modem is opened.
+    static const std::size_t c_trace_head_size = 256 * 1024;
+
+    //! Serial traffic in both directions, with monotonic timestamps.
+    //! The start of the modem session and the last minutes are kept in
+    //! memory and written to a file on demand. Records are stored as
+    //! time since the previous record (4, us), direction and length (2)
+    //! and data, after the signature. An empty sent record marks records
+    //! dropped between the session start and the last minutes.
+    class SerialTrace
+    {
+    public:
+      //! Serial I/O chunk.
+      struct Record
+      {
+        // Monotonic time (s).
+        double time;
+        // Sent to the modem.
+        bool sent;
+        // Bytes.
+        std::string data;
+      };
+
+      //! Records, oldest first.
+      typedef std::deque<Record> Records;
+
+      SerialTrace(void):
+        m_window(0),
+        m_size(0),
+        m_session_start(-1),
+        m_head_size(0),
+        m_pruned(false)
+      { }
+
+      //! Set the time kept in memory.
+      //! @param[in] window time (s), zero disables recording.
+      void
+      setWindow(double window)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        m_window = window;
+        prune(Clock::get());
+      }
+
+      bool
+      isEnabled(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        return m_window > 0;
+      }
+
+      bool
+      isEmpty(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        return m_head.empty() && m_records.empty();
+      }
+
+      //! Drop all records and start recording a new modem session, whose
+      //! first records are kept whatever the window.
+      void
+      startSession(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        m_head.clear();
+        m_records.clear();
+        m_size = 0;
+        m_session_start = Clock::get();
+        m_head_size = 0;
+        m_pruned = false;
+      }
+
+      //! Record serial I/O.
+      //! @param[in] sent bytes were sent to the modem.
+      //! @param[in] data bytes.
+      //! @param[in] size number of bytes.
+      void
+      add(bool sent, const uint8_t* data, std::size_t size)
+      {
+        if (size == 0)
+          return;
+
+        double now = Clock::get();
+        Concurrency::ScopedMutex l(m_lock);
+        if (m_window <= 0)
+          return;
+
+        bool head = m_session_start >= 0 && m_records.empty() && now - m_session_start <= c_trace_head_time &&
+                    m_head_size + size <= c_trace_head_size;
+        Records& records = head ? m_head : m_records;
+        records.push_back(Record());
+        records.back().time = now;
+        records.back().sent = sent;
+        records.back().data.assign((const char*)data, size);
+        if (head)
+        {
+          m_head_size += size;
+          return;
+        }
+
+        m_size += size;
+        prune(now);
+      }
+
+      //! Write the records kept in memory to a file.
+      //! @param[in] path trace file.
+      //! @return number of records written.
+      unsigned
+      save(const std::string& path)
+      {
+        Records records;
+        {
+          Concurrency::ScopedMutex l(m_lock);
+          records = m_head;
+          //! Mark the records dropped after the session start.
+          if (m_pruned || (m_head.empty() && !m_records.empty()))
+          {
+            records.push_back(Record());
+            records.back().time = m_records.empty() ? Clock::get() : m_records.front().time;
+            records.back().sent = true;
+          }
+          records.insert(records.end(), m_records.begin(), m_records.end());
+        }
+
+        std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file)
+          throw std::runtime_error(String::str(DTR("failed to create trace %s"), path.c_str()));
+
+        file.write((const char*)&c_trace_magic, sizeof(c_trace_magic));
+        double last = records.empty() ? 0 : records.front().time;
+        unsigned count = 0;
+        for (std::size_t i = 0; i < records.size(); ++i)
+        {
+          const Record& rec = records[i];
+          //! Gaps longer than about 71 minutes are shortened.
+          uint32_t delta = (uint32_t)std::min((rec.time - last) * 1e6, 4294967295.0);
+          std::size_t offset = 0;
+          do
+          {
+            uint16_t length = std::min(rec.data.size() - offset, c_trace_max_chunk);
+            uint16_t header = length | (rec.sent ? 0x8000 : 0);
+            file.write((const char*)&delta, sizeof(delta));
+            file.write((const char*)&header, sizeof(header));
+            file.write(rec.data.data() + offset, length);
+            last = rec.time;
+            delta = 0;
+            offset += length;
+            ++count;
+          }
+          while (offset < rec.data.size());
+        }
+
+        if (!file)
+          throw std::runtime_error(String::str(DTR("failed to write trace %s"), path.c_str()));
+
+        return count;
+      }
+
+      //! Read a trace file. Times start at zero, gap markers are records
+      //! sent with no data.
+      //! @param[in] path trace file.
+      //! @param[out] records records.
+      static void
+      load(const std::string& path, Records& records)
+      {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        uint32_t magic = 0;
+        file.read((char*)&magic, sizeof(magic));
+        if (!file || magic != c_trace_magic)
+          throw std::runtime_error(String::str(DTR("invalid trace %s"), path.c_str()));
+
+        double time = 0;
+        uint32_t delta = 0;
+        uint16_t header = 0;
+        while (file.read((char*)&delta, sizeof(delta)) && file.read((char*)&header, sizeof(header)))
+        {
+          Record rec;
+          time += delta / 1e6;
+          rec.time = time;
+          rec.sent = (header & 0x8000) != 0;
+          rec.data.resize(header & c_trace_max_chunk);
+          if (!file.read(&rec.data[0], rec.data.size()))
+            break;
+
+          records.push_back(rec);
+        }
+      }
+
+    private:
+      //! Time kept in memory (s).
+      double m_window;
+      //! Records after the session start, oldest first.
+      Records m_records;
+      //! Bytes in records.
+      std::size_t m_size;
+      //! Records at the start of the session, never pruned.
+      Records m_head;
+      //! Time the modem session started, negative if unknown.
+      double m_session_start;
+      //! Bytes in head records.
+      std::size_t m_head_size;
+      //! Records were pruned since the session started.
+      bool m_pruned;
+      //! Lock for records, added by the reader and engine threads.
+      Concurrency::Mutex m_lock;
+
+      //! Drop records older than the window or over the size limit.
+      void
+      prune(double now)
+      {
+        while (!m_records.empty())
+        {
+          const Record& rec = m_records.front();
+          if (m_window > 0 && now - rec.time <= m_window && m_size <= c_trace_max_size)
+            break;
+
+          m_size -= rec.data.size();
+          m_records.pop_front();
+          m_pruned = true;
+        }
+      }
+    };
+
+    //! Serial port wrapper recording all I/O in a trace.
+    class TraceRecorder: public IO::Handle
+    {
+    public:
+      //! Constructor.
+      //! @param[in] handle serial port, deleted with the recorder.
+      //! @param[in] trace trace.
+      TraceRecorder(IO::Handle* handle, SerialTrace* trace):
+        m_handle(handle),
+        m_trace(trace)
+      { }
+
+      ~TraceRecorder(void)
+      {
+        delete m_handle;
+      }
+
+    private:
+      //! Serial port.
+      IO::Handle* m_handle;
+      //! Trace.
+      SerialTrace* m_trace;
+
+      NativeHandle
+      doGetNative(void) const
+      {
+        return m_handle->getNative();
+      }
+
+      size_t
+      doWrite(const uint8_t* data, size_t size)
+      {
+        size_t rv = m_handle->write(data, size);
+        m_trace->add(true, data, rv);
+        return rv;
+      }
+
+      size_t
+      doRead(uint8_t* data, size_t size)
+      {
+        size_t rv = m_handle->read(data, size);
+        m_trace->add(false, data, rv);
+        return rv;
+      }
+
+      void
+      doFlushInput(void)
+      {
+        m_handle->flushInput();
+      }
+
+      void
+      doFlushOutput(void)
+      {
+        m_handle->flushOutput();
+      }
+
+      void
+      doFlush(void)
+      {
+        m_handle->flush();
+      }
+    };
+
+    //! Serial port stand-in replaying a trace. Received bytes are fed
+    //! through a pipe, so that the modem reader thread polls it as a
+    //! serial port. A received record is only fed once the modem has
+    //! written everything that preceded it in the trace, which keeps
+    //! replays deterministic, and after the original delay divided by
+    //! the replay speed. Written bytes are compared with the trace.
+    //! At the start of the trace and after a gap marker the replay
+    //! skips ahead: it waits for the modem to write the next sent
+    //! record, ignoring anything written before, and carries on from
+    //! there. Traces recorded mid-session can then be replayed as far
+    //! as the driver reproduces their commands.
+    class TraceReplay: public IO::Handle, public Concurrency::Thread
+    {
+    public:
+      //! Constructor.
+      //! @param[in] path trace file.
+      //! @param[in] speed replay speed, zero for no delays.
+      TraceReplay(const std::string& path, double speed):
+        m_speed(speed),
+        m_written(0),
+        m_mismatches(0),
+        m_done(false),
+        m_syncing(false),
+        m_sync_offset(0)
+      {
+        SerialTrace::load(path, m_records);
+        for (std::size_t i = 0; i < m_records.size(); ++i)
+        {
+          if (m_records[i].sent)
+            m_expected.append(m_records[i].data);
+        }
+
+        //! The modem may write as soon as it is opened.
+        startSync(0, 0);
+
+        int fds[2];
+        if (::pipe(fds) != 0)
+          throw std::runtime_error(DTR("failed to create replay pipe"));
+
+        m_read_fd = fds[0];
+        m_write_fd = fds[1];
+        ::fcntl(m_read_fd, F_SETFL, O_NONBLOCK);
+      }
+
+      ~TraceReplay(void)
+      {
+        stopAndJoin();
+        ::close(m_read_fd);
+        ::close(m_write_fd);
+      }
+
+      //! Get replay progress.
+      //! @param[out] mismatches written bytes that differ from the trace.
+      //! @return true if the whole trace was replayed.
+      bool
+      isDone(unsigned& mismatches)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        mismatches = m_mismatches;
+        return m_done;
+      }
+
+    private:
+      //! Replay speed.
+      double m_speed;
+      //! Trace.
+      SerialTrace::Records m_records;
+      //! Bytes sent in the trace.
+      std::string m_expected;
+      //! Bytes written by the modem.
+      std::size_t m_written;
+      //! Written bytes that differ from the trace.
+      unsigned m_mismatches;
+      //! Whole trace replayed.
+      bool m_done;
+      //! Waiting for the modem to write m_sync.
+      bool m_syncing;
+      //! Sent record to skip ahead to.
+      std::string m_sync;
+      //! Trace offset of the bytes sent after m_sync.
+      std::size_t m_sync_offset;
+      //! Last bytes written while skipping ahead.
+      std::string m_sync_tail;
+      //! Pipe ends.
+      int m_read_fd;
+      int m_write_fd;
+      //! Lock for counters.
+      Concurrency::Mutex m_lock;
+
+      //! Get the number of bytes written by the modem.
+      std::size_t
+      getWritten(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        return m_written;
+      }
+
+      //! Skip ahead to the first sent record from an index: anything the
+      //! modem writes before it is ignored. Started before the modem can
+      //! write that record.
+      //! @param[in] index first record.
+      //! @param[in] offset trace offset of the bytes sent before it.
+      void
+      startSync(std::size_t index, std::size_t offset)
+      {
+        while (index < m_records.size() && !(m_records[index].sent && !m_records[index].data.empty()))
+          ++index;
+
+        if (index == m_records.size())
+          return;
+
+        Concurrency::ScopedMutex l(m_lock);
+        m_sync = m_records[index].data;
+        m_sync_offset = offset + m_sync.size();
+        m_sync_tail.clear();
+        m_syncing = true;
+      }
+
+      //! Wait for the modem to write the record started by startSync().
+      void
+      waitSync(void)
+      {
+        while (!isStopping())
+        {
+          {
+            Concurrency::ScopedMutex l(m_lock);
+            if (!m_syncing)
+              return;
+          }
+
+          Delay::waitMsec(1);
+        }
+      }
+
+      void
+      run(void)
+      {
+        double mark = Clock::get();
+        double last = 0;
+        std::size_t sent = 0;
+        bool skip = true;
+        for (std::size_t i = 0; i < m_records.size() && !isStopping(); ++i)
+        {
+          const SerialTrace::Record& rec = m_records[i];
+          if (rec.sent && rec.data.empty())
+          {
+            if (!skip)
+              startSync(i + 1, sent);
+            skip = true;
+          }
+          else if (rec.sent)
+          {
+            sent += rec.data.size();
+            if (skip)
+              waitSync();
+            skip = false;
+
+            while (getWritten() < sent && !isStopping())
+              Delay::waitMsec(1);
+          }
+          else
+          {
+            if (m_speed > 0)
+            {
+              double wait = mark + (rec.time - last) / m_speed - Clock::get();
+              if (wait > 0)
+                Delay::wait(wait);
+            }
+
+            //! The modem may answer with the command after the gap.
+            if (!skip && i + 1 < m_records.size() && m_records[i + 1].sent && m_records[i + 1].data.empty())
+            {
+              startSync(i + 2, sent);
+              skip = true;
+            }
+
+            if (::write(m_write_fd, rec.data.data(), rec.data.size()) < 0)
+              break;
+          }
+
+          mark = Clock::get();
+          last = rec.time;
+        }
+
+        Concurrency::ScopedMutex l(m_lock);
+        m_done = true;
+      }
+
+      NativeHandle
+      doGetNative(void) const
+      {
+        return m_read_fd;
+      }
+
+      size_t
+      doWrite(const uint8_t* data, size_t size)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        for (size_t i = 0; i < size; ++i)
+        {
+          if (m_syncing)
+          {
+            m_sync_tail.push_back(data[i]);
+            if (m_sync_tail.size() > m_sync.size())
+              m_sync_tail.erase(0, 1);
+
+            if (m_sync_tail == m_sync)
+            {
+              m_written = m_sync_offset;
+              m_syncing = false;
+            }
+            continue;
+          }
+
+          if (m_written >= m_expected.size() || (uint8_t)m_expected[m_written] != data[i])
+            ++m_mismatches;
+          ++m_written;
+        }
+
+        return size;
+      }
+
+      size_t
+      doRead(uint8_t* data, size_t size)
+      {
+        ssize_t rv = ::read(m_read_fd, data, size);
+        return rv < 0 ? 0 : rv;
+      }
+
+      //! Input was already flushed when the trace was recorded.
+      void
+      doFlushInput(void)
+      { }
+
+      void
+      doFlushOutput(void)
+      { }
+
+      void
+      doFlush(void)
+      { }
+    };
+  }
+}
+#endif
@@ -0,0 +1,123 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_SMS_ERROR_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_SMS_ERROR_INCLUDED
+// ISO C++ 98 headers.
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! Unknown +CMS ERROR code.
+    static const int c_cms_unknown = -1;
+
+    //! Verbose +CMS ERROR texts of permanent errors, with their codes.
+    static const struct
+    {
+      int code;
+      const char* text;
+    } c_cms_permanent[] =
+    {
+      {1, "unassigned (unallocated) number"},
+      {8, "operator determined barring"},
+      {10, "call barred"},
+      {21, "short message transfer rejected"},
+      {28, "unidentified subscriber"},
+      {29, "facility rejected"},
+      {30, "unknown subscriber"},
+      {50, "requested facility not subscribed"},
+      {69, "requested facility not implemented"},
+      {96, "invalid mandatory information"},
+      {97, "message type non-existent or not implemented"},
+      {98, "message not compatible with short message protocol state"},
+      {99, "information element non-existent or not implemented"},
+      {193, "no sc subscription"},
+      {195, "invalid sme address"},
+      {196, "destination sme barred"},
+      {197, "sm rejected-duplicate sm"},
+      {198, "tp-vpf not supported"},
+      {199, "tp-vp not supported"},
+      {301, "sms service of me reserved"},
+      {302, "operation not allowed"},
+      {303, "operation not supported"},
+      {304, "invalid pdu mode parameter"},
+      {305, "invalid text mode parameter"},
+      {330, "smsc address unknown"}
+    };
+
+    //! SMS submission rejected with +CMS ERROR. Permanent errors (bad
+    //! destination, barring, unsupported contents) will fail again if
+    //! retried, the remaining ones (network, congestion, storage) may
+    //! not. Codes follow 3GPP TS 27.005 and 24.011.
+    class SmsError: public std::runtime_error
+    {
+    public:
+      //! Constructor.
+      //! @param[in] reply +CMS ERROR parameter, numeric or verbose.
+      SmsError(const std::string& reply):
+        std::runtime_error(String::str(DTR("SMS transmission failed with error %s"), reply.c_str())),
+        m_code(c_cms_unknown),
+        m_permanent(false)
+      {
+        classify(reply);
+      }
+
+      //! @return error code, c_cms_unknown if not known.
+      int
+      getCode(void) const
+      {
+        return m_code;
+      }
+
+      //! @return true if retrying will not help.
+      bool
+      isPermanent(void) const
+      {
+        return m_permanent;
+      }
+
+    private:
+      //! Error code.
+      int m_code;
+      //! Error is permanent.
+      bool m_permanent;
+
+      void
+      classify(const std::string& reply)
+      {
+        std::string text = String::trim(reply);
+        char* end = NULL;
+        long code = std::strtol(text.c_str(), &end, 10);
+        if (!text.empty() && *end == '\0')
+        {
+          m_code = code;
+          //! TP-PID, TP-DCS and TP-Command errors, TPDU not supported.
+          m_permanent = (code >= 128 && code <= 176);
+        }
+        else
+        {
+          for (std::size_t i = 0; i < text.size(); ++i)
+            text[i] = std::tolower(text[i]);
+        }
+
+        for (std::size_t i = 0; i < sizeof(c_cms_permanent) / sizeof(c_cms_permanent[0]); ++i)
+        {
+          if (c_cms_permanent[i].code == m_code || text == c_cms_permanent[i].text)
+          {
+            m_code = c_cms_permanent[i].code;
+            m_permanent = true;
+            break;
+          }
+        }
+      }
+    };
+  }
+}
+#endif
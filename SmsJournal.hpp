@@ -0,0 +1,347 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_SMS_JOURNAL_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_SMS_JOURNAL_INCLUDED
+// ISO C++ 98 headers.
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! Journal file signature.
+    static const uint32_t c_journal_magic = 0x4a534d53;
+    //! Journal format version, bumped whenever the payload layout
+    //! changes. Files written before the version was added have their
+    //! first record length here, never equal to a version.
+    static const uint32_t c_journal_version = 2;
+    //! File header: signature (4) and format version (4).
+    static const std::size_t c_journal_file_header = 8;
+    //! Minimum journal file size.
+    static const std::size_t c_journal_size = 64 * 1024;
+    //! Record header: payload length (4), checksum (4), type (1), id (4).
+    static const std::size_t c_journal_header = 13;
+
+    //! Append-only journal of records identified by id, memory mapped
+    //! so that appending is a memory copy. Pages are written back by the
+    //! kernel, the journal survives the task or process crashing. An
+    //! 'add' record stores a payload (the last one with a given id wins)
+    //! and a 'remove' record drops it. When the file fills up it is
+    //! rewritten with the live records only.
+    class SmsJournal
+    {
+    public:
+      //! Live payloads by id.
+      typedef std::map<uint32_t, std::string> Records;
+
+      SmsJournal(void):
+        m_fd(-1),
+        m_data(NULL),
+        m_size(0),
+        m_offset(0),
+        m_live_size(0)
+      { }
+
+      ~SmsJournal(void)
+      {
+        close();
+      }
+
+      bool
+      isOpen(void) const
+      {
+        return m_data != NULL;
+      }
+
+      //! Open a journal, creating it if needed, and replay its records.
+      //! Replay stops at the first torn or corrupt record. A journal of
+      //! another format version is moved aside, see getRejected().
+      //! @param[in] path journal file.
+      //! @return live payloads by id.
+      const Records&
+      open(const std::string& path)
+      {
+        close();
+        m_path = path;
+        m_live.clear();
+        m_live_size = 0;
+        m_rejected.clear();
+
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (m_fd < 0)
+          throw std::runtime_error(String::str(DTR("failed to open journal %s"), path.c_str()));
+
+        uint32_t header[2] = {0, 0};
+        if (::pread(m_fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+            header[0] == c_journal_magic && header[1] != c_journal_version)
+        {
+          //! Keep the records for inspection instead of overwriting them.
+          std::string old = path + ".old";
+          ::close(m_fd);
+          std::rename(path.c_str(), old.c_str());
+          m_rejected = String::str(DTR("incompatible journal moved to %s"), old.c_str());
+          m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+          if (m_fd < 0)
+            throw std::runtime_error(String::str(DTR("failed to open journal %s"), path.c_str()));
+        }
+
+        struct stat st;
+        std::size_t size = c_journal_size;
+        if (fstat(m_fd, &st) == 0 && (std::size_t)st.st_size > size)
+          size = st.st_size;
+
+        map(size);
+
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        std::memcpy(&magic, m_data, sizeof(magic));
+        std::memcpy(&version, m_data + sizeof(magic), sizeof(version));
+        m_offset = c_journal_file_header;
+        if (magic == c_journal_magic && version == c_journal_version)
+          replay();
+
+        //! Clear any torn record left after the last valid one.
+        std::memset(m_data + m_offset, 0, m_size - m_offset);
+        writeHeader();
+        return m_live;
+      }
+
+      //! @return why the journal found on open was not replayed, empty
+      //! if it was.
+      const std::string&
+      getRejected(void) const
+      {
+        return m_rejected;
+      }
+
+      void
+      close(void)
+      {
+        if (m_data != NULL)
+        {
+          munmap(m_data, m_size);
+          m_data = NULL;
+        }
+
+        if (m_fd >= 0)
+        {
+          ::close(m_fd);
+          m_fd = -1;
+        }
+      }
+
+      //! Store a payload.
+      //! @param[in] id record id.
+      //! @param[in] payload record payload.
+      void
+      add(uint32_t id, const std::string& payload)
+      {
+        std::string& live = m_live[id];
+        m_live_size -= live.size();
+        m_live_size += payload.size();
+        live = payload;
+        append(RECORD_ADD, id, payload);
+      }
+
+      //! Drop a payload.
+      //! @param[in] id record id.
+      void
+      remove(uint32_t id)
+      {
+        Records::iterator itr = m_live.find(id);
+        if (itr == m_live.end())
+          return;
+
+        m_live_size -= itr->second.size();
+        m_live.erase(itr);
+        append(RECORD_REMOVE, id, std::string());
+      }
+
+    private:
+      //! Record types.
+      enum RecordType
+      {
+        RECORD_ADD    = 1,
+        RECORD_REMOVE = 2
+      };
+
+      //! File descriptor.
+      int m_fd;
+      //! Mapped file.
+      uint8_t* m_data;
+      //! Mapped size.
+      std::size_t m_size;
+      //! Write offset.
+      std::size_t m_offset;
+      //! Journal file.
+      std::string m_path;
+      //! Live payloads, rewritten when compacting.
+      Records m_live;
+      //! Total size of live payloads.
+      std::size_t m_live_size;
+      //! Why the journal found on open was not replayed.
+      std::string m_rejected;
+
+      //! FNV-1a checksum.
+      static uint32_t
+      checksum(const uint8_t* data, std::size_t size)
+      {
+        uint32_t hash = 2166136261u;
+        for (std::size_t i = 0; i < size; ++i)
+          hash = (hash ^ data[i]) * 16777619u;
+        return hash;
+      }
+
+      void
+      map(std::size_t size)
+      {
+        if (ftruncate(m_fd, size) != 0)
+          throw std::runtime_error(DTR("failed to resize journal"));
+
+        void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED)
+          throw std::runtime_error(DTR("failed to map journal"));
+
+        m_data = (uint8_t*)data;
+        m_size = size;
+      }
+
+      void
+      writeHeader(void)
+      {
+        std::memcpy(m_data, &c_journal_magic, sizeof(c_journal_magic));
+        std::memcpy(m_data + sizeof(c_journal_magic), &c_journal_version, sizeof(c_journal_version));
+      }
+
+      //! Write a record at the end of the journal. The checksum covers
+      //! type, id and payload. The length goes last: a zero length ends
+      //! the journal and a torn record fails the checksum.
+      void
+      append(RecordType type, uint32_t id, const std::string& payload)
+      {
+        std::size_t size = c_journal_header + payload.size();
+        if (m_offset + size > m_size)
+        {
+          compact(size);
+          //! The live records already hold this one.
+          return;
+        }
+
+        uint8_t* ptr = m_data + m_offset;
+        uint32_t length = payload.size();
+        ptr[8] = type;
+        std::memcpy(ptr + 9, &id, sizeof(id));
+        std::memcpy(ptr + c_journal_header, payload.data(), payload.size());
+
+        uint32_t sum = checksum(ptr + 8, size - 8);
+        std::memcpy(ptr + 4, &sum, sizeof(sum));
+        std::memcpy(ptr, &length, sizeof(length));
+        m_offset += size;
+      }
+
+      void
+      replay(void)
+      {
+        while (m_offset + c_journal_header <= m_size)
+        {
+          const uint8_t* ptr = m_data + m_offset;
+          uint32_t length = 0, sum = 0, id = 0;
+          std::memcpy(&length, ptr, sizeof(length));
+          std::memcpy(&sum, ptr + 4, sizeof(sum));
+          std::memcpy(&id, ptr + 9, sizeof(id));
+
+          std::size_t size = c_journal_header + length;
+          if (ptr[8] == 0 || length > m_size - m_offset - c_journal_header)
+            break;
+
+          if (checksum(ptr + 8, size - 8) != sum)
+            break;
+
+          if (ptr[8] == RECORD_ADD)
+          {
+            std::string& live = m_live[id];
+            m_live_size -= live.size();
+            live.assign((const char*)ptr + c_journal_header, length);
+            m_live_size += length;
+          }
+          else if (ptr[8] == RECORD_REMOVE)
+          {
+            Records::iterator itr = m_live.find(id);
+            if (itr != m_live.end())
+            {
+              m_live_size -= itr->second.size();
+              m_live.erase(itr);
+            }
+          }
+          else
+          {
+            break;
+          }
+
+          m_offset += size;
+        }
+      }
+
+      //! Rewrite the live records to a new file, at most half full, and
+      //! replace the journal with it. A crash leaves either the old or
+      //! the new journal.
+      //! @param[in] size size of the record that did not fit.
+      void
+      compact(std::size_t size)
+      {
+        std::size_t required = c_journal_file_header + m_live_size + m_live.size() * c_journal_header + size;
+        std::size_t new_size = c_journal_size;
+        while (required > new_size / 2)
+          new_size *= 2;
+
+        std::string tmp = m_path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+          throw std::runtime_error(DTR("failed to compact journal"));
+
+        int old_fd = m_fd;
+        uint8_t* old_data = m_data;
+        std::size_t old_size = m_size;
+        m_fd = fd;
+
+        try
+        {
+          map(new_size);
+        }
+        catch (...)
+        {
+          ::close(fd);
+          m_fd = old_fd;
+          m_data = old_data;
+          m_size = old_size;
+          throw;
+        }
+
+        munmap(old_data, old_size);
+        ::close(old_fd);
+
+        writeHeader();
+        m_offset = c_journal_file_header;
+        for (Records::const_iterator itr = m_live.begin(); itr != m_live.end(); ++itr)
+          append(RECORD_ADD, itr->first, itr->second);
+
+        msync(m_data, m_size, MS_SYNC);
+        std::rename(tmp.c_str(), m_path.c_str());
+      }
+    };
+  }
+}
+#endif
@@ -0,0 +1,432 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_SMS_QUEUE_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_SMS_QUEUE_INCLUDED
+// ISO C++ 98 headers.
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "SmsJournal.hpp"
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    struct SmsRequest
+    {
+      // Request id.
+      uint16_t req_id;
+      // Source address.
+      uint16_t src_adr;
+      // Source entity id.
+      uint8_t src_eid;
+      // Recipient.
+      std::string destination;
+      // Message to send.
+      std::string sms_text;
+      // Deadline to deliver the
+      double deadline;
+      // Reference of the concatenated message.
+      uint8_t concat_ref = 0;
+      // Parts of the concatenated message already sent.
+      uint8_t parts_sent = 0;
+      // Message is a serialized IMC packet sent as 8 bit data.
+      bool binary = false;
+      // Queue entry id, assigned when first queued.
+      uint32_t id = 0;
+      // Failed attempts.
+      uint8_t retries = 0;
+      // Do not send before this time (s since epoch).
+      double retry_time = 0;
+      //! Fill a status message addressed to the requester.
+      //! @param[out] sms_status status message.
+      //! @param[in] status request status.
+      //! @param[in] info status description.
+      void
+      fillStatus(IMC::SmsStatus& sms_status, IMC::SmsStatus::StatusEnum status, const std::string& info) const
+      {
+        sms_status.setDestination(src_adr);
+        sms_status.setDestinationEntity(src_eid);
+        sms_status.req_id = req_id;
+        sms_status.info   = info;
+        sms_status.status = status;
+      }
+
+      //! Serialize to a journal record. Changing the layout requires a
+      //! new c_journal_version.
+      //! @param[out] record record payload.
+      void
+      serialize(std::string& record) const
+      {
+        record.clear();
+        put(record, deadline);
+        put(record, req_id);
+        put(record, src_adr);
+        put(record, src_eid);
+        put(record, concat_ref);
+        put(record, parts_sent);
+        put(record, (uint8_t)binary);
+        put(record, retries);
+        put(record, retry_time);
+        put(record, (uint16_t)destination.size());
+        record += destination;
+        put(record, (uint32_t)sms_text.size());
+        record += sms_text;
+      }
+
+      //! Deserialize a journal record.
+      //! @param[in] record record payload.
+      //! @return false if the record is malformed.
+      bool
+      deserialize(const std::string& record)
+      {
+        std::size_t offset = 0;
+        uint8_t bin = 0;
+        uint16_t dest_size = 0;
+        uint32_t text_size = 0;
+        if (!get(record, offset, deadline) || !get(record, offset, req_id) ||
+            !get(record, offset, src_adr) || !get(record, offset, src_eid) ||
+            !get(record, offset, concat_ref) || !get(record, offset, parts_sent) ||
+            !get(record, offset, bin) || !get(record, offset, retries) ||
+            !get(record, offset, retry_time) || !get(record, offset, dest_size) ||
+            record.size() - offset < dest_size)
+          return false;
+
+        destination.assign(record, offset, dest_size);
+        offset += dest_size;
+        if (!get(record, offset, text_size) || record.size() - offset != text_size)
+          return false;
+
+        sms_text.assign(record, offset, text_size);
+        binary = bin != 0;
+        return true;
+      }
+
+    private:
+      template <typename T>
+      static void
+      put(std::string& record, const T& value)
+      {
+        record.append((const char*)&value, sizeof(value));
+      }
+
+      template <typename T>
+      static bool
+      get(const std::string& record, std::size_t& offset, T& value)
+      {
+        if (record.size() - offset < sizeof(value))
+          return false;
+
+        std::memcpy(&value, record.data() + offset, sizeof(value));
+        offset += sizeof(value);
+        return true;
+      }
+    };
+
+    //! Scheduler of SMS requests, ordered by deadline. Owned by the task
+    //! so that pending requests survive modem restarts, filled by the
+    //! task thread and drained by the modem command engine. Requests are
+    //! indexed by deadline, for ordering and bulk expiry, and by
+    //! requester and request id, for cancellation. Requests waiting to
+    //! be retried are set aside, by retry time, until they are due; they
+    //! stay in the expiry index meanwhile. All operations are O(log n),
+    //! purge is O(log n) per expired request. With a journal requests
+    //! also survive the process: they stay in the journal from the first
+    //! push until done(), so a request being sent when the process dies
+    //! is sent again.
+    class SmsQueue
+    {
+    public:
+      SmsQueue(void):
+        m_capacity(0),
+        m_next_id(1)
+      { }
+
+      //! Set the maximum number of queued requests, zero for no limit.
+      //! Requests already queued are kept.
+      //! @param[in] capacity maximum number of requests.
+      void
+      setCapacity(unsigned capacity)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        m_capacity = capacity;
+      }
+
+      //! Open the journal and queue the requests it holds.
+      //! @param[in] path journal file.
+      //! @return number of requests reloaded.
+      unsigned
+      open(const std::string& path)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        const SmsJournal::Records& records = m_journal.open(path);
+
+        unsigned count = 0;
+        SmsJournal::Records::const_iterator itr = records.begin();
+        for (; itr != records.end(); ++itr)
+        {
+          SmsRequest sms_req;
+          if (!sms_req.deserialize(itr->second))
+            continue;
+
+          sms_req.id = itr->first;
+          m_next_id = std::max(m_next_id, sms_req.id + 1);
+          insert(sms_req);
+          ++count;
+        }
+
+        return count;
+      }
+
+      //! @return why the journal found on open was not reloaded, empty
+      //! if it was.
+      std::string
+      getRejected(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        return m_journal.getRejected();
+      }
+
+      bool
+      isPersistent(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        return m_journal.isOpen();
+      }
+
+      //! Get and clear the last journal error. The queue carries on in
+      //! memory after an error.
+      //! @param[out] error error description.
+      //! @return true if there was an error.
+      bool
+      getError(std::string& error)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        error = m_error;
+        m_error.clear();
+        return !error.empty();
+      }
+
+      //! Queue a new request, or a request taken with pop() again with
+      //! its updated progress. New requests are refused when the queue
+      //! is full, returned requests are always accepted.
+      //! @param[in] sms_req request.
+      //! @return false if the queue is full.
+      bool
+      push(const SmsRequest& sms_req)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        SmsRequest queued = sms_req;
+        if (queued.id == 0)
+        {
+          if (m_capacity > 0 && m_requests.size() >= m_capacity)
+            return false;
+
+          queued.id = m_next_id++;
+        }
+
+        if (m_journal.isOpen())
+        {
+          try
+          {
+            queued.serialize(m_record);
+            m_journal.add(queued.id, m_record);
+          }
+          catch (std::exception& e)
+          {
+            failed(e);
+          }
+        }
+
+        insert(queued);
+        return true;
+      }
+
+      //! Remove a request taken with pop() from the journal, once it was
+      //! sent or given up on.
+      //! @param[in] sms_req request.
+      void
+      done(const SmsRequest& sms_req)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        forget(sms_req.id);
+      }
+
+      //! Remove a queued request.
+      //! @param[in] src_adr requester address.
+      //! @param[in] src_eid requester entity.
+      //! @param[in] req_id request id.
+      //! @param[out] sms_req removed request.
+      //! @return false if no such request is queued.
+      bool
+      cancel(uint16_t src_adr, uint8_t src_eid, uint16_t req_id, SmsRequest& sms_req)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        KeyIndex::iterator itr = m_by_key.find(getKey(src_adr, src_eid, req_id));
+        if (itr == m_by_key.end())
+          return false;
+
+        sms_req = m_requests[itr->second];
+        erase(sms_req.id);
+        forget(sms_req.id);
+        return true;
+      }
+
+      //! Remove all requests past their deadline in one pass, including
+      //! the ones waiting to be retried.
+      //! @param[in] now current time (s since epoch).
+      //! @param[out] expired removed requests.
+      //! @return number of removed requests.
+      unsigned
+      purge(double now, std::vector<SmsRequest>& expired)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        expired.clear();
+        while (!m_by_expiry.empty() && m_by_expiry.begin()->first <= now)
+        {
+          uint32_t id = m_by_expiry.begin()->second;
+          expired.push_back(m_requests[id]);
+          erase(id);
+          forget(id);
+        }
+
+        return expired.size();
+      }
+
+      //! Take the request with the earliest deadline among the ones not
+      //! waiting to be retried.
+      //! @param[out] sms_req request.
+      //! @return false if no request is due.
+      bool
+      pop(SmsRequest& sms_req)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        double now = Clock::getSinceEpoch();
+        while (!m_by_retry.empty() && m_by_retry.begin()->first <= now)
+        {
+          uint32_t id = m_by_retry.begin()->second;
+          m_by_retry.erase(m_by_retry.begin());
+          m_by_deadline.insert(std::make_pair(m_requests[id].deadline, id));
+        }
+
+        if (m_by_deadline.empty())
+          return false;
+
+        uint32_t id = m_by_deadline.begin()->second;
+        sms_req = m_requests[id];
+        erase(id);
+        return true;
+      }
+
+      unsigned
+      size(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        return m_requests.size();
+      }
+
+    private:
+      //! Queue entry ids by deadline or retry time.
+      typedef std::set<std::pair<double, uint32_t> > DeadlineIndex;
+      //! Queue entry ids by requester (address and entity) and request id.
+      typedef std::map<uint64_t, uint32_t> KeyIndex;
+
+      //! Queued requests by queue entry id.
+      std::map<uint32_t, SmsRequest> m_requests;
+      //! Deadline index of requests due.
+      DeadlineIndex m_by_deadline;
+      //! Retry time index of requests set aside.
+      DeadlineIndex m_by_retry;
+      //! Deadline index of all requests, due or set aside.
+      DeadlineIndex m_by_expiry;
+      //! Requester index.
+      KeyIndex m_by_key;
+      //! Maximum number of queued requests.
+      unsigned m_capacity;
+      //! Journal of queued requests.
+      SmsJournal m_journal;
+      //! Serialization buffer.
+      std::string m_record;
+      //! Last journal error.
+      std::string m_error;
+      //! Next queue entry id.
+      uint32_t m_next_id;
+      //! Lock for pending requests and journal.
+      Concurrency::Mutex m_lock;
+
+      static uint64_t
+      getKey(uint16_t src_adr, uint8_t src_eid, uint16_t req_id)
+      {
+        return ((uint64_t)src_adr << 24) | ((uint64_t)src_eid << 16) | req_id;
+      }
+
+      void
+      insert(const SmsRequest& sms_req)
+      {
+        m_requests[sms_req.id] = sms_req;
+        if (sms_req.retry_time > Clock::getSinceEpoch())
+          m_by_retry.insert(std::make_pair(sms_req.retry_time, sms_req.id));
+        else
+          m_by_deadline.insert(std::make_pair(sms_req.deadline, sms_req.id));
+        m_by_expiry.insert(std::make_pair(sms_req.deadline, sms_req.id));
+        //! Forwarded IMC messages have no requester.
+        if (!sms_req.binary)
+          m_by_key[getKey(sms_req.src_adr, sms_req.src_eid, sms_req.req_id)] = sms_req.id;
+      }
+
+      void
+      erase(uint32_t id)
+      {
+        std::map<uint32_t, SmsRequest>::iterator itr = m_requests.find(id);
+        if (itr == m_requests.end())
+          return;
+
+        const SmsRequest& sms_req = itr->second;
+        m_by_deadline.erase(std::make_pair(sms_req.deadline, id));
+        m_by_retry.erase(std::make_pair(sms_req.retry_time, id));
+        m_by_expiry.erase(std::make_pair(sms_req.deadline, id));
+        if (!sms_req.binary)
+        {
+          KeyIndex::iterator key = m_by_key.find(getKey(sms_req.src_adr, sms_req.src_eid, sms_req.req_id));
+          if (key != m_by_key.end() && key->second == id)
+            m_by_key.erase(key);
+        }
+
+        m_requests.erase(itr);
+      }
+
+      //! Remove a request from the journal.
+      void
+      forget(uint32_t id)
+      {
+        if (!m_journal.isOpen())
+          return;
+
+        try
+        {
+          m_journal.remove(id);
+        }
+        catch (std::exception& e)
+        {
+          failed(e);
+        }
+      }
+
+      //! Stop journaling after an error.
+      void
+      failed(const std::exception& e)
+      {
+        m_error = e.what();
+        m_journal.close();
+      }
+    };
+  }
+}
+#endif
@@ -29,6 +29,8 @@
 
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
+#include "ModemStarter.hpp"
+#include "SerialTrace.hpp"
 #include "TobyL2.hpp"
 
 namespace Transports
@@ -40,55 +42,233 @@ namespace Transports
 
   struct Arguments
     {
-      //! Serial port device.
-      std::string uart_dev;
+      //! Serial port devices, one per modem.
+      std::vector<std::string> uart_dev;
       //! Serial port baud rate.
       unsigned uart_baud;
-      //! Power channel Name.
-      std::string pwr_channel_name;
-      //! APN name to connect to
-      std::string apn_name;
+      //! Power channel names, one per modem.
+      std::vector<std::string> pwr_channel_name;
+      //! Time to wait for the serial device to appear.
+      double dev_tout;
+      //! Time to wait for the modem to answer commands.
+      double ready_tout;
+      //! APN names to connect to, one per modem.
+      std::vector<std::string> apn_name;
       //! RSSI query timer.
       double rssi_querry_per;
+      //! Maximum RSSI querry period while the link is stable.
+      double rssi_querry_max;
       //! Network connection querry period
       double nwk_querry_per;
-      //! Network report period
+      //! Maximum network querry period while the link is stable.
+      double nwk_querry_max;
+      //! Network report period, when nothing changes.
       double nwk_report_per;
-      //! GSM Pin.
-      std::string pin;
+      //! Signal strength change reported immediately (%).
+      double rssi_hysteresis;
+      //! Latency change reported immediately (ms).
+      double latency_hysteresis;
+      //! GSM Pins, one per modem.
+      std::vector<std::string> pin;
       //! SMS send timeout (s).
       double sms_tout;
+      //! Time budget for each burst of queued SMS (s).
+      double sms_budget;
       //! start GSM by default flag
       bool start_gsm;
+      //! Track network state from unsolicited result codes.
+      bool event_tracking;
+      //! Watchdog querry period in event driven mode.
+      double watchdog_per;
+      //! Fetch incoming SMS on new message indications.
+      bool sms_indications;
+      //! IMC messages to forward over SMS.
+      std::vector<std::string> imc_messages;
+      //! Recipient of IMC messages sent over SMS.
+      std::string imc_recipient;
+      //! Delivery timeout of IMC messages sent over SMS (s).
+      double imc_tout;
+      //! IMC messages to send as datagrams.
+      std::vector<std::string> udp_messages;
+      //! Remote datagram endpoint address.
+      std::string udp_host;
+      //! Remote datagram endpoint port.
+      unsigned udp_port;
+      //! Datagram batching period (ms).
+      unsigned udp_period;
+      //! Upload logs when they are closed.
+      bool upload_logs;
+      //! Upload server address.
+      std::string upload_server;
+      //! Upload server port.
+      unsigned upload_port;
+      //! Upload server path.
+      std::string upload_path;
+      //! Bytes written to the modem file system at a time.
+      unsigned upload_chunk;
+      //! Maximum time to post a file (s).
+      double upload_tout;
+      //! Latency probe targets.
+      std::vector<std::string> ping_targets;
+      //! Packets per latency probe burst.
+      unsigned ping_count;
+      //! Latency probe packet size.
+      unsigned ping_size;
+      //! Latency probe packet timeout (ms).
+      unsigned ping_tout;
+      //! Number of probes in latency statistics.
+      unsigned latency_window;
+      //! Time after a recovery in which a new failure escalates it.
+      double recovery_window;
+      //! Keep queued SMS in a journal across task restarts.
+      bool sms_journal;
+      //! Maximum number of queued SMS.
+      unsigned sms_capacity;
+      //! Command statistics report period.
+      double cmd_stats_per;
+      //! Log the command statistics.
+      bool cmd_stats_dump;
+      //! Serial traffic kept in memory (s).
+      double trace_window;
+      //! Serial trace to replay instead of using the modem.
+      std::string trace_replay;
+      //! Serial trace replay speed.
+      double trace_speed;
     };
 
   namespace GSMTobyL2
   {
     using DUNE_NAMESPACES;
 
+    //! Time between checks for network changes to report (s).
+    static const double c_report_check_period = 1.0;
+    //! Time before opening again a modem dropped after failing (s).
+    static const double c_reopen_delay = 60.0;
+    //! Time between power channel requests while waiting for it (s).
+    static const double c_channel_request_period = 2.0;
+
+    //! Bring-up phases of a modem, advanced by the main loop.
+    enum ModemPhase
+    {
+      //! Closed, opened again at its reopen time if set.
+      PHASE_CLOSED,
+      //! Waiting for the power channel to turn off.
+      PHASE_POWER_OFF,
+      //! Waiting for the power channel to turn on.
+      PHASE_POWER_ON,
+      //! Bring-up thread running.
+      PHASE_STARTING,
+      //! Command engine running.
+      PHASE_OPEN
+    };
+
+    //! Recovery time statistics of a tier.
+    struct RecoveryStats
+    {
+      // Number of recoveries.
+      unsigned count;
+      // Total recovery time (s).
+      double total;
+      // Longest recovery time (s).
+      double max;
+    };
+
+    //! Modem managed by the task, with its own serial port, power
+    //! channel and recovery state. All modems serve the same SMS and
+    //! datagram queues.
+    struct Modem
+    {
+      // Index, used in logs and reports.
+      unsigned index;
+      // Serial port device.
+      std::string uart_dev;
+      // Power channel name.
+      std::string channel;
+      // APN name.
+      std::string apn;
+      // SIM PIN.
+      std::string pin;
+      // Serial port handle.
+      IO::Handle* uart;
+      // Command engine, NULL while the modem is closed.
+      TobyL2* driver;
+      // Bring-up phase.
+      ModemPhase phase;
+      // Time by which the power channel must reach its state.
+      double phase_deadline;
+      // Request the power channel state from the power controller.
+      bool request;
+      // Time of the last power channel request, negative if none.
+      double request_time;
+      // Bring-up thread, NULL unless starting.
+      ModemStarter* starter;
+      // Power channel state.
+      bool channel_state;
+      // Time at which the power channel was seen turning on.
+      double power_on_time;
+      // Time to open the modem again after dropping it, zero if none.
+      double reopen_time;
+      // Recovery action in progress.
+      RecoveryTier recovery_tier;
+      // Last completed recovery action.
+      RecoveryTier last_tier;
+      // Time of the failure being recovered.
+      double failure_time;
+      // Time at which the last recovery completed.
+      double recovery_end;
+      // Recovery time statistics per tier.
+      RecoveryStats mttr[RECOVERY_RESTART + 1];
+      // Last reported link picture.
+      TobyL2::LinkStatus link_sent;
+      // Modem was open at the last report.
+      bool open_sent;
+      // Serial bytes exchanged at the last report.
+      double serial_bytes;
+    };
+
     struct Task: public DUNE::Tasks::Task
     {
       //! Task arguments.
       Arguments m_args;
-      //! Serial port handle.
-      SerialPort* m_uart;
-      //! Toby L2
-      TobyL2* m_modem;
-      //! Channel State
-      bool m_channel_state = false;
+      //! Toby L2 modems, sized once from the serial port devices.
+      std::vector<Modem> m_modems;
+      //! Serial trace replay of the first modem, if replaying (owned as
+      //! its serial port).
+      TraceReplay* m_replay;
+      //! Time the replay started, negative once reported.
+      double m_replay_start = -1;
+      //! Recent serial traffic of the first modem.
+      SerialTrace m_trace;
       //! Timer for Network reports
       DUNE::Time::Counter<double> m_ntwk_report_timer;
+      //! Timer for checking network changes.
+      DUNE::Time::Counter<double> m_ntwk_check_timer;
+      //! Last reported signal strength (%).
+      double m_rssi_sent = -1;
+      //! Last reported average latency (ms).
+      double m_latency_sent = -1;
+      //! Timer for command statistics reports.
+      DUNE::Time::Counter<double> m_cmd_stats_timer;
+      //! Pending SMS, kept across modem restarts.
+      SmsQueue m_queue;
+      //! Outgoing and incoming IMC datagrams.
+      Datagrams m_datagrams;
+      //! Files to upload.
+      Uploads m_uploads;
+      //! Identifiers of IMC messages sent over SMS.
+      std::set<uint16_t> m_sms_ids;
+      //! Identifiers of IMC messages sent as datagrams.
+      std::set<uint16_t> m_udp_ids;
       //! Constructor.
       //! @param[in] name task name.
       //! @param[in] ctx context.
       Task(const std::string& name, Tasks::Context& ctx):
         DUNE::Tasks::Task(name, ctx),
-        m_uart(NULL),
-        m_modem(NULL)
+        m_replay(NULL)
       {
         param("Serial Port - Device", m_args.uart_dev)
         .defaultValue("/dev/ttyACM0")
-        .description("Serial port device used to communicate with Toby L2");
+        .description("Serial port devices used to communicate with Toby L2 modems, one per modem");
 
         param("Serial Port - Baud Rate", m_args.uart_baud)
         .defaultValue("115200")
@@ -96,30 +276,61 @@ namespace Transports
 
         param("Power Channel - Name", m_args.pwr_channel_name)
         .defaultValue("SAT_GSM")
-        .description("GSM Device power channel name");
+        .description("GSM Device power channel names, one per modem. The last one applies to the remaining modems. "
+                     "A channel shared by several modems is not power cycled while another one is open");
+
+        param("Power Channel - Device Timeout", m_args.dev_tout)
+        .defaultValue("30")
+        .units(Units::Second)
+        .description("Maximum amount of time to wait for the serial device after turning the channel on");
+
+        param("Power Channel - Ready Timeout", m_args.ready_tout)
+        .defaultValue("20")
+        .units(Units::Second)
+        .description("Maximum amount of time to wait for the modem to answer before resetting it");
 
         param("RSSI Querry Periodicity", m_args.rssi_querry_per)
         .defaultValue("10")
         .units(Units::Second)
-        .description("Periodicity of RSSI querry");
+        .description("Periodicity of RSSI querry after link changes");
+
+        param("RSSI Querry Maximum Periodicity", m_args.rssi_querry_max)
+        .defaultValue("60")
+        .units(Units::Second)
+        .description("The RSSI querry period doubles up to this value while the link is stable");
 
         param("Network Querry Periodicity", m_args.nwk_querry_per)
         .defaultValue("5")
         .units(Units::Second)
-        .description("Periodicity of network status querry");
+        .description("Periodicity of network status querry after link changes and failures, and of inbox sweeps, pings and SMS retries");
+
+        param("Network Querry Maximum Periodicity", m_args.nwk_querry_max)
+        .defaultValue("60")
+        .units(Units::Second)
+        .description("The network status querry period doubles up to this value while the link is stable");
 
         param("Network Reports Periodicity", m_args.nwk_report_per)
-        .defaultValue("5")
+        .defaultValue("60")
         .units(Units::Second)
-        .description("Periodicity of network reports");
+        .description("Periodicity of network reports when the link does not change");
+
+        param("Network Reports - RSSI Hysteresis", m_args.rssi_hysteresis)
+        .defaultValue("5")
+        .units(Units::Percentage)
+        .description("Signal strength change reported immediately");
+
+        param("Network Reports - Latency Hysteresis", m_args.latency_hysteresis)
+        .defaultValue("100")
+        .units(Units::Millisecond)
+        .description("Average latency change reported immediately");
 
         param("SIM-PIN", m_args.pin)
         .defaultValue("")
-        .description("SIM card PIN Code");
+        .description("SIM card PIN Codes, one per modem. The last one applies to the remaining modems");
 
         param("APN", m_args.apn_name)
         .defaultValue("web.vodafone.de")
-        .description("APN Code");
+        .description("APN Codes, one per modem. The last one applies to the remaining modems");
 
         param("Turn GSM ON", m_args.start_gsm)
         .defaultValue("false")
@@ -130,30 +341,219 @@ namespace Transports
         .units(Units::Second)
         .description("Maximum amount of time to wait for SMS send completion");
 
+        param("SMS Burst Budget", m_args.sms_budget)
+        .defaultValue("10")
+        .units(Units::Second)
+        .description("Maximum amount of time spent sending queued SMS back-to-back before polling status again");
+
+        param("Event Driven Network Tracking", m_args.event_tracking)
+        .defaultValue("false")
+        .description("Track registration, signal and PDP context from unsolicited result codes");
+
+        param("Watchdog Querry Periodicity", m_args.watchdog_per)
+        .defaultValue("60")
+        .units(Units::Second)
+        .description("Periodicity of status querries when tracking network events");
+
+        param("SMS New Message Indications", m_args.sms_indications)
+        .defaultValue("false")
+        .description("Read incoming SMS as soon as the modem reports them instead of polling the inbox");
+
+        param("IMC over SMS - Messages", m_args.imc_messages)
+        .defaultValue("")
+        .description("List of IMC messages to forward over SMS as 8 bit data");
+
+        param("IMC over SMS - Recipient", m_args.imc_recipient)
+        .defaultValue("")
+        .description("Phone number to forward IMC messages to");
+
+        param("IMC over SMS - Timeout", m_args.imc_tout)
+        .defaultValue("300")
+        .units(Units::Second)
+        .description("Maximum amount of time to deliver forwarded IMC messages");
+
+        param("IMC over UDP - Messages", m_args.udp_messages)
+        .defaultValue("")
+        .description("List of IMC messages to send as datagrams while connected");
+
+        param("IMC over UDP - Address", m_args.udp_host)
+        .defaultValue("")
+        .description("IP address of the remote datagram endpoint");
+
+        param("IMC over UDP - Port", m_args.udp_port)
+        .defaultValue("0")
+        .description("Port of the remote datagram endpoint, zero to disable datagrams");
+
+        param("IMC over UDP - Batch Period", m_args.udp_period)
+        .defaultValue("100")
+        .units(Units::Millisecond)
+        .description("Time messages wait to be batched in one datagram");
+
+        param("Upload - Logs", m_args.upload_logs)
+        .defaultValue("false")
+        .description("Upload logs to the server when they are closed");
+
+        param("Upload - Server", m_args.upload_server)
+        .defaultValue("")
+        .description("Address of the HTTP server files are uploaded to");
+
+        param("Upload - Port", m_args.upload_port)
+        .defaultValue("80")
+        .description("Port of the HTTP server files are uploaded to");
+
+        param("Upload - Path", m_args.upload_path)
+        .defaultValue("/upload")
+        .description("Server path files are posted to, followed by the file name");
+
+        param("Upload - Chunk Size", m_args.upload_chunk)
+        .defaultValue("4096")
+        .minimumValue("64")
+        .units(Units::Byte)
+        .description("Bytes stored in the modem file system at a time");
+
+        param("Upload - Timeout", m_args.upload_tout)
+        .defaultValue("300")
+        .units(Units::Second)
+        .description("Maximum amount of time for the modem to post a file");
+
+        param("Ping - Targets", m_args.ping_targets)
+        .defaultValue("8.8.8.8")
+        .description("Host names or IP addresses used in turn for latency probes");
+
+        param("Ping - Count", m_args.ping_count)
+        .defaultValue("4")
+        .minimumValue("1")
+        .description("Number of packets in each latency probe burst");
+
+        param("Ping - Size", m_args.ping_size)
+        .defaultValue("32")
+        .units(Units::Byte)
+        .description("Size of latency probe packets");
+
+        param("Ping - Timeout", m_args.ping_tout)
+        .defaultValue("5000")
+        .units(Units::Millisecond)
+        .description("Timeout of each latency probe packet");
+
+        param("Latency Statistics Window", m_args.latency_window)
+        .defaultValue("50")
+        .minimumValue("1")
+        .description("Number of latency probes used for statistics");
+
+        param("Persistent SMS Queue", m_args.sms_journal)
+        .defaultValue("true")
+        .description("Keep queued SMS in a journal so that they are sent after a task restart");
+
+        param("SMS Queue Capacity", m_args.sms_capacity)
+        .defaultValue("100")
+        .description("Maximum number of queued SMS, zero for no limit. Further requests are refused");
+
+        param("Recovery Window", m_args.recovery_window)
+        .defaultValue("120")
+        .units(Units::Second)
+        .description("Failures within this time after a recovery escalate to the next recovery action");
+
+        param("Command Statistics Periodicity", m_args.cmd_stats_per)
+        .defaultValue("60")
+        .units(Units::Second)
+        .description("Period of AT command latency and serial traffic reports, zero to disable");
+
+        param("Command Statistics - Dump", m_args.cmd_stats_dump)
+        .defaultValue("false")
+        .description("Log AT command latency and serial traffic statistics when set");
+
+        param("Serial Trace - Window", m_args.trace_window)
+        .defaultValue("0")
+        .units(Units::Second)
+        .description("Serial traffic kept in memory and saved to the log directory when the task restarts, zero to disable");
+
+        param("Serial Trace - Replay", m_args.trace_replay)
+        .defaultValue("")
+        .description("Serial trace replayed instead of talking to the modem, for tests and benchmarks");
+
+        param("Serial Trace - Replay Speed", m_args.trace_speed)
+        .defaultValue("1")
+        .minimumValue("0")
+        .description("Serial trace replay speed relative to the original, zero replays without delays");
+
         bind<IMC::PowerChannelState>(this);
+        bind<IMC::LoggingControl>(this);
       }
 
       //! Update internal state with new parameter values.
       void
       onUpdateParameters(void)
       {
-        if (m_modem)
+        m_queue.setCapacity(m_args.sms_capacity);
+        m_cmd_stats_timer.setTop(m_args.cmd_stats_per);
+        m_trace.setWindow(m_args.trace_window);
+
+        if (paramChanged(m_args.cmd_stats_dump) && m_args.cmd_stats_dump)
+          sendCommandStats(true);
+
+        if (countActive() > 0 && (paramChanged(m_args.pin) || paramChanged(m_args.uart_dev) ||
+                                  paramChanged(m_args.uart_baud) || paramChanged(m_args.apn_name) ||
+                                  paramChanged(m_args.pwr_channel_name)))
         {
-          if (paramChanged(m_args.pin) || paramChanged(m_args.uart_dev) || paramChanged(m_args.uart_baud) || paramChanged(m_args.apn_name))
+          saveTrace();
+          throw RestartNeeded(DTR("restarting to change parameters"), 1);
+        }
+
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
+        {
+          TobyL2* modem = m_modems[i].driver;
+          if (modem == NULL)
+            continue;
+
+          if (paramChanged(m_args.rssi_querry_per) || paramChanged(m_args.rssi_querry_max))
+          {
+            modem->setRssiTimer(m_args.rssi_querry_per, m_args.rssi_querry_max);
+          }
+
+          if (paramChanged(m_args.nwk_querry_per) || paramChanged(m_args.nwk_querry_max))
+          {
+            modem->setNtwkTimer(m_args.nwk_querry_per, m_args.nwk_querry_max);
+          }
+
+          if (paramChanged(m_args.sms_tout))
+          {
+            modem->setSMSTimeout(m_args.sms_tout);
+          }
+
+          if (paramChanged(m_args.sms_budget))
           {
-            throw RestartNeeded(DTR("restarting to change parameters"), 1);
+            modem->setSMSBudget(m_args.sms_budget);
           }
-          else if (paramChanged(m_args.rssi_querry_per))
+
+          if (paramChanged(m_args.event_tracking) || paramChanged(m_args.watchdog_per))
           {
-            m_modem->setRssiTimer(m_args.rssi_querry_per);
+            modem->setEventTracking(m_args.event_tracking, m_args.watchdog_per);
           }
-          else if (paramChanged(m_args.nwk_querry_per))
+
+          if (paramChanged(m_args.ping_targets) || paramChanged(m_args.ping_count) ||
+              paramChanged(m_args.ping_size) || paramChanged(m_args.ping_tout) ||
+              paramChanged(m_args.latency_window))
           {
-            m_modem->setNtwkTimer(m_args.nwk_querry_per);
+            modem->setPingConfig(m_args.ping_targets, m_args.ping_count, m_args.ping_size,
+                                 m_args.ping_tout, m_args.latency_window);
           }
-          else if (paramChanged(m_args.sms_tout))
+
+          if (paramChanged(m_args.sms_indications))
           {
-            m_modem->setSMSTimeout(m_args.sms_tout);
+            modem->setMessageIndications(m_args.sms_indications);
+          }
+
+          if (paramChanged(m_args.udp_host) || paramChanged(m_args.udp_port) || paramChanged(m_args.udp_period))
+          {
+            modem->setDatagramConfig(m_args.udp_host, m_args.udp_port, m_args.udp_period / 1000.0);
+          }
+
+          if (paramChanged(m_args.upload_server) || paramChanged(m_args.upload_port) ||
+              paramChanged(m_args.upload_path) || paramChanged(m_args.upload_chunk) ||
+              paramChanged(m_args.upload_tout))
+          {
+            modem->setUploadConfig(m_args.upload_server, m_args.upload_port, m_args.upload_path,
+                                   m_args.upload_chunk, m_args.upload_tout);
           }
         }
       }
@@ -174,43 +574,325 @@ namespace Transports
       void
       onResourceAcquisition(void)
       {
-        //! Turn on GSM Channel
-        IMC::PowerChannelControl pcc;
-        pcc.name = m_args.pwr_channel_name;
-        pcc.op = IMC::PowerChannelControl::PCC_OP_TURN_ON;
+        if (m_args.sms_journal && !m_queue.isPersistent())
+          openJournal();
+
+        setupModems();
 
-        while (!m_channel_state && !stopping())
+        //! Modems are brought up by the main loop. A modem that fails to
+        //! start is opened again later.
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
         {
-          Time::Delay::wait(2.0);
-          if (m_args.start_gsm)
-          {
-            dispatch(pcc);
-          }
-          waitForMessages(0.05);
-          this->inf("Waiting for channel to be turned ON");
+          Modem& modem = m_modems[i];
+          if (modem.phase != PHASE_CLOSED)
+            continue;
+
+          //! Measure bring-up from now if the channel is already on.
+          if (modem.channel_state)
+            modem.power_on_time = Clock::get();
+
+          openModem(modem, m_args.start_gsm);
         }
-        if (!m_modem && !stopping())
+
+        //! SMS requests are queued until a modem is open.
+        bind<IMC::SmsRequest>(this);
+        bindForwarded();
+      }
+
+      //! Create one modem per serial port device. Per modem parameters
+      //! with fewer values than devices repeat their last value.
+      void
+      setupModems(void)
+      {
+        if (!m_modems.empty())
+          return;
+
+        //! A replayed trace stands for a single modem.
+        std::size_t count = 1;
+        if (m_args.trace_replay.empty())
+          count = std::max(m_args.uart_dev.size(), (std::size_t)1);
+
+        m_modems.resize(count);
+        for (std::size_t i = 0; i < count; ++i)
         {
-          try
-          {
-            //! Wait here for 20 seconds to kernel to detect and bring the device UP
-            Time::Delay::wait(20.0);
-            //! Create Handle for Serial Port to configure GSM Modem
-            m_uart = new SerialPort(m_args.uart_dev, m_args.uart_baud);
-            m_modem = new TobyL2(this , m_uart);
-            m_modem->initTobyL2(m_args.apn_name ,  m_args.pin);
-            m_modem->setSMSTimeout(m_args.sms_tout);
-            m_modem->setNtwkTimer(m_args.nwk_querry_per);
-            m_modem->setRssiTimer(m_args.rssi_querry_per);
-            m_ntwk_report_timer.setTop(m_args.nwk_report_per);
-            //! Now that its initialized accept SMS send request
-            bind<IMC::SmsRequest>(this);
-          }
-          catch(...)
+          Modem& modem = m_modems[i];
+          modem.index = i;
+          modem.uart_dev = getModemArg(m_args.uart_dev, i);
+          modem.channel = getModemArg(m_args.pwr_channel_name, i);
+          modem.apn = getModemArg(m_args.apn_name, i);
+          modem.pin = getModemArg(m_args.pin, i);
+
+          for (std::size_t j = 0; j < i; ++j)
           {
-             throw RestartNeeded(DTR("Restarting.."), 1);
+            if (m_modems[j].channel == modem.channel)
+              war(DTR("modems %u and %u share power channel %s, it is not power cycled while both are open"),
+                  (unsigned)j, (unsigned)i, modem.channel.c_str());
           }
         }
+
+        if (count > 1)
+          inf(DTR("managing %u modems"), (unsigned)count);
+      }
+
+      //! Get the value of a per modem parameter.
+      //! @param[in] values parameter values.
+      //! @param[in] index modem index.
+      //! @return value of the modem, the last one if there are fewer
+      //! values than modems.
+      static std::string
+      getModemArg(const std::vector<std::string>& values, std::size_t index)
+      {
+        if (values.empty())
+          return "";
+
+        return values[std::min(index, values.size() - 1)];
+      }
+
+      //! @return number of modems open or being opened.
+      unsigned
+      countActive(void) const
+      {
+        unsigned active = 0;
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
+        {
+          if (m_modems[i].phase != PHASE_CLOSED)
+            ++active;
+        }
+        return active;
+      }
+
+      //! Find another modem, open or being opened, powered by the same
+      //! channel as a modem.
+      //! @param[in] modem modem.
+      //! @return other modem, NULL if none.
+      const Modem*
+      findChannelUser(const Modem& modem) const
+      {
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
+        {
+          const Modem& other = m_modems[i];
+          if (other.index != modem.index && other.phase != PHASE_CLOSED && other.channel == modem.channel)
+            return &other;
+        }
+        return NULL;
+      }
+
+      //! Name a per modem report parameter, prefixed with the modem index
+      //! if there are several modems.
+      std::string
+      getLabel(const Modem& modem, const std::string& name) const
+      {
+        if (m_modems.size() < 2)
+          return name;
+
+        return String::str("Modem %u %s", modem.index, name.c_str());
+      }
+
+      //! Subscribe to IMC messages sent over SMS or as datagrams.
+      void
+      bindForwarded(void)
+      {
+        std::set<std::string> names;
+        for (std::size_t i = 0; i < m_args.imc_messages.size(); ++i)
+        {
+          names.insert(m_args.imc_messages[i]);
+          m_sms_ids.insert(IMC::Factory::getIdFromAbbrev(m_args.imc_messages[i]));
+        }
+
+        for (std::size_t i = 0; i < m_args.udp_messages.size(); ++i)
+        {
+          names.insert(m_args.udp_messages[i]);
+          m_udp_ids.insert(IMC::Factory::getIdFromAbbrev(m_args.udp_messages[i]));
+        }
+
+        bind(this, std::vector<std::string>(names.begin(), names.end()));
+      }
+
+      //! Reload SMS queued before the task stopped.
+      void
+      openJournal(void)
+      {
+        Path path = m_ctx.dir_log / (std::string(getName()) + ".sms");
+        try
+        {
+          m_ctx.dir_log.create();
+          unsigned count = m_queue.open(path.str());
+          if (!m_queue.getRejected().empty())
+            war(DTR("queued SMS not reloaded: %s"), m_queue.getRejected().c_str());
+          if (count > 0)
+            inf(DTR("reloaded %u queued SMS"), count);
+        }
+        catch (std::exception& e)
+        {
+          war(DTR("queued SMS will not persist: %s"), e.what());
+        }
+      }
+
+      //! Start opening a modem, from its power channel unless replaying.
+      //! @param[in] modem modem.
+      //! @param[in] request request the channel from the power controller.
+      void
+      openModem(Modem& modem, bool request)
+      {
+        //! A replayed modem has no power channel.
+        if (!m_args.trace_replay.empty())
+          launchStarter(modem);
+        else
+          setPowerPhase(modem, true, request);
+      }
+
+      //! Wait from the main loop for the power channel of a modem to
+      //! reach a state.
+      //! @param[in] modem modem.
+      //! @param[in] state desired channel state.
+      //! @param[in] request request the state from the power controller.
+      void
+      setPowerPhase(Modem& modem, bool state, bool request)
+      {
+        modem.phase = state ? PHASE_POWER_ON : PHASE_POWER_OFF;
+        modem.phase_deadline = Clock::get() + m_args.dev_tout;
+        modem.request = request;
+        modem.request_time = -1;
+      }
+
+      //! Check the power channel of a modem waiting for it, requesting
+      //! the state again periodically.
+      //! @param[in] modem modem.
+      //! @param[in] state desired channel state.
+      //! @return true once the channel reached the state.
+      bool
+      checkChannel(Modem& modem, bool state)
+      {
+        if (modem.channel_state == state)
+          return true;
+
+        double now = Clock::get();
+        if (now >= modem.phase_deadline)
+        {
+          failStart(modem, String::str(DTR("power channel %s did not turn %s"),
+                                       modem.channel.c_str(), state ? "on" : "off"));
+          return false;
+        }
+
+        if (modem.request_time >= 0 && now - modem.request_time < c_channel_request_period)
+          return false;
+
+        if (modem.request)
+        {
+          IMC::PowerChannelControl pcc;
+          pcc.name = modem.channel;
+          pcc.op = state ? IMC::PowerChannelControl::PCC_OP_TURN_ON : IMC::PowerChannelControl::PCC_OP_TURN_OFF;
+          dispatch(pcc);
+        }
+
+        this->inf("Waiting for channel %s to be turned %s", modem.channel.c_str(), state ? "ON" : "OFF");
+        modem.request_time = now;
+        return false;
+      }
+
+      //! Open the serial port of a modem and bring it up in a separate
+      //! thread. Only the first modem is traced, replayed and uploads
+      //! files.
+      //! @param[in] modem modem.
+      void
+      launchStarter(Modem& modem)
+      {
+        bool first = modem.index == 0;
+        IO::Handle* uart = NULL;
+        SerialTrace* trace = NULL;
+        if (first && !m_args.trace_replay.empty())
+        {
+          m_replay = new TraceReplay(m_args.trace_replay, m_args.trace_speed);
+          m_replay->start();
+          m_replay_start = Clock::get();
+          uart = m_replay;
+          inf(DTR("replaying serial trace %s"), m_args.trace_replay.c_str());
+        }
+        else if (first && m_trace.isEnabled())
+        {
+          //! Keep the trace of the previous session, which failed.
+          if (!m_trace.isEmpty())
+            saveTrace();
+          m_trace.startSession();
+          trace = &m_trace;
+        }
+
+        StarterConfig config;
+        config.uart_dev = modem.uart_dev;
+        config.uart_baud = m_args.uart_baud;
+        config.dev_tout = m_args.dev_tout;
+        config.ready_tout = m_args.ready_tout;
+        config.apn = modem.apn;
+        config.pin = modem.pin;
+        config.power_on_time = modem.power_on_time;
+
+        modem.starter = new ModemStarter(this, config, uart, trace, &m_queue, &m_datagrams,
+                                         first ? &m_uploads : NULL);
+        modem.starter->start();
+        modem.phase = PHASE_STARTING;
+      }
+
+      //! Start the engine of a modem once its bring-up thread is done.
+      //! @param[in] modem modem.
+      void
+      checkStarter(Modem& modem)
+      {
+        std::string error;
+        if (!modem.starter->isDone(error))
+          return;
+
+        modem.starter->stopAndJoin();
+        modem.driver = modem.starter->take(modem.uart);
+        Memory::clear(modem.starter);
+        if (modem.driver == NULL)
+        {
+          failStart(modem, error);
+          return;
+        }
+
+        TobyL2* driver = modem.driver;
+        inf(DTR("modem %u ready %.1f s after power on"), modem.index, driver->getReadyTime() - modem.power_on_time);
+        driver->setSMSTimeout(m_args.sms_tout);
+        driver->setSMSBudget(m_args.sms_budget);
+        driver->setNtwkTimer(m_args.nwk_querry_per, m_args.nwk_querry_max);
+        driver->setRssiTimer(m_args.rssi_querry_per, m_args.rssi_querry_max);
+        driver->setEventTracking(m_args.event_tracking, m_args.watchdog_per);
+        driver->setMessageIndications(m_args.sms_indications);
+        driver->setPingConfig(m_args.ping_targets, m_args.ping_count, m_args.ping_size,
+                              m_args.ping_tout, m_args.latency_window);
+        driver->setDatagramConfig(m_args.udp_host, m_args.udp_port, m_args.udp_period / 1000.0);
+        driver->setUploadConfig(m_args.upload_server, m_args.upload_port, m_args.upload_path,
+                                m_args.upload_chunk, m_args.upload_tout);
+        m_ntwk_report_timer.setTop(m_args.nwk_report_per);
+        m_ntwk_check_timer.setTop(c_report_check_period);
+        driver->startEngine();
+        modem.phase = PHASE_OPEN;
+
+        if (modem.recovery_tier == RECOVERY_POWER_CYCLE)
+          finishRecovery(modem);
+        else if (modem.reopen_time > 0)
+          inf(DTR("modem %u is back in service"), modem.index);
+
+        modem.reopen_time = 0;
+      }
+
+      //! Close a modem that failed to start. A modem being power cycled
+      //! goes on to the next recovery action, others are opened again
+      //! later.
+      //! @param[in] modem modem.
+      //! @param[in] error failure description.
+      void
+      failStart(Modem& modem, const std::string& error)
+      {
+        err(DTR("modem %u failed to start: %s"), modem.index, error.c_str());
+        if (modem.recovery_tier != RECOVERY_NONE)
+        {
+          dropModem(modem);
+          return;
+        }
+
+        releaseModem(modem);
+        modem.reopen_time = Clock::get() + c_reopen_delay;
       }
 
       //! Initialize resources.
@@ -224,67 +906,645 @@ namespace Transports
       void
       onResourceRelease(void)
       {
-        if (m_modem)
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
+          releaseModem(m_modems[i]);
+      }
+
+      //! Stop the bring-up or the engine of a modem and close its serial
+      //! port.
+      //! @param[in] modem modem.
+      void
+      releaseModem(Modem& modem)
+      {
+        if (modem.starter != NULL)
+        {
+          modem.starter->stopAndJoin();
+          modem.driver = modem.starter->take(modem.uart);
+          Memory::clear(modem.starter);
+        }
+
+        if (modem.driver)
+        {
+          modem.driver->stopEngine();
+          modem.driver->stopAndJoin();
+          delete modem.driver;
+          modem.driver = NULL;
+        }
+
+        if (modem.uart == m_replay)
+          m_replay = NULL;
+        Memory::clear(modem.uart);
+        modem.phase = PHASE_CLOSED;
+      }
+
+      //! Advance the bring-up of each modem, opening again the ones
+      //! dropped after failing.
+      void
+      updateModems(void)
+      {
+        for (std::size_t i = 0; i < m_modems.size() && !stopping(); ++i)
         {
-          m_modem->stopAndJoin();
-          delete m_modem;
-          m_modem = NULL;
+          Modem& modem = m_modems[i];
+          switch (modem.phase)
+          {
+            case PHASE_CLOSED:
+              {
+                if (modem.reopen_time <= 0 || Clock::get() < modem.reopen_time)
+                  break;
+
+                //! Let a modem on the same channel finish its power cycle.
+                const Modem* other = findChannelUser(modem);
+                if (other == NULL || other->phase != PHASE_POWER_OFF)
+                  openModem(modem, true);
+              }
+              break;
+
+            case PHASE_POWER_OFF:
+              if (checkChannel(modem, false))
+                setPowerPhase(modem, true, true);
+              break;
+
+            case PHASE_POWER_ON:
+              if (checkChannel(modem, true))
+                launchStarter(modem);
+              break;
+
+            case PHASE_STARTING:
+              checkStarter(modem);
+              break;
+
+            case PHASE_OPEN:
+              break;
+          }
         }
-        Memory::clear(m_uart);
+      }
+
+      //! Save the recent serial traffic to the log directory.
+      void
+      saveTrace(void)
+      {
+        if (!m_trace.isEnabled())
+          return;
+
+        Path path = m_ctx.dir_log / String::str("%s-%.0f.trace", getName(), Clock::getSinceEpoch());
+        try
+        {
+          m_ctx.dir_log.create();
+          unsigned count = m_trace.save(path.str());
+          inf(DTR("saved %u serial trace records to %s"), count, path.c_str());
+        }
+        catch (std::exception& e)
+        {
+          err(DTR("failed to save serial trace: %s"), e.what());
+        }
+      }
+
+      //! Report the end of a serial trace replay.
+      void
+      checkReplay(void)
+      {
+        unsigned mismatches = 0;
+        if (m_replay == NULL || m_replay_start < 0 || !m_replay->isDone(mismatches))
+          return;
+
+        inf(DTR("serial trace replayed in %.1f s, %u bytes sent differ from the trace"),
+            Clock::get() - m_replay_start, mismatches);
+        m_replay_start = -1;
       }
 
       void
       consume(const IMC::PowerChannelState* msg)
       {
-        if (msg->name == m_args.pwr_channel_name)
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
         {
-          m_channel_state = (msg->state) ? true:false;
+          Modem& modem = m_modems[i];
+          if (msg->name != modem.channel)
+            continue;
+
+          bool state = (msg->state) ? true:false;
+          if (state && !modem.channel_state)
+            modem.power_on_time = Clock::get();
+          modem.channel_state = state;
         }
       }
 
+      //! Queue closed logs for upload.
+      void
+      consume(const IMC::LoggingControl* msg)
+      {
+        if (!m_args.upload_logs || msg->op != IMC::LoggingControl::COP_STOPPED)
+          return;
+
+        Path dir = m_ctx.dir_log / msg->name;
+        const char* files[] = {"Data.lsf.gz", "Data.lsf"};
+        for (unsigned i = 0; i < sizeof(files) / sizeof(files[0]); ++i)
+        {
+          Path path = dir / files[i];
+          std::string name = String::str("%s_%s", msg->name.c_str(), files[i]);
+          if (path.exists() && m_uploads.push(path.str(), name))
+          {
+            inf(DTR("queued %s for upload"), path.c_str());
+            return;
+          }
+        }
+
+        war(DTR("no log to upload in %s"), dir.c_str());
+      }
+
       void
       consume(const IMC::SmsRequest* msg)
       {
-        TobyL2::SmsRequest sms_req;
+        SmsRequest sms_req;
         sms_req.req_id      = msg->req_id;
         sms_req.destination = msg->destination;
         sms_req.sms_text    = msg->sms_text;
         sms_req.src_adr     = msg->getSource();
         sms_req.src_eid     = msg->getSourceEntity();
 
+        //! A negative timeout cancels the queued request with the same
+        //! id. Nothing is queued and the requester gets a single answer.
+        SmsRequest queued;
+        if (msg->timeout < 0)
+        {
+          if (m_queue.cancel(sms_req.src_adr, sms_req.src_eid, sms_req.req_id, queued))
+          {
+            sendSmsStatus(queued,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,DTR("SMS cancelled"));
+            debug("cancelled SMS %u", sms_req.req_id);
+          }
+          else
+          {
+            sendSmsStatus(sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,DTR("no queued SMS to cancel"));
+          }
+          return;
+        }
+
         if (msg->timeout <= 0)
         {
-          m_modem->sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,"SMS timeout cannot be zero");
+          sendSmsStatus(sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,"SMS timeout cannot be zero");
           inf("%s", DTR("SMS timeout cannot be zero"));
           return;
         }
-        if(sms_req.sms_text.length() > 160) //160 characters encoded in 8-bit alphabet per SMS message
+        if (sms_req.sms_text.empty())
+        {
+          sendSmsStatus(sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,DTR("SMS text cannot be empty"));
+          inf("%s", DTR("SMS text cannot be empty"));
+          return;
+        }
+        //! Long texts are sent as concatenated SMS of up to 255 parts.
+        std::vector<uint8_t> septets;
+        std::vector<std::vector<uint8_t> > parts;
+        Pdu::encodeText(sms_req.sms_text, septets);
+        Pdu::split(septets, parts);
+        if (parts.size() > c_pdu_max_parts)
         {
-          m_modem->sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,"Can only send 160 characters over SMS.");
-          inf("%s", DTR("Can only send 160 characters over SMS"));
-        return;
+          sendSmsStatus(sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,"SMS text is too long.");
+          inf("%s", DTR("SMS text is too long"));
+          return;
         }
+        //! A valid request with the id of a queued one replaces it; the
+        //! queued status below is the only answer for both.
+        bool replaced = m_queue.cancel(sms_req.src_adr, sms_req.src_eid, sms_req.req_id, queued);
+        if (replaced)
+          debug("replaced SMS %u", sms_req.req_id);
         sms_req.deadline = Clock::getSinceEpoch() + msg->timeout;
-        m_modem->m_queue.push(sms_req);
-        m_modem->sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_QUEUED,DTR("SMS sent to queue"));
+        if (!m_queue.push(sms_req))
+        {
+          sendSmsStatus(sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,DTR("SMS queue is full"));
+          war("%s", DTR("SMS queue is full"));
+          return;
+        }
+        sendSmsStatus(sms_req,IMC::SmsStatus::SMSSTAT_QUEUED,
+                      replaced ? DTR("SMS replaced in queue") : DTR("SMS sent to queue"));
+      }
+
+      void
+      sendSmsStatus(const SmsRequest& sms_req, IMC::SmsStatus::StatusEnum status, const std::string& info)
+      {
+        IMC::SmsStatus sms_status;
+        sms_req.fillStatus(sms_status, status, info);
+        dispatch(sms_status);
       }
 
+      //! Forward local IMC messages as datagrams or over SMS.
+      void
+      consume(const IMC::Message* msg)
+      {
+        if (msg->getSource() != getSystemId())
+          return;
+
+        if (m_udp_ids.count(msg->getId()) && m_args.udp_port != 0)
+        {
+          if (!m_datagrams.push(msg))
+            debug("dropped datagram %s", msg->getName());
+        }
+
+        if (m_sms_ids.count(msg->getId()))
+          forwardSMS(msg);
+      }
+
+      //! Queue a local IMC message to be sent over SMS, serialized as 8
+      //! bit data.
+      void
+      forwardSMS(const IMC::Message* msg)
+      {
+        if (m_args.imc_recipient.empty())
+          return;
+
+        //! The receiver decodes bundles up to the same size.
+        if (msg->getSerializationSize() > c_bundle_max_size)
+        {
+          war(DTR("%s is too large to send over SMS"), msg->getName());
+          return;
+        }
+
+        SmsRequest sms_req;
+        sms_req.req_id      = 0;
+        sms_req.destination = m_args.imc_recipient;
+        sms_req.src_adr     = getSystemId();
+        sms_req.src_eid     = getEntityId();
+        sms_req.binary      = true;
+        sms_req.sms_text.resize(msg->getSerializationSize());
+        IMC::Packet::serialize(msg, (uint8_t*)&sms_req.sms_text[0], sms_req.sms_text.size());
+
+        std::vector<std::vector<uint8_t> > parts;
+        Pdu::splitData(sms_req.sms_text, parts);
+
+        sms_req.deadline = Clock::getSinceEpoch() + m_args.imc_tout;
+        if (!m_queue.push(sms_req))
+        {
+          war(DTR("SMS queue is full, dropped %s"), msg->getName());
+          return;
+        }
+        debug("queued %s for %s (%u SMS)", msg->getName(), sms_req.destination.c_str(),
+              (unsigned)parts.size());
+      }
+
+      void
+      addParameter(IMC::EntityParameters& params, const std::string& name, double value)
+      {
+        addParameter(params, name, String::str("%.2f", value));
+      }
+
+      void
+      addParameter(IMC::EntityParameters& params, const std::string& name, const std::string& value)
+      {
+        IMC::EntityParameter param;
+        param.name = name;
+        param.value = value;
+        params.params.push_back(param);
+      }
+
+      //! Check if the link picture changed, ignoring signal strength.
+      static bool
+      linkChanged(const TobyL2::LinkStatus& a, const TobyL2::LinkStatus& b)
+      {
+        return a.state != b.state || a.reg != b.reg || a.rat != b.rat || a.pdp != b.pdp ||
+               a.oper != b.oper || a.lac != b.lac || a.cell != b.cell;
+      }
+
+      //! Name a connection state, or report a closed modem.
+      static const char*
+      getStateName(const TobyL2* driver, int state)
+      {
+        return driver == NULL ? "closed" : c_state_names[state];
+      }
+
+      //! Publish the link picture of each modem, the best signal strength
+      //! and lowest latency among modems when they change significantly,
+      //! and everything at the report period.
       void
       sendNetworkReports()
       {
-        if (m_ntwk_report_timer.overflow())
+        if (!m_ntwk_check_timer.overflow())
+          return;
+
+        m_ntwk_check_timer.reset();
+        bool heartbeat = m_ntwk_report_timer.overflow();
+        if (heartbeat)
+          m_ntwk_report_timer.reset();
+
+        IMC::EntityParameters status;
+        status.name = getEntityLabel();
+        bool changed = heartbeat;
+        //! Unknown (-1) unless a modem reports a signal level.
+        double best_rssi = -1;
+        double best_latency = 0;
+        std::vector<LinkStatistics::Summary> latencies(m_modems.size());
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
+        {
+          Modem& modem = m_modems[i];
+          bool open = modem.driver != NULL;
+          TobyL2::LinkStatus link = TobyL2::LinkStatus();
+          link.reg = -1;
+          link.rat = -1;
+          link.rssi = -1;
+          if (open)
+          {
+            modem.driver->getLinkStatus(link);
+            modem.driver->getLatency(latencies[i]);
+          }
+
+          if (linkChanged(link, modem.link_sent) || open != modem.open_sent)
+            changed = true;
+
+          addParameter(status, getLabel(modem, "Connection State"), getStateName(modem.driver, link.state));
+          addParameter(status, getLabel(modem, "Registration"), link.reg);
+          addParameter(status, getLabel(modem, "Access Technology"), link.rat);
+          addParameter(status, getLabel(modem, "Operator"), link.oper);
+          addParameter(status, getLabel(modem, "Location Area"), link.lac);
+          addParameter(status, getLabel(modem, "Cell"), link.cell);
+          addParameter(status, getLabel(modem, "PDP Context"), link.pdp ? "active" : "inactive");
+          modem.link_sent = link;
+          modem.open_sent = open;
+
+          best_rssi = std::max(best_rssi, link.rssi);
+          if (latencies[i].avg > 0 && (best_latency <= 0 || latencies[i].avg < best_latency))
+            best_latency = latencies[i].avg;
+        }
+
+        if (changed)
+          dispatch(status);
+
+        if (heartbeat || std::fabs(best_rssi - m_rssi_sent) >= m_args.rssi_hysteresis)
         {
-          //! Dispatch RSSI
           IMC::RSSI rssi;
-          rssi.value = m_modem->m_rssi;
+          rssi.value = best_rssi;
           dispatch(rssi);
+          m_rssi_sent = best_rssi;
+        }
 
-          //! Dispatch Link Latency
+        if (heartbeat || std::fabs(best_latency - m_latency_sent) >= m_args.latency_hysteresis)
+        {
           IMC::LinkLatency link_latency;
-          link_latency.value = (m_modem->m_ping) ? (m_modem->m_ping / 1000.0):m_modem->m_ping;
+          link_latency.value = best_latency / 1000.0;
           dispatch(link_latency);
+          m_latency_sent = best_latency;
+        }
 
-          m_ntwk_report_timer.reset();
+        if (!heartbeat)
+          return;
+
+        //! Dispatch latency statistics
+        IMC::EntityParameters stats;
+        stats.name = getEntityLabel();
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
+        {
+          Modem& modem = m_modems[i];
+          if (modem.driver == NULL)
+            continue;
+
+          const LinkStatistics::Summary& latency = latencies[i];
+          addParameter(stats, getLabel(modem, "Latency Minimum"), latency.min);
+          addParameter(stats, getLabel(modem, "Latency Average"), latency.avg);
+          addParameter(stats, getLabel(modem, "Latency Maximum"), latency.max);
+          addParameter(stats, getLabel(modem, "Latency Jitter"), latency.jitter);
+          addParameter(stats, getLabel(modem, "Latency 95th Percentile"), latency.p95);
+          addParameter(stats, getLabel(modem, "Packet Loss"), latency.loss * 100.0);
+
+          double rssi_period = 0;
+          double ntwk_period = 0;
+          double tx = 0;
+          double rx = 0;
+          modem.driver->getPollingPeriods(rssi_period, ntwk_period);
+          modem.driver->getSerialTraffic(tx, rx);
+          //! A new modem starts counting from zero.
+          double bytes = tx + rx >= modem.serial_bytes ? tx + rx - modem.serial_bytes : tx + rx;
+          modem.serial_bytes = tx + rx;
+          addParameter(stats, getLabel(modem, "RSSI Querry Period"), rssi_period);
+          addParameter(stats, getLabel(modem, "Network Querry Period"), ntwk_period);
+          addParameter(stats, getLabel(modem, "Serial Load"),
+                       bytes / std::max(m_ntwk_report_timer.getTop(), c_report_check_period));
+        }
+
+        if (m_args.udp_port != 0)
+        {
+          Datagrams::Statistics udp;
+          m_datagrams.getStatistics(udp);
+          addParameter(stats, "Datagram Messages Sent", udp.msgs_out);
+          addParameter(stats, "Datagram Messages Received", udp.msgs_in);
+          addParameter(stats, "Datagram Messages Dropped", udp.dropped);
+          addParameter(stats, "Datagram Throughput Out", udp.rate_out);
+          addParameter(stats, "Datagram Throughput In", udp.rate_in);
+          addParameter(stats, "Datagram Latency Average", udp.latency_avg);
+          addParameter(stats, "Datagram Latency Maximum", udp.latency_max);
+        }
+
+        Uploads::Progress upload;
+        m_uploads.getProgress(upload);
+        if (!upload.name.empty() || upload.queued > 0)
+        {
+          addParameter(stats, "Upload Progress", upload.progress * 100.0);
+          addParameter(stats, "Upload Throughput", upload.rate);
+          addParameter(stats, "Uploads Queued", upload.queued);
+        }
+        if (upload.failed > 0)
+          addParameter(stats, "Uploads Failed", upload.failed);
+        dispatch(stats);
+      }
+
+      //! Report time spent on each AT command and connection state, and
+      //! serial traffic, of each open modem.
+      //! @param[in] dump also log the statistics.
+      void
+      sendCommandStats(bool dump)
+      {
+        IMC::EntityParameters stats;
+        stats.name = getEntityLabel();
+        for (std::size_t m = 0; m < m_modems.size(); ++m)
+        {
+          const Modem& modem = m_modems[m];
+          if (modem.driver == NULL)
+            continue;
+
+          CommandStats::Commands commands;
+          std::vector<double> states;
+          double tx = 0;
+          double rx = 0;
+          modem.driver->getCommandStats(commands, states, tx, rx);
+
+          addParameter(stats, getLabel(modem, "Serial Bytes Sent"), tx);
+          addParameter(stats, getLabel(modem, "Serial Bytes Received"), rx);
+          if (dump)
+            inf(DTR("modem %u serial traffic: %.0f bytes sent, %.0f bytes received"), modem.index, tx, rx);
+
+          for (std::size_t i = 0; i < states.size(); ++i)
+          {
+            addParameter(stats, getLabel(modem, String::str("Time %s", c_state_names[i])), states[i]);
+            if (dump)
+              inf(DTR("modem %u time %s: %.1f s"), modem.index, c_state_names[i], states[i]);
+          }
+
+          for (CommandStats::Commands::const_iterator itr = commands.begin(); itr != commands.end(); ++itr)
+          {
+            IMC::EntityParameter param;
+            param.name = getLabel(modem, "AT" + itr->first);
+            param.value = CommandStats::format(itr->second);
+            stats.params.push_back(param);
+            if (dump)
+              inf("%s: %s", param.name.c_str(), param.value.c_str());
+          }
+        }
+
+        if (stats.params.size() > 0)
+          dispatch(stats);
+      }
+
+      //! Dispatch messages produced by the modem command engines.
+      void
+      dispatchModemMessages(void)
+      {
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
+        {
+          TobyL2* driver = m_modems[i].driver;
+          if (driver == NULL)
+            continue;
+
+          IMC::Message* msg = NULL;
+          while ((msg = driver->popMessage()) != NULL)
+          {
+            dispatch(msg);
+            delete msg;
+          }
+        }
+      }
+
+      //! Check each open modem for failures.
+      void
+      checkRecovery(void)
+      {
+        for (std::size_t i = 0; i < m_modems.size(); ++i)
+        {
+          if (m_modems[i].driver != NULL)
+            checkRecovery(m_modems[i]);
+        }
+      }
+
+      //! Escalate modem failures through the recovery actions. A failure
+      //! during a recovery, or shortly after one, moves to the next tier.
+      //! @param[in] modem modem.
+      void
+      checkRecovery(Modem& modem)
+      {
+        //! Timeout error. Or GSM modem turned OFF(Serial will dissapear)
+        std::string error;
+        if (modem.driver->getFailure(error))
+        {
+          RecoveryTier tier = RECOVERY_RESYNC;
+          if (modem.recovery_tier != RECOVERY_NONE)
+          {
+            tier = (RecoveryTier)(modem.recovery_tier + 1);
+          }
+          else
+          {
+            modem.failure_time = Clock::get();
+            if (modem.last_tier != RECOVERY_NONE && modem.failure_time - modem.recovery_end < m_args.recovery_window)
+              tier = (RecoveryTier)std::min(modem.last_tier + 1, (int)RECOVERY_RESTART);
+          }
+
+          war(DTR("modem %u failure: %s"), modem.index, error.c_str());
+          startRecovery(modem, tier);
+        }
+        else if (modem.recovery_tier != RECOVERY_NONE && modem.driver->isRecovered())
+        {
+          finishRecovery(modem);
+        }
+      }
+
+      //! Start a recovery action. A power cycle goes on in the main loop
+      //! and is skipped if the channel powers another modem. When a
+      //! restart is needed and other modems are running, the modem is
+      //! dropped and opened again later while the others carry the
+      //! traffic.
+      //! @param[in] modem modem.
+      //! @param[in] tier recovery action.
+      void
+      startRecovery(Modem& modem, RecoveryTier tier)
+      {
+        modem.recovery_tier = tier;
+        war(DTR("recovering modem %u: %s"), modem.index, c_recovery_names[tier]);
+
+        if (tier <= RECOVERY_SOFT_RESET)
+        {
+          modem.driver->recover(tier);
+          return;
+        }
+
+        if (tier == RECOVERY_POWER_CYCLE)
+        {
+          const Modem* other = findChannelUser(modem);
+          if (!m_args.trace_replay.empty())
+          {
+            war(DTR("not power cycling modem %u: replayed modems have no power channel"), modem.index);
+          }
+          else if (other != NULL)
+          {
+            war(DTR("not power cycling modem %u: channel %s also powers modem %u"), modem.index,
+                modem.channel.c_str(), other->index);
+          }
+          else
+          {
+            releaseModem(modem);
+            setPowerPhase(modem, false, true);
+            return;
+          }
+        }
+
+        dropModem(modem);
+      }
+
+      //! Close a modem that could not be recovered. It is opened again
+      //! later if other modems are running, otherwise the task restarts.
+      //! @param[in] modem modem.
+      void
+      dropModem(Modem& modem)
+      {
+        logRecoveryStats(modem);
+        releaseModem(modem);
+        if (countActive() > 0)
+        {
+          war(DTR("dropped modem %u, opening it again in %.0f s"), modem.index, c_reopen_delay);
+          modem.reopen_time = Clock::get() + c_reopen_delay;
+          modem.recovery_tier = RECOVERY_NONE;
+          return;
+        }
+
+        saveTrace();
+        throw RestartNeeded(DTR("Restarting.."), 1);
+      }
+
+      //! Account the time taken by the completed recovery action.
+      //! @param[in] modem modem.
+      void
+      finishRecovery(Modem& modem)
+      {
+        modem.recovery_end = Clock::get();
+        double elapsed = modem.recovery_end - modem.failure_time;
+
+        RecoveryStats& stats = modem.mttr[modem.recovery_tier];
+        ++stats.count;
+        stats.total += elapsed;
+        stats.max = std::max(stats.max, elapsed);
+
+        inf(DTR("modem %u recovered by %s in %.1f s"), modem.index, c_recovery_names[modem.recovery_tier], elapsed);
+        logRecoveryStats(modem);
+
+        modem.last_tier = modem.recovery_tier;
+        modem.recovery_tier = RECOVERY_NONE;
+      }
+
+      //! Log mean and maximum time to recovery of each tier.
+      //! @param[in] modem modem.
+      void
+      logRecoveryStats(const Modem& modem)
+      {
+        for (unsigned i = RECOVERY_RESYNC; i < RECOVERY_RESTART; ++i)
+        {
+          const RecoveryStats& stats = modem.mttr[i];
+          if (stats.count == 0)
+            continue;
+
+          debug("modem %u %s: %u recoveries, mean %.1f s, max %.1f s", modem.index, c_recovery_names[i],
+                stats.count, stats.total / stats.count, stats.max);
         }
       }
 
@@ -295,15 +1555,19 @@ namespace Transports
         while (!stopping())
         {
           sendNetworkReports();
-          try
+          if (m_args.cmd_stats_per > 0 && m_cmd_stats_timer.overflow())
           {
-            m_modem->updateTobyL2();
-          }
-          catch(...)
-          {
-            //! Timeout error. Or GSM modem turned OFF(Serial will dissapear)
-            throw RestartNeeded(DTR("Restarting.."), 1);
+            sendCommandStats(false);
+            m_cmd_stats_timer.reset();
           }
+          dispatchModemMessages();
+          checkRecovery();
+          updateModems();
+          checkReplay();
+
+          std::string error;
+          if (m_queue.getError(error))
+            war(DTR("queued SMS will not persist: %s"), error.c_str());
 
           waitForMessages(0.05);
         }
@@ -1,13 +1,28 @@
 #ifndef TRANSPORTS_GPS_TOBY_L2_INCLUDED
 #define TRANSPORTS_GPS_TOBY_L2_INCLUDED
 // ISO C++ 98 headers.
+#include <cmath>
 #include <cstring>
+#include <fstream>
 #include <queue>
 #include <cstddef>
+#include <map>
 
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
 
+// Local headers.
+#include "AdaptivePeriod.hpp"
+#include "CommandStats.hpp"
+#include "Datagrams.hpp"
+#include "LinkStatistics.hpp"
+#include "PacketDecoder.hpp"
+#include "Pdu.hpp"
+#include "Response.hpp"
+#include "SmsError.hpp"
+#include "SmsQueue.hpp"
+#include "Uploads.hpp"
+
 namespace Transports
 {
   namespace GSMTobyL2
@@ -20,38 +35,224 @@ namespace Transports
       NETWORK_CONNECTION_OK     = 4
     };
 
+    //! Connection state names.
+    static const char* c_state_names[] = {"initial", "sim ready", "registered", "attached", "connected"};
+
+    //! Signal strength change that shortens polling periods (%).
+    static const double c_rssi_swing = 10.0;
     //! SMS terminator character.
     static const char c_sms_term = 0x1a;
     //! SMS input prompt.
     static const char* c_sms_prompt = "\r\n> ";
     //! Size of SMS input prompt.
     static const unsigned c_sms_prompt_size = std::strlen(c_sms_prompt);
+    //! Time to keep incomplete concatenated SMS (s).
+    static const double c_concat_expiry = 3600.0;
+    //! +CIEV indicator for signal quality.
+    static const int c_ciev_signal = 2;
+    //! +CIEV indicator for network service availability.
+    static const int c_ciev_service = 3;
+    //! +UUPINGER error when no packet data connection is set up.
+    static const int c_ping_no_psd = 17;
+    //! Consecutive failed ping bursts before checking the connection again.
+    static const unsigned c_ping_max_errors = 4;
+    //! Command timeout (s).
+    static const double c_command_timeout = 7.0;
+    //! Time to wait for the answer to a readiness probe (s).
+    static const double c_probe_timeout = 0.5;
+    //! Initial delay between readiness probes (s).
+    static const double c_probe_delay_min = 0.1;
+    //! Maximum delay between readiness probes (s).
+    static const double c_probe_delay_max = 2.0;
+    //! Idle period of the command engine (s).
+    static const double c_engine_period = 0.05;
+
+    //! Status queries that can be chained in one command line.
+    enum StatusQuery
+    {
+      QUERY_SIM = 0x01,
+      QUERY_REG = 0x02,
+      QUERY_RAT = 0x04,
+      QUERY_PDP = 0x08,
+      QUERY_CSQ = 0x10
+    };
+
+    //! Delay before the first retry of a failed SMS (s).
+    static const double c_sms_retry_delay = 10.0;
+    //! Maximum delay between retries of a failed SMS (s).
+    static const double c_sms_retry_max_delay = 600.0;
+    //! HTTP profile used for uploads.
+    static const int c_http_profile = 0;
+    //! +UHTTPC command: POST a file.
+    static const int c_http_post_file = 4;
+    //! +UHTTPC content type: application/octet-stream.
+    static const int c_http_octet_stream = 2;
+    //! Modem file holding the server reply to uploads.
+    static const char* c_http_reply_file = "upload.rsp";
+    //! Consecutive rejected command lines before chaining is disabled.
+    static const unsigned c_chain_max_errors = 3;
+
+    //! Priority of queued commands.
+    enum CommandPriority
+    {
+      PRIORITY_LOW      = 0,
+      PRIORITY_NORMAL   = 1,
+      PRIORITY_HIGH     = 2,
+      PRIORITY_CRITICAL = 3
+    };
+
+    //! Recovery actions, in order of escalation.
+    enum RecoveryTier
+    {
+      //! No recovery in progress.
+      RECOVERY_NONE         = 0,
+      //! Resynchronize the AT command channel.
+      RECOVERY_RESYNC       = 1,
+      //! Re-attach packet domain, PDP context and PSD profile.
+      RECOVERY_REATTACH     = 2,
+      //! Cycle the modem functionality (+CFUN).
+      RECOVERY_SOFT_RESET   = 3,
+      //! Cycle the modem power channel.
+      RECOVERY_POWER_CYCLE  = 4,
+      //! Restart the task.
+      RECOVERY_RESTART      = 5
+    };
+
+    //! Names of recovery tiers.
+    static const char* c_recovery_names[] = {"none", "resync", "re-attach", "soft reset", "power cycle", "restart"};
 
 
     using DUNE_NAMESPACES;
     class TobyL2 : public HayesModem
     {
     public:
-      struct SmsRequest
-      {
-        // Request id.
-        uint16_t req_id;
-        // Source address.
-        uint16_t src_adr;
-        // Source entity id.
-        uint8_t src_eid;
-        // Recipient.
-        std::string destination;
-        // Message to send.
-        std::string sms_text;
-        // Deadline to deliver the
-        double deadline;
-        // Higher deadlines have less priority.
+      //! Network event reported by an unsolicited result code.
+      struct NetworkEvent
+      {
+        enum Type
+        {
+          //! Registration status changed (+CREG).
+          EVENT_REGISTRATION,
+          //! PDP context was deactivated or packet domain detached (+CGEV).
+          EVENT_PDP_DOWN,
+          //! Signal quality indicator changed (+CIEV).
+          EVENT_SIGNAL,
+          //! Network service indicator changed (+CIEV).
+          EVENT_SERVICE,
+          //! Ping reply, value is the round trip time (+UUPING).
+          EVENT_PING,
+          //! Ping failed, value is the error code (+UUPINGER).
+          EVENT_PING_ERROR,
+          //! Datagram received on a socket.
+          EVENT_UDP_DATA,
+          //! Socket closed by the modem.
+          EVENT_UDP_CLOSED,
+          //! HTTP command completed.
+          EVENT_HTTP_RESULT
+        };
+
+        // Event type.
+        Type type;
+        // Event value.
+        int value;
+      };
+
+      //! Network link picture, published by the task.
+      struct LinkStatus
+      {
+        // Connection state.
+        int state;
+        // Network registration status (+CREG), -1 if unknown.
+        int reg;
+        // Radio access technology (+COPS), -1 if unknown.
+        int rat;
+        // Operator name.
+        std::string oper;
+        // Location area code (hexadecimal).
+        std::string lac;
+        // Cell identifier (hexadecimal).
+        std::string cell;
+        // A PDP context is active.
+        bool pdp;
+        // Signal strength (%), negative if unknown.
+        double rssi;
+      };
+
+      //! Parts of an incoming concatenated SMS.
+      struct ConcatenatedSMS
+      {
+        // Received parts, indexed by sequence number.
+        std::vector<std::string> parts;
+        // Number of parts received.
+        unsigned received;
+        // Time of the first part.
+        double time;
+      };
+
+      //! Command queued for the command engine.
+      struct Command
+      {
+        enum Type
+        {
+          //! Set SMS send timeout.
+          CMD_SMS_TIMEOUT,
+          //! Set SMS burst time budget.
+          CMD_SMS_BUDGET,
+          //! Set RSSI querry period bounds.
+          CMD_RSSI_PERIOD,
+          //! Set network querry period bounds.
+          CMD_NTWK_PERIOD,
+          //! Configure event driven network tracking.
+          CMD_EVENT_TRACKING,
+          //! Configure new message indications.
+          CMD_MESSAGE_INDICATIONS,
+          //! Run a recovery action.
+          CMD_RECOVER
+        };
+
+        // Command type.
+        Type type;
+        // Command priority.
+        CommandPriority priority;
+        // Sequence number, keeps submission order within a priority.
+        uint64_t seq;
+        // Enable flag.
+        bool enable;
+        // Command value.
+        double value;
+        // Upper bound, for period commands.
+        double limit;
 
         bool
-        operator<(const SmsRequest& other) const
+        operator<(const Command& other) const
+        {
+          if (priority != other.priority)
+            return priority < other.priority;
+          return seq > other.seq;
+        }
+      };
+
+      //! Thread running queued commands and the state machine, so that
+      //! the task loop never waits on the modem.
+      class Engine: public Concurrency::Thread
+      {
+      public:
+        Engine(TobyL2* modem):
+          m_modem(modem)
+        { }
+
+      private:
+        //! Modem driven by this engine.
+        TobyL2* m_modem;
+
+        void
+        run(void)
         {
-          return deadline > other.deadline;
+          while (!isStopping())
+          {
+            m_modem->runEngine();
+            Time::Delay::wait(c_engine_period);
+          }
         }
       };
 
@@ -67,10 +268,10 @@ namespace Transports
 
       //! Parent task.
       Tasks::Task* m_task;
-      //! Timer for RSSI Querry
-      DUNE::Time::Counter<double> m_rssi_querry_timer;
-      //! Timer for Network Check
-      DUNE::Time::Counter<double> m_ntwk_querry_timer;
+      //! RSSI querry period
+      AdaptivePeriod m_rssi_period;
+      //! Network check period
+      AdaptivePeriod m_ntwk_period;
       //! IMEI number of the modem
       std::string m_IMEI;
       //! IMSI number of the SIM card
@@ -79,32 +280,283 @@ namespace Transports
       std::string m_phone_number;
       //! Current State of Modem
       uint8_t m_modem_state = INITIAL_STATE;
-      //! Signal Strength
-      double m_rssi;
-      //! SMS queue.
-      std::priority_queue<SmsRequest> m_queue;
+      //! Signal Strength, engine thread only (the task reads m_link).
+      double m_rssi = -1;
+      //! SMS queue (owned by the task).
+      SmsQueue* m_queue;
       //! SMS timeout
       double m_sms_tout;
-      //! Ping Value
-      int m_ping;
-
-      TobyL2(Tasks::Task* task , SerialPort* uart):
+      //! Time budget for each burst of queued SMS (s).
+      double m_sms_budget = 0;
+      //! Hold sending until the next service period after a failure.
+      bool m_sms_holdoff = false;
+      //! Rate achieved by the last SMS burst (messages per second).
+      double m_sms_rate = 0;
+      //! Next concatenated message reference.
+      uint8_t m_concat_ref = 0;
+      //! Incoming concatenated SMS being reassembled, by origin and reference.
+      std::map<std::string, ConcatenatedSMS> m_concat;
+      //! Ping targets (host names or IP addresses), used in turn.
+      std::vector<std::string> m_ping_targets;
+      //! Index of the next ping target.
+      unsigned m_ping_target = 0;
+      //! Number of packets in each ping burst.
+      unsigned m_ping_count = 1;
+      //! Ping packet size (bytes).
+      unsigned m_ping_size = 32;
+      //! Ping packet timeout (ms).
+      unsigned m_ping_tout = 5000;
+      //! Ping replies still expected from the current burst.
+      unsigned m_ping_pending = 0;
+      //! Replies received in the current burst.
+      unsigned m_ping_replies = 0;
+      //! Time limit for the current burst.
+      double m_ping_deadline = 0;
+      //! Consecutive bursts without replies.
+      unsigned m_ping_errors = 0;
+      //! Packet data connection must be set up before pinging.
+      bool m_psd_setup = false;
+      //! Jump to the current connection state with a single status probe.
+      bool m_probe_status = true;
+      //! Answers of the last chained status query, valid for one update.
+      struct
+      {
+        // Queries answered (StatusQuery flags).
+        unsigned answered;
+        // SIM status, as returned by checkSIMStatus().
+        int sim;
+        // Network registration status.
+        int reg;
+        // Radio access technology.
+        int rat;
+        // At least one PDP context is active.
+        bool pdp;
+        // First active PDP context.
+        uint8_t pdp_cid;
+        // State of the first active PDP context.
+        uint8_t pdp_state;
+        // Received signal strength indication.
+        int csq;
+      } m_status = {};
+      //! Modem accepts chained command lines.
+      bool m_chaining = true;
+      //! Consecutive rejected command lines.
+      unsigned m_chain_errors = 0;
+      //! Network link picture.
+      LinkStatus m_link = {INITIAL_STATE, -1, -1, "", "", "", false, -1};
+      //! Effective RSSI querry period, for the task.
+      double m_polling_rssi = 0;
+      //! Effective network querry period, for the task.
+      double m_polling_ntwk = 0;
+      //! Lock for the link picture and polling periods, also updated by
+      //! the reader thread.
+      Concurrency::Mutex m_link_lock;
+      //! Rolling latency statistics.
+      LinkStatistics m_latency;
+      //! Lock for ping configuration and latency statistics.
+      Concurrency::Mutex m_latency_lock;
+      //! Outgoing and incoming IMC datagrams (owned by the task).
+      Datagrams* m_datagrams;
+      //! Decoder of IMC packets received by SMS or datagram.
+      PacketDecoder m_decoder;
+      //! Remote datagram endpoint address.
+      std::string m_udp_host;
+      //! Remote datagram endpoint port, zero to disable datagrams.
+      unsigned m_udp_port = 0;
+      //! Datagram batching period (s).
+      double m_udp_period = 0;
+      //! Lock for datagram endpoint configuration.
+      Concurrency::Mutex m_udp_lock;
+      //! Modem socket used for datagrams, negative if not open.
+      int m_udp_socket = -1;
+      //! Command and serial traffic statistics.
+      CommandStats m_command_stats;
+      //! Uploads (owned by the task), NULL if another modem uploads.
+      Uploads* m_uploads;
+      //! Upload server address.
+      std::string m_http_server;
+      //! Upload server port.
+      unsigned m_http_port = 80;
+      //! Upload server path.
+      std::string m_http_path;
+      //! Bytes written to the modem file system at a time.
+      unsigned m_upload_chunk = 4096;
+      //! Maximum time the HTTP client may take to post a file (s).
+      double m_upload_tout = 300;
+      //! Lock for upload configuration.
+      Concurrency::Mutex m_upload_lock;
+      //! Result of the last HTTP command, negative if pending.
+      int m_http_result = -1;
+      //! Deadline of the pending HTTP command.
+      double m_http_deadline = 0;
+      //! Time at which the modem first answered a command.
+      double m_ready_time = 0;
+      //! Drive the state machine from unsolicited result codes.
+      bool m_event_tracking = false;
+      //! Watchdog timer for status polling in event driven mode.
+      DUNE::Time::Counter<double> m_watchdog_timer;
+      //! Inbox sweeps, pings and SMS pacing, on the minimum network
+      //! querry period whatever the state polling backs off to.
+      DUNE::Time::Counter<double> m_service_timer;
+      //! Pending network events.
+      std::queue<NetworkEvent> m_events;
+      //! Lock for pending network events (filled by the reader thread).
+      Concurrency::Mutex m_events_lock;
+      //! Signal quality changed since last RSSI query.
+      bool m_signal_changed = false;
+      //! Fetch incoming SMS on new message indications (+CMTI).
+      bool m_sms_indications = false;
+      //! Inbox listing pending after enabling new message indications.
+      bool m_inbox_sweep = false;
+      //! Storage indexes of SMS reported by +CMTI and not yet read.
+      std::queue<unsigned> m_sms_indexes;
+      //! Command engine thread.
+      Engine* m_engine = NULL;
+      //! Queued commands.
+      std::priority_queue<Command> m_commands;
+      //! Next command sequence number.
+      uint64_t m_command_seq = 0;
+      //! Lock for queued commands.
+      Concurrency::Mutex m_commands_lock;
+      //! Messages produced by the command engine, to be dispatched by the task.
+      std::queue<IMC::Message*> m_outbox;
+      //! Command engine stopped on an error (m_outbox_lock).
+      bool m_failed = false;
+      //! Description of the command engine error.
+      std::string m_failure;
+      //! Recovery action completed since last checked.
+      bool m_recovered = false;
+      //! Lock for outgoing messages and engine errors.
+      Concurrency::Mutex m_outbox_lock;
+
+      //! Constructor. Probes the modem until it answers, the modem is
+      //! only reset if it does not answer in time.
+      //! @param[in] task parent task.
+      //! @param[in] uart serial port.
+      //! @param[in] queue SMS queue.
+      //! @param[in] datagrams IMC datagrams.
+      //! @param[in] uploads file uploads, NULL to leave them to another
+      //! modem.
+      //! @param[in] ready_timeout time to wait for the modem to answer (s).
+      TobyL2(Tasks::Task* task , IO::Handle* uart, SmsQueue* queue, Datagrams* datagrams,
+             Uploads* uploads, double ready_timeout):
       HayesModem(task, uart),
-      m_task(task)
+      m_task(task),
+      m_queue(queue),
+      m_datagrams(datagrams),
+      m_uploads(uploads)
       {
-        sendReset();
-        Time::Delay::wait(2.0);
         setLineTrim(true);
         setReadMode(READ_MODE_LINE);
-        setTimeout(7.0);
+        setTimeout(c_command_timeout);
         flushInput();
         start();
+
+        if (!waitReady(ready_timeout))
+        {
+          m_task->war(DTR("modem not responding, resetting"));
+          sendReset();
+          Time::Delay::wait(2.0);
+          flushInput();
+          if (!waitReady(ready_timeout))
+          {
+            stopAndJoin();
+            throw std::runtime_error(DTR("modem not responding"));
+          }
+        }
+
         sendInitialization();
       }
 
       ~TobyL2()
       {
+        stopEngine();
+
+        while (!m_outbox.empty())
+        {
+          delete m_outbox.front();
+          m_outbox.pop();
+        }
+      }
+
+      //! @return time at which the modem first answered a command.
+      double
+      getReadyTime(void) const
+      {
+        return m_ready_time;
+      }
+
+      //! Start running queued commands and the state machine.
+      void
+      startEngine(void)
+      {
+        if (m_engine == NULL)
+        {
+          m_engine = new Engine(this);
+          m_engine->start();
+        }
+      }
+
+      //! Stop the command engine, waiting for the current command.
+      void
+      stopEngine(void)
+      {
+        if (m_engine != NULL)
+        {
+          m_engine->stopAndJoin();
+          delete m_engine;
+          m_engine = NULL;
+        }
+      }
+
+      //! Take the next message produced by the command engine.
+      //! @return message to dispatch (owned by the caller) or NULL.
+      IMC::Message*
+      popMessage(void)
+      {
+        Concurrency::ScopedMutex l(m_outbox_lock);
+        if (m_outbox.empty())
+          return NULL;
+
+        IMC::Message* msg = m_outbox.front();
+        m_outbox.pop();
+        return msg;
+      }
+
+      //! Check if the command engine stopped on an error.
+      //! @param[out] error error description.
+      //! @return true if the engine stopped.
+      bool
+      getFailure(std::string& error)
+      {
+        Concurrency::ScopedMutex l(m_outbox_lock);
+        error = m_failure;
+        return m_failed;
+      }
+
+      //! Clear the engine error and run a recovery action before any
+      //! other command.
+      //! @param[in] tier recovery action (up to soft reset).
+      void
+      recover(RecoveryTier tier)
+      {
+        //! Queue the action first so it runs before the next update.
+        postCommand(Command::CMD_RECOVER, PRIORITY_CRITICAL, true, tier);
 
+        Concurrency::ScopedMutex l(m_outbox_lock);
+        m_failed = false;
+        m_recovered = false;
+      }
+
+      //! Check if the last recovery action completed.
+      //! @return true once after the recovery action completed.
+      bool
+      isRecovered(void)
+      {
+        Concurrency::ScopedMutex l(m_outbox_lock);
+        bool recovered = m_recovered;
+        m_recovered = false;
+        return recovered;
       }
 
       void
@@ -112,7 +564,12 @@ namespace Transports
       {
         m_task->inf("Initializing the Modem");
         setEcho(false);
-        setAirplaneMode(true);
+        //! A modem kept powered across task restarts may still be
+        //! connected, do not drop the connection to configure it again.
+        bool connected = probeStatus() == NETWORK_CONNECTION_OK && getAPN() == apn;
+        m_status.answered = 0;
+        if (!connected)
+          setAirplaneMode(true);
         //! Get IMEI
         m_IMEI = getIMEI();
         m_task->inf("IMEI : %s " , m_IMEI.c_str());
@@ -125,10 +582,15 @@ namespace Transports
           m_IMSI = getIMSI();
           m_task->inf("IMSI : %s " , m_IMSI.c_str());
         }
+        //! Configure SMS Properties (PDU mode)
+        setMessageFormat(0);
+        if (connected)
+        {
+          m_task->inf("modem already connected");
+          return;
+        }
         //! Set APN to connect to
         setAPN(apn);
-        //! Configure SMS Properties
-        setMessageFormat(1);
         //! Remore from Airplane Mode
         setAirplaneMode(false);
       }
@@ -136,386 +598,1865 @@ namespace Transports
       void
       updateTobyL2()
       {
-        static uint8_t ping_err = 0;
+        //! Answers left over by an update that failed are stale.
+        m_status.answered = 0;
+        m_command_stats.setState(m_modem_state);
+        uint8_t state = m_modem_state;
+        bool state_changed = processNetworkEvents();
+        bool watchdog = false;
+
+        if (m_watchdog_timer.overflow())
+        {
+          watchdog = true;
+          m_watchdog_timer.reset();
+        }
+
+        if (m_probe_status)
+        {
+          m_modem_state = probeStatus();
+          m_probe_status = false;
+          state_changed = true;
+        }
 
-        if (m_rssi_querry_timer.overflow())
+        bool rssi_querry = m_event_tracking ? (watchdog || m_signal_changed) : m_rssi_period.overflow();
+        bool ntwk_querry = m_ntwk_period.overflow();
+        bool service = m_service_timer.overflow();
+        if (service)
+          m_service_timer.reset();
+
+        //! Fetch everything this update needs in one round trip.
+        unsigned queries = 0;
+        if (rssi_querry && m_modem_state >= NETWORK_REGISTRATION_DONE)
+          queries |= QUERY_CSQ;
+        if (ntwk_querry || state_changed)
+          queries |= getStateQueries(watchdog);
+        queryStatus(queries);
+
+        if (rssi_querry)
         {
+          bool swing = false;
           if (m_modem_state >= NETWORK_REGISTRATION_DONE )
           {
+            double previous = m_rssi;
             m_rssi = getRSSI();
+            swing = std::fabs(m_rssi - previous) >= c_rssi_swing;
             m_task->inf("Current Signal Strength %.2f%% " , m_rssi);
             //! Send RSSI here
           }
-          m_rssi_querry_timer.reset();
+          m_signal_changed = false;
+          m_rssi_period.reset(!swing && !state_changed);
+          //! A swinging signal may be followed by a lost registration.
+          if (swing)
+            m_ntwk_period.shorten();
         }
 
+        processMessageIndications();
+        checkPingTimeout();
 
-        if (m_ntwk_querry_timer.overflow())
+        if (service && m_modem_state > NETWORK_REGISTRATION_DONE)
         {
-          if (m_modem_state > NETWORK_REGISTRATION_DONE)
+          //! With new message indications the storage sweep only picks
+          //! up messages stored before indications were enabled.
+          if (!m_sms_indications || m_inbox_sweep || watchdog)
           {
             checkMessages();
-            processSMSQueue();
+            m_inbox_sweep = false;
           }
 
-          switch(m_modem_state)
+          //! Without a connection messages go out one per period.
+          if (m_modem_state != NETWORK_CONNECTION_OK)
+            processSMSQueue(0);
+        }
+
+        if (service)
+          m_sms_holdoff = false;
+
+        if (ntwk_querry || state_changed)
+        {
+          //! Chain transitions while their preconditions hold.
+          uint8_t previous;
+          do
           {
-            case INITIAL_STATE:
+            previous = m_modem_state;
+            switch(m_modem_state)
             {
-              if (checkSIMStatus() == 1)
+              case INITIAL_STATE:
               {
-                m_modem_state++;
-              }
-              else
-              {
-                m_task->err("SIM card Error");
+                if (checkSIMStatus() == 1)
+                {
+                  m_modem_state++;
+                }
+                else
+                {
+                  m_task->err("SIM card Error");
+                }
+                break;
               }
-              break;
-            }
 
-            case SIM_CARD_READY:
-            {
-              int ntwk_register = checkNetworkRegistration();
-              //! ntwk_registration 1 is registered to home netowrk
-              //! ntwk_registration 5 is registered to roaming network
-              m_task->inf("Network Registration Value %d" , ntwk_register);
-              if (ntwk_register == 1 || ntwk_register == 5 )
+              case SIM_CARD_READY:
               {
-                m_modem_state++;
-              }
-
-              break;
-            }
-
-            case NETWORK_REGISTRATION_DONE:
-            {
-              int rat_type = getRATType();
-              uint8_t pdp = 0 , state = 0;
-              m_task->inf("Radio Access Technology Type %d " , rat_type);
+                int ntwk_register = checkNetworkRegistration();
+                //! ntwk_registration 1 is registered to home netowrk
+                //! ntwk_registration 5 is registered to roaming network
+                m_task->inf("Network Registration Value %d" , ntwk_register);
+                if (ntwk_register == 1 || ntwk_register == 5 )
+                {
+                  m_modem_state++;
+                }
 
-              if (rat_type > 0 && rat_type < 7 && !checkPDPContext(&pdp , &state))
-              {
-                //! RAT 1 = GSM COMPACT
-                //! RAT 2 = UTRAN
-                //! RAT 3 = GSM/GPRS with EDGE availability
-                //! RAT 4 = UTRAN with HSDPA availability
-                //! RAT 5 = UTRAN with HSUPA availability
-                //! RAT 6 = UTRAN with HSDPA and HSUPA availability
-                //! Need to connect to Internat manually
-                activatePDPContext();
-                m_modem_state++;
-              }
-              else if (rat_type == 7)
-              {
-                //! Connected to LTE network Do nothing Modem auto connents to internet
-                m_modem_state++;
+                break;
               }
-              break;
-            }
 
-            case PDP_CONTEXT_ATTACHED:
-            {
-              //! Check PDP Context
-              uint8_t pdp = 0 , state = 0;
-              bool status =  checkPDPContext(&pdp , &state);
-              m_task->inf("PDP Context Status %d " , status);
-              if (status == true)
-              {
-                m_modem_state++;
-              }
-              else if (status == false)
+              case NETWORK_REGISTRATION_DONE:
               {
-                m_modem_state = INITIAL_STATE;
+                int rat_type = getRATType();
+                uint8_t pdp = 0 , state = 0;
+                m_task->inf("Radio Access Technology Type %d " , rat_type);
+
+                if (rat_type > 0 && rat_type < 7 && !checkPDPContext(&pdp , &state))
+                {
+                  //! RAT 1 = GSM COMPACT
+                  //! RAT 2 = UTRAN
+                  //! RAT 3 = GSM/GPRS with EDGE availability
+                  //! RAT 4 = UTRAN with HSDPA availability
+                  //! RAT 5 = UTRAN with HSUPA availability
+                  //! RAT 6 = UTRAN with HSDPA and HSUPA availability
+                  //! Need to connect to Internat manually
+                  activatePDPContext();
+                  m_modem_state++;
+                }
+                else if (rat_type == 7)
+                {
+                  //! Connected to LTE network Do nothing Modem auto connents to internet
+                  m_modem_state++;
+                }
+                break;
               }
-              break;
-            }
 
-            case NETWORK_CONNECTION_OK:
-            {
-              uint8_t pdp = 0 , state = 0;
-              bool status =  checkPDPContext(&pdp , &state);
-              if (status == false)
+              case PDP_CONTEXT_ATTACHED:
               {
-                m_modem_state = INITIAL_STATE;
+                //! Check PDP Context
+                uint8_t pdp = 0 , state = 0;
+                bool status =  checkPDPContext(&pdp , &state);
+                m_task->inf("PDP Context Status %d " , status);
+                if (status == true)
+                {
+                  m_modem_state++;
+                }
+                else if (status == false)
+                {
+                  m_modem_state = INITIAL_STATE;
+                }
+                break;
               }
-              else
+
+              case NETWORK_CONNECTION_OK:
               {
-                m_ping = pingRemote("www.google.com");
-                //! PSD is not setup
-                if (m_ping == -2)
+                uint8_t pdp = 0 , state = 0;
+                //! In event driven mode context loss is reported by +CGEV,
+                //! the explicit check only runs on the watchdog period.
+                bool status = (m_event_tracking && !watchdog) ? true : checkPDPContext(&pdp , &state);
+                if (status == false)
                 {
-                  setupPSDProfile();
+                  m_modem_state = INITIAL_STATE;
                 }
-                //! Error in Ping
-                //! Ping Can fail when the connection is bad and the ping time exceeds command timeout
-                else if (m_ping == -1)
+                else
                 {
-                  ping_err++;
-                  //! Ping Failed 4 times Check Connection status again.
-                  if (ping_err > 4)
+                  //! PSD is not setup
+                  if (m_psd_setup)
                   {
-                    ping_err = 0;
-                    m_modem_state = INITIAL_STATE;
+                    setupPSDProfile();
+                    m_psd_setup = false;
                   }
                 }
-                else if (m_ping >= 0)
-                {
-                  ping_err = 0;
-                }
+                break;
               }
+            }
+          }
+          while (m_modem_state > previous);
+
+          m_ntwk_period.reset(!state_changed && m_modem_state == state);
+        }
+
+        if (m_modem_state != state)
+        {
+          m_ntwk_period.shorten();
+          m_rssi_period.shorten();
+        }
+
+        //! Latency is sampled at a fixed rate, and as soon as connected.
+        if (m_modem_state == NETWORK_CONNECTION_OK && m_ping_pending == 0 && (service || state != m_modem_state))
+          startPing();
+
+        m_status.answered = 0;
+        updateLinkStatus();
+
+        processDatagrams();
+
+        if (m_modem_state == NETWORK_CONNECTION_OK)
+          processUpload();
+
+        if (m_modem_state == NETWORK_CONNECTION_OK && !m_sms_holdoff)
+          processSMSQueue(m_sms_budget);
+      }
+
+      //! Enable or disable network status URCs and event driven state
+      //! tracking. When enabled status polling only runs as a watchdog.
+      //! @param[in] enable true to enable event driven tracking.
+      //! @param[in] watchdog watchdog polling period (s).
+      void
+      setEventTracking(bool enable, double watchdog)
+      {
+        postCommand(Command::CMD_EVENT_TRACKING, PRIORITY_NORMAL, enable, watchdog);
+      }
+
+      //! Enable or disable new message indications. When enabled each
+      //! incoming SMS is read and deleted by its storage index as soon as
+      //! +CMTI is received.
+      //! @param[in] enable true to enable new message indications.
+      void
+      setMessageIndications(bool enable)
+      {
+        postCommand(Command::CMD_MESSAGE_INDICATIONS, PRIORITY_NORMAL, enable);
+      }
+
+      //! Configure latency probes. Each burst sends count packets to the
+      //! next target, replies arrive asynchronously as +UUPING URCs.
+      //! @param[in] targets host names or IP addresses.
+      //! @param[in] count packets per burst.
+      //! @param[in] size packet size (bytes).
+      //! @param[in] timeout packet timeout (ms).
+      //! @param[in] window number of probes in the statistics.
+      void
+      setPingConfig(const std::vector<std::string>& targets, unsigned count, unsigned size,
+                    unsigned timeout, unsigned window)
+      {
+        Concurrency::ScopedMutex l(m_latency_lock);
+        m_ping_targets = targets;
+        m_ping_count = std::max(count, 1u);
+        m_ping_size = size;
+        m_ping_tout = timeout;
+        m_latency.setWindow(window);
+      }
+
+      //! Configure the datagram endpoint.
+      //! @param[in] host remote IP address.
+      //! @param[in] port remote port, zero to disable datagrams.
+      //! @param[in] period batching period (s).
+      void
+      setDatagramConfig(const std::string& host, unsigned port, double period)
+      {
+        Concurrency::ScopedMutex l(m_udp_lock);
+        m_udp_host = host;
+        m_udp_port = port;
+        m_udp_period = period;
+      }
+
+      //! Configure the upload server.
+      //! @param[in] server server address.
+      //! @param[in] port server port.
+      //! @param[in] path server path files are posted to.
+      //! @param[in] chunk bytes written to the modem at a time.
+      //! @param[in] timeout maximum time to post a file (s).
+      void
+      setUploadConfig(const std::string& server, unsigned port, const std::string& path,
+                      unsigned chunk, double timeout)
+      {
+        Concurrency::ScopedMutex l(m_upload_lock);
+        m_http_server = server;
+        m_http_port = port;
+        m_http_path = path;
+        m_upload_chunk = std::max(chunk, 1u);
+        m_upload_tout = timeout;
+      }
+
+      //! Get command, state and serial traffic statistics since the
+      //! modem was opened.
+      //! @param[out] commands statistics by command.
+      //! @param[out] states time in each connection state (s).
+      //! @param[out] tx bytes sent.
+      //! @param[out] rx bytes received.
+      void
+      getCommandStats(CommandStats::Commands& commands, std::vector<double>& states, double& tx, double& rx)
+      {
+        m_command_stats.get(commands, states, tx, rx);
+      }
+
+      //! Get the network link picture.
+      //! @param[out] status link status.
+      void
+      getLinkStatus(LinkStatus& status)
+      {
+        Concurrency::ScopedMutex l(m_link_lock);
+        status = m_link;
+      }
+
+      //! Get the effective querry periods.
+      //! @param[out] rssi RSSI querry period, zero if tracking events (s).
+      //! @param[out] ntwk network querry period (s).
+      void
+      getPollingPeriods(double& rssi, double& ntwk)
+      {
+        Concurrency::ScopedMutex l(m_link_lock);
+        rssi = m_polling_rssi;
+        ntwk = m_polling_ntwk;
+      }
+
+      //! Get the bytes exchanged with the modem since it was opened.
+      //! @param[out] tx bytes sent.
+      //! @param[out] rx bytes received.
+      void
+      getSerialTraffic(double& tx, double& rx)
+      {
+        m_command_stats.getTraffic(tx, rx);
+      }
+
+      //! Get rolling latency statistics.
+      //! @param[out] summary latency statistics.
+      void
+      getLatency(LinkStatistics::Summary& summary)
+      {
+        Concurrency::ScopedMutex l(m_latency_lock);
+        m_latency.getSummary(summary);
+      }
+
+      void
+      setSMSTimeout(const double timeout)
+      {
+        postCommand(Command::CMD_SMS_TIMEOUT, PRIORITY_HIGH, true, timeout);
+      }
+
+      void
+      setSMSBudget(const double budget)
+      {
+        postCommand(Command::CMD_SMS_BUDGET, PRIORITY_HIGH, true, budget);
+      }
+
+      //! Set the RSSI querry period bounds. The period is shortest after
+      //! changes and doubles while the link is stable.
+      //! @param[in] rssi_timer minimum period (s).
+      //! @param[in] rssi_max maximum period (s).
+      void
+      setRssiTimer(const double rssi_timer, const double rssi_max)
+      {
+        postCommand(Command::CMD_RSSI_PERIOD, PRIORITY_HIGH, true, rssi_timer, rssi_max);
+      }
+
+      //! Set the network querry period bounds. The period is shortest
+      //! after changes and failures and doubles while the link is stable.
+      //! @param[in] ntwk_timer minimum period (s).
+      //! @param[in] ntwk_max maximum period (s).
+      void
+      setNtwkTimer(const double ntwk_timer, const double ntwk_max)
+      {
+        postCommand(Command::CMD_NTWK_PERIOD, PRIORITY_HIGH, true, ntwk_timer, ntwk_max);
+      }
+
+      void
+      sendSmsStatus(const SmsRequest* sms_req,IMC::SmsStatus::StatusEnum status,const std::string& info = "")
+      {
+        //! Forwarded IMC messages have no requester.
+        if (sms_req->binary)
+          return;
+
+        IMC::SmsStatus sms_status;
+        sms_req->fillStatus(sms_status, status, info);
+        dispatch(sms_status);
+      }
+
+
+    private:
+      //! Probe the modem with 'AT', backing off between attempts, until it
+      //! answers or the timeout expires.
+      //! @param[in] timeout maximum time to wait (s).
+      //! @return true if the modem answered.
+      bool
+      waitReady(double timeout)
+      {
+        Time::Counter<double> timer(timeout);
+        double delay = c_probe_delay_min;
+
+        while (true)
+        {
+          try
+          {
+            sendAT("");
+            //! Skip the echo of the probe, if enabled.
+            Time::Counter<double> reply(c_probe_timeout);
+            while (readLine(reply) != "OK");
+
+            m_ready_time = Time::Clock::get();
+            return true;
+          }
+          catch (...)
+          { }
+
+          if (timer.overflow())
+            return false;
+
+          Time::Delay::wait(std::min(delay, timer.getRemaining()));
+          delay = std::min(delay * 2, c_probe_delay_max);
+        }
+      }
+
+      //! Queue a command for the command engine.
+      void
+      postCommand(Command::Type type, CommandPriority priority, bool enable, double value = 0, double limit = 0)
+      {
+        Command cmd;
+        cmd.type = type;
+        cmd.priority = priority;
+        cmd.enable = enable;
+        cmd.value = value;
+        cmd.limit = limit;
+
+        Concurrency::ScopedMutex l(m_commands_lock);
+        cmd.seq = m_command_seq++;
+        m_commands.push(cmd);
+      }
+
+      //! Command engine iteration: run queued commands by priority, then
+      //! a state machine step. Errors stop the engine until the task
+      //! handles them.
+      void
+      runEngine(void)
+      {
+        {
+          //! Cleared by recover() on the task thread.
+          Concurrency::ScopedMutex l(m_outbox_lock);
+          if (m_failed)
+            return;
+        }
+
+        try
+        {
+          Command cmd;
+          while (popCommand(cmd))
+            runCommand(cmd);
+
+          updateTobyL2();
+        }
+        catch (std::exception& e)
+        {
+          setFailure(e.what());
+        }
+        catch (...)
+        {
+          setFailure(DTR("unknown error"));
+        }
+      }
+
+      bool
+      popCommand(Command& cmd)
+      {
+        Concurrency::ScopedMutex l(m_commands_lock);
+        if (m_commands.empty())
+          return false;
+
+        cmd = m_commands.top();
+        m_commands.pop();
+        return true;
+      }
+
+      void
+      runCommand(const Command& cmd)
+      {
+        switch (cmd.type)
+        {
+          case Command::CMD_SMS_TIMEOUT:
+            m_sms_tout = cmd.value;
+            break;
+
+          case Command::CMD_SMS_BUDGET:
+            m_sms_budget = cmd.value;
+            break;
+
+          case Command::CMD_RSSI_PERIOD:
+            m_rssi_period.setBounds(cmd.value, cmd.limit);
+            break;
+
+          case Command::CMD_NTWK_PERIOD:
+            m_ntwk_period.setBounds(cmd.value, cmd.limit);
+            m_service_timer.setTop(cmd.value);
+            break;
+
+          case Command::CMD_EVENT_TRACKING:
+            configureEventTracking(cmd.enable, cmd.value);
+            break;
+
+          case Command::CMD_MESSAGE_INDICATIONS:
+            configureMessageIndications(cmd.enable);
+            break;
+
+          case Command::CMD_RECOVER:
+            runRecovery((RecoveryTier)(int)cmd.value);
+            break;
+        }
+      }
+
+      void
+      setFailure(const std::string& error)
+      {
+        m_task->err(DTR("modem error: %s"), error.c_str());
+        Concurrency::ScopedMutex l(m_outbox_lock);
+        m_failure = error;
+        m_failed = true;
+      }
+
+      //! Run a recovery action, throws if the modem is still unusable.
+      void
+      runRecovery(RecoveryTier tier)
+      {
+        m_task->inf(DTR("recovery: %s"), c_recovery_names[tier]);
+
+        //! All tiers start from a synchronized command channel.
+        setReadMode(READ_MODE_LINE);
+        flushInput();
+        if (!waitReady(c_command_timeout))
+          throw std::runtime_error(DTR("modem not responding"));
+
+        m_ping_pending = 0;
+        m_sms_holdoff = false;
+        m_udp_socket = -1;
+
+        if (tier >= RECOVERY_SOFT_RESET)
+        {
+          setAirplaneMode(true);
+          setAirplaneMode(false);
+        }
+        else if (tier >= RECOVERY_REATTACH)
+        {
+          sendAT("+CGATT=1");
+          expectOK();
+          activatePDPContext();
+          m_psd_setup = true;
+        }
+
+        m_probe_status = true;
+
+        Concurrency::ScopedMutex l(m_outbox_lock);
+        m_recovered = true;
+      }
+
+      //! Send a command, accounting it in the command statistics. This
+      //! and the following I/O functions hide the ones of HayesModem.
+      void
+      sendAT(const std::string& str)
+      {
+        m_command_stats.begin(str, str.size() + 3);
+        HayesModem::sendAT(str);
+      }
+
+      std::string
+      readLine(void)
+      {
+        try
+        {
+          std::string line = HayesModem::readLine();
+          checkResult(line);
+          return line;
+        }
+        catch (ReadTimeout&)
+        {
+          m_command_stats.timeout();
+          throw;
+        }
+      }
+
+      std::string
+      readLine(Time::Counter<double>& timer)
+      {
+        try
+        {
+          std::string line = HayesModem::readLine(timer);
+          checkResult(line);
+          return line;
+        }
+        catch (ReadTimeout&)
+        {
+          m_command_stats.timeout();
+          throw;
+        }
+      }
+
+      void
+      expectOK(void)
+      {
+        if (readLine() != "OK")
+          throw UnexpectedReply();
+      }
+
+      std::string
+      readValue(const std::string& cmd)
+      {
+        sendAT(cmd);
+        std::string value = readLine();
+        expectOK();
+        return value;
+      }
+
+      void
+      sendRaw(const uint8_t* data, unsigned size)
+      {
+        m_command_stats.addSent(size);
+        HayesModem::sendRaw(data, size);
+      }
+
+      void
+      readRaw(Time::Counter<double>& timer, uint8_t* data, unsigned size)
+      {
+        try
+        {
+          HayesModem::readRaw(timer, data, size);
+          m_command_stats.addReceived(size);
+        }
+        catch (ReadTimeout&)
+        {
+          m_command_stats.timeout();
+          throw;
+        }
+      }
+
+      //! End the command in progress on a final result code.
+      void
+      checkResult(const std::string& line)
+      {
+        if (line == "OK")
+          m_command_stats.end(false);
+        else if (line == "ERROR" || String::startsWith(line, "+CME ERROR:") || String::startsWith(line, "+CMS ERROR:"))
+          m_command_stats.end(true);
+      }
+
+      //! Queue a message to be dispatched by the task.
+      void
+      dispatch(const IMC::Message& msg)
+      {
+        Concurrency::ScopedMutex l(m_outbox_lock);
+        m_outbox.push(msg.clone());
+      }
+
+      void
+      configureEventTracking(bool enable, double watchdog)
+      {
+        //! +CREG: <stat>[,<lac>,<ci>[,<AcT>]] on registration changes.
+        sendAT(enable ? "+CREG=2" : "+CREG=0");
+        expectOK();
+        //! +CGEV: on PDP context and packet domain events.
+        sendAT(enable ? "+CGEREP=1" : "+CGEREP=0");
+        expectOK();
+
+        try
+        {
+          //! +CIEV: on signal and service indicator changes.
+          sendAT(enable ? "+CMER=1,0,0,2,1" : "+CMER=0");
+          expectOK();
+        }
+        catch (...)
+        {
+          m_task->war(DTR("indicator events not supported, relying on watchdog for signal quality"));
+        }
+
+        m_watchdog_timer.setTop(watchdog);
+        m_event_tracking = enable;
+      }
+
+      void
+      configureMessageIndications(bool enable)
+      {
+        sendAT(enable ? "+CNMI=2,1" : "+CNMI=0,0");
+        expectOK();
+        m_sms_indications = enable;
+        m_inbox_sweep = enable;
+      }
+
+      bool
+      handleUnsolicited(const std::string& str)
+      {
+        NetworkEvent event;
+        //! Every received line goes through here, with its terminator.
+        m_command_stats.addReceived(str.size() + 2);
+
+        if (String::startsWith(str, "+CREG:"))
+        {
+          //! Reply to +CREG? starts with <n>,<stat>, the URC with <stat> and
+          //! is either alone or followed by the quoted location area code.
+          Response creg(str, "+CREG:");
+          if (creg.size() > 1 && !creg[1].quoted())
+            return false;
+
+          updateRegistration(creg, 0);
+
+          event.type = NetworkEvent::EVENT_REGISTRATION;
+          if (!creg.getInt(0, event.value))
+            return true;
+        }
+        else if (String::startsWith(str, "+CGEV:"))
+        {
+          if (str.find("DEACT") == std::string::npos && str.find("DETACH") == std::string::npos)
+            return true;
+
+          event.type = NetworkEvent::EVENT_PDP_DOWN;
+          event.value = 0;
+        }
+        else if (String::startsWith(str, "+UUPING:"))
+        {
+          //! +UUPING: <retry_num>,<p_size>,<remote_hostname>,<remote_ip>,<ttl>,<rtt>
+          event.type = NetworkEvent::EVENT_PING;
+          if (!Response(str, "+UUPING:").getInt(5, event.value))
+            event.value = -1;
+        }
+        else if (String::startsWith(str, "+UUPINGER:"))
+        {
+          event.type = NetworkEvent::EVENT_PING_ERROR;
+          if (!Response(str, "+UUPINGER:").getInt(0, event.value))
+            event.value = -1;
+        }
+        else if (String::startsWith(str, "+UUSORF:"))
+        {
+          //! +UUSORF: <socket>,<length>
+          event.type = NetworkEvent::EVENT_UDP_DATA;
+          if (!Response(str, "+UUSORF:").getInt(0, event.value))
+            return true;
+        }
+        else if (String::startsWith(str, "+UUSOCL:"))
+        {
+          //! +UUSOCL: <socket>
+          event.type = NetworkEvent::EVENT_UDP_CLOSED;
+          if (!Response(str, "+UUSOCL:").getInt(0, event.value))
+            return true;
+        }
+        else if (String::startsWith(str, "+UUHTTPCR:"))
+        {
+          //! +UUHTTPCR: <profile_id>,<http_command>,<http_result>
+          Response uuhttpcr(str, "+UUHTTPCR:");
+          int profile = -1;
+          event.type = NetworkEvent::EVENT_HTTP_RESULT;
+          if (!uuhttpcr.getInt(0, profile) || profile != c_http_profile || !uuhttpcr.getInt(2, event.value))
+            return true;
+        }
+        else if (String::startsWith(str, "+CMTI:"))
+        {
+          //! +CMTI: "ME",<index>
+          int index = -1;
+          if (!Response(str, "+CMTI:").getInt(1, index) || index < 0)
+            return true;
+
+          Concurrency::ScopedMutex l(m_events_lock);
+          m_sms_indexes.push(index);
+          return true;
+        }
+        else if (String::startsWith(str, "+CIEV:"))
+        {
+          Response ciev(str, "+CIEV:");
+          int indicator = -1;
+          if (!ciev.getInt(0, indicator) || !ciev.getInt(1, event.value))
+            return true;
+
+          if (indicator == c_ciev_signal)
+            event.type = NetworkEvent::EVENT_SIGNAL;
+          else if (indicator == c_ciev_service)
+            event.type = NetworkEvent::EVENT_SERVICE;
+          else
+            return true;
+        }
+        else
+        {
+          return false;
+        }
+
+        Concurrency::ScopedMutex l(m_events_lock);
+        m_events.push(event);
+        return true;
+      }
+
+      //! Apply pending network events to the state machine.
+      //! @return true if the modem state changed.
+      bool
+      processNetworkEvents(void)
+      {
+        uint8_t previous = m_modem_state;
+
+        while (true)
+        {
+          NetworkEvent event;
+          {
+            Concurrency::ScopedMutex l(m_events_lock);
+            if (m_events.empty())
+              break;
+
+            event = m_events.front();
+            m_events.pop();
+          }
+
+          switch (event.type)
+          {
+            case NetworkEvent::EVENT_REGISTRATION:
+              m_task->inf("Network Registration Event %d" , event.value);
+              if (event.value == 1 || event.value == 5)
+              {
+                if (m_modem_state == SIM_CARD_READY)
+                  m_modem_state = NETWORK_REGISTRATION_DONE;
+              }
+              else if (m_modem_state > SIM_CARD_READY)
+              {
+                m_modem_state = SIM_CARD_READY;
+              }
+              break;
+
+            case NetworkEvent::EVENT_SERVICE:
+              if (event.value == 0 && m_modem_state > SIM_CARD_READY)
+              {
+                m_task->inf("Network service lost");
+                m_modem_state = SIM_CARD_READY;
+              }
+              break;
+
+            case NetworkEvent::EVENT_PDP_DOWN:
+              if (m_modem_state > NETWORK_REGISTRATION_DONE)
+              {
+                m_task->inf("PDP context deactivated");
+                m_modem_state = NETWORK_REGISTRATION_DONE;
+              }
+              break;
+
+            case NetworkEvent::EVENT_SIGNAL:
+              m_signal_changed = true;
+              break;
+
+            case NetworkEvent::EVENT_PING:
+              handlePingReply(event.value);
+              break;
+
+            case NetworkEvent::EVENT_PING_ERROR:
+              handlePingError(event.value);
+              break;
+
+            case NetworkEvent::EVENT_UDP_DATA:
+              if (event.value == m_udp_socket)
+                receiveDatagrams();
+              break;
+
+            case NetworkEvent::EVENT_HTTP_RESULT:
+              m_http_result = event.value;
+              break;
+
+            case NetworkEvent::EVENT_UDP_CLOSED:
+              if (event.value == m_udp_socket)
+              {
+                m_task->inf("datagram socket closed");
+                m_udp_socket = -1;
+              }
+              break;
+          }
+        }
+
+        return m_modem_state != previous;
+      }
+
+      void
+      sendSMS(SmsRequest& sms_req, double timeout)
+      {
+        std::vector<std::vector<uint8_t> > parts;
+        uint8_t dcs = c_dcs_gsm7;
+
+        if (sms_req.binary)
+        {
+          Pdu::splitData(sms_req.sms_text, parts);
+          dcs = c_dcs_8bit;
+        }
+        else
+        {
+          std::vector<uint8_t> septets;
+          Pdu::encodeText(sms_req.sms_text, septets);
+          Pdu::split(septets, parts);
+        }
+
+        //! Parts already sent are kept across retries, with the same reference.
+        if (sms_req.parts_sent == 0)
+          sms_req.concat_ref = m_concat_ref++;
+
+        for (; sms_req.parts_sent < parts.size(); ++sms_req.parts_sent)
+        {
+          unsigned tpdu_size = 0;
+          std::string pdu = Pdu::encodeSubmit(sms_req.destination, parts[sms_req.parts_sent], dcs,
+                                              sms_req.concat_ref, parts.size(),
+                                              sms_req.parts_sent + 1, tpdu_size);
+          Time::Counter<double> timer(timeout);
+          submitSMS(String::str("+CMGS=%u", tpdu_size), pdu, timer);
+        }
+      }
+
+      //! Issue a send command, wait for the input prompt and send the PDU.
+      //! @param[in] command send command.
+      //! @param[in] msg hexadecimal PDU.
+      //! @param[in] timer send timeout.
+      void
+      submitSMS(const std::string& command, const std::string& msg, Time::Counter<double>& timer)
+      {
+        uint8_t bfr[16];
+
+        try
+        {
+          setReadMode(HayesModem::READ_MODE_RAW);
+          sendAT(command);
+          readRaw(timer, bfr, 4);
+          setReadMode(HayesModem::READ_MODE_LINE);
+
+          if (std::memcmp(bfr, c_sms_prompt, c_sms_prompt_size) != 0)
+            throw Hardware::UnexpectedReply();
+
+          std::string data = msg;
+          data.push_back(c_sms_term);
+          sendRaw((uint8_t*)&data[0], data.size());
+        }
+        catch (...)
+        {
+          setReadMode(HayesModem::READ_MODE_LINE);
+          throw;
+        }
+
+        std::string reply = readLine(timer);
+        if (reply == "ERROR")
+        {
+          throw std::runtime_error(DTR("unknown error"));
+        }
+        else if (String::startsWith(reply, "+CMGS:"))
+        {
+          setBusy(true);
+        }
+        else if (String::startsWith(reply, "+CMS ERROR:"))
+        {
+          throw SmsError(reply.substr(std::strlen("+CMS ERROR:")));
+        }
+        else
+        {
+          throw UnexpectedReply();
+        }
+
+        expectOK();
+      }
+
+      //! Read, dispatch and delete stored messages one by one. The
+      //! storage usage is checked first, so an empty store costs a
+      //! single command, and the scan stops once every stored message
+      //! was found. The modem stores messages at the lowest free index.
+      void
+      checkMessages(void)
+      {
+        //! +CPMS: <mem1>,<used1>,<total1>,...
+        std::string reply = readValue("+CPMS?");
+        Response cpms(reply, "+CPMS:");
+        int used = 0;
+        int total = 0;
+        if (!cpms.getInt(1, used) || !cpms.getInt(2, total))
+          throw Hardware::UnexpectedReply();
+
+        //! Storage indexes start at 0 or 1 depending on the storage.
+        int found = 0;
+        for (int index = 0; index <= total && found < used; ++index)
+        {
+          std::string pdu;
+          if (!readStoredSMS(index, pdu))
+            continue;
+
+          ++found;
+          if (!pdu.empty())
+            handleSMS(pdu);
+          deleteSMS(index);
+        }
+      }
+
+      //! Read and delete messages reported by new message indications.
+      void
+      processMessageIndications(void)
+      {
+        while (true)
+        {
+          unsigned index = 0;
+          {
+            Concurrency::ScopedMutex l(m_events_lock);
+            if (m_sms_indexes.empty())
+              return;
+
+            index = m_sms_indexes.front();
+            m_sms_indexes.pop();
+          }
+
+          //! A storage sweep may have read it already.
+          std::string pdu;
+          if (!readStoredSMS(index, pdu))
+            continue;
+
+          if (!pdu.empty())
+            handleSMS(pdu);
+          deleteSMS(index);
+        }
+      }
+
+      //! Read a single message by its storage index.
+      //! @param[in] index storage index.
+      //! @param[out] pdu hexadecimal PDU, empty if the entry is not a
+      //! received message.
+      //! @return false if the storage index is empty.
+      bool
+      readStoredSMS(unsigned index, std::string& pdu)
+      {
+        sendAT(String::str("+CMGR=%u", index));
+        //! +CMGR: <stat>,[<alpha>],<length>
+        std::string header = readLine();
+        if (header == "OK")
+          return false;
+
+        if (String::startsWith(header, "+CMS ERROR:"))
+          return false;
+
+        int stat = -1;
+        if (!Response(header, "+CMGR:").getInt(0, stat))
+          throw Hardware::UnexpectedReply();
+
+        pdu = readLine();
+        expectOK();
+        //! Only REC UNREAD and REC READ entries are received messages.
+        if (stat > 1)
+          pdu.clear();
+        return true;
+      }
+
+      void
+      deleteSMS(unsigned index)
+      {
+        sendAT(String::str("+CMGD=%u", index));
+        expectOK();
+      }
+
+      //! Decode a received PDU, reassemble concatenated messages and
+      //! dispatch complete ones.
+      //! @param[in] pdu hexadecimal PDU.
+      void
+      handleSMS(const std::string& pdu)
+      {
+        Pdu::Deliver deliver;
+        if (!Pdu::decodeDeliver(pdu, deliver))
+        {
+          m_task->war(DTR("discarding malformed SMS PDU"));
+          return;
+        }
+
+        if (deliver.total > 1)
+        {
+          if (deliver.seq == 0 || deliver.seq > deliver.total)
+            return;
+
+          purgeConcatenated();
+
+          std::string key = String::str("%s/%u", deliver.origin.c_str(), deliver.ref);
+          ConcatenatedSMS& concat = m_concat[key];
+          if (concat.parts.size() != deliver.total)
+          {
+            concat.parts.assign(deliver.total, std::string());
+            concat.received = 0;
+            concat.time = Time::Clock::get();
+          }
+
+          std::string& part = concat.parts[deliver.seq - 1];
+          if (part.empty())
+            ++concat.received;
+          part.swap(deliver.data);
+
+          if (concat.received < deliver.total)
+            return;
+
+          for (std::size_t i = 0; i < concat.parts.size(); ++i)
+            deliver.data.append(concat.parts[i]);
+
+          m_concat.erase(key);
+        }
+
+        if (deliver.binary)
+        {
+          unsigned count = 0;
+          if (m_decoder.assign((const uint8_t*)deliver.data.data(), deliver.data.size()))
+            count = dispatchPackets("SMS");
+
+          if (count > 0)
+            m_task->inf(DTR("received %u IMC messages via SMS from %s"), count, deliver.origin.c_str());
+          else
+            m_task->war(DTR("discarding unrecognized binary SMS from %s"), deliver.origin.c_str());
+        }
+        else
+        {
+          dispatchSMS(deliver.origin, deliver.data);
+        }
+      }
+
+      //! Drop incoming concatenated SMS that were never completed.
+      void
+      purgeConcatenated(void)
+      {
+        double now = Time::Clock::get();
+        std::map<std::string, ConcatenatedSMS>::iterator itr = m_concat.begin();
+        while (itr != m_concat.end())
+        {
+          if (now - itr->second.time > c_concat_expiry)
+          {
+            m_task->war(DTR("discarding incomplete concatenated SMS %s"), itr->first.c_str());
+            m_concat.erase(itr++);
+          }
+          else
+          {
+            ++itr;
+          }
+        }
+      }
+
+      //! Dispatch a received text message, either as the IMC message it
+      //! encodes in Base64 or as a text message.
+      void
+      dispatchSMS(const std::string& origin, const std::string& data)
+      {
+        if (m_decoder.decodeBase64(data))
+        {
+          unsigned count = dispatchPackets("SMS");
+          if (count > 0)
+          {
+            m_task->inf(DTR("received %u IMC messages via SMS from %s"), count, origin.c_str());
+            return;
+          }
+
+          m_task->war(DTR("Parsing unrecognized Base64 message as text"));
+        }
+
+        IMC::TextMessage sms;
+        sms.origin = origin;
+        sms.text = data;
+        m_task->inf("Recieved sms from %s , Message %s " , sms.origin.c_str() , sms.text.c_str() );
+        dispatch(sms);
+      }
+
+      //! Dispatch the IMC packets loaded in the decoder.
+      //! @param[in] via transport, for logging.
+      //! @return number of messages dispatched.
+      unsigned
+      dispatchPackets(const char* via)
+      {
+        unsigned count = 0;
+        const IMC::Message* msg = NULL;
+        while ((msg = m_decoder.next()) != NULL)
+        {
+          m_task->debug("received IMC message of type %s via %s", msg->getName(), via);
+          dispatch(*msg);
+          ++count;
+        }
+
+        unsigned rejected = m_decoder.getRejected();
+        if (rejected > 0)
+          m_task->war(DTR("discarding %u corrupt IMC packets received via %s"), rejected, via);
+
+        return count;
+      }
+
+      void
+      setMessageFormat(unsigned value)
+      {
+        sendAT(String::str("+CMGF=%u", value));
+        expectOK();
+      }
+
+      //! Send queued messages back-to-back until the queue is empty, a
+      //! message fails or the time budget is exhausted. At least one
+      //! message is attempted.
+      //! @param[in] budget time budget (s).
+      void
+      processSMSQueue(double budget)
+      {
+        double start = Time::Clock::get();
+        unsigned sent = 0;
+
+        // Messages that are too old, discard them.
+        std::vector<SmsRequest> expired;
+        if (m_queue->purge(Time::Clock::getSinceEpoch(), expired) > 0)
+        {
+          for (std::size_t i = 0; i < expired.size(); ++i)
+            sendSmsStatus(&expired[i],IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,getRetryInfo(expired[i], DTR("SMS timeout")));
+          m_task->war(DTR("discarded %u expired SMS"), (unsigned)expired.size());
+        }
+
+        do
+        {
+          SmsRequest sms_req;
+          if (!m_queue->pop(sms_req))
+            break;
+
+          // Message expired while sending the previous ones.
+          if (Time::Clock::getSinceEpoch() >= sms_req.deadline)
+          {
+            m_queue->done(sms_req);
+            sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,getRetryInfo(sms_req, DTR("SMS timeout")));
+            m_task->war(DTR("discarded expired SMS to recipient %s"), sms_req.destination.c_str());
+            continue;
+          }
+
+          try
+          {
+            sendSMS(sms_req, m_sms_tout);
+            //SMS successfully sent, otherwise driver throws error
+            m_queue->done(sms_req);
+            sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_SENT,getRetryInfo(sms_req, ""));
+            ++sent;
+          }
+          catch (SmsError& e)
+          {
+            if (!e.isPermanent())
+            {
+              retrySMS(sms_req, e.what());
+              m_sms_holdoff = true;
               break;
             }
+
+            //! Retrying will not help, other messages go on.
+            m_queue->done(sms_req);
+            sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_ERROR,getRetryInfo(sms_req, e.what()));
+            m_task->war(DTR("SMS to recipient %s failed: %s"), sms_req.destination.c_str(), e.what());
+          }
+          catch (std::exception& e)
+          {
+            retrySMS(sms_req, e.what());
+            m_sms_holdoff = true;
+            break;
           }
-          m_ntwk_querry_timer.reset();
+        }
+        while (Time::Clock::get() - start < budget);
+
+        if (sent > 0)
+        {
+          double elapsed = Time::Clock::get() - start;
+          m_sms_rate = (elapsed > 0) ? sent / elapsed : 0;
+          m_task->inf(DTR("sent %u SMS in %.2f s (%.2f SMS/s), %u queued"),
+                      sent, elapsed, m_sms_rate, m_queue->size());
         }
       }
 
+      //! Send queued datagrams while connected, opening the socket when
+      //! needed. The socket is closed when the connection is lost.
       void
-      setSMSTimeout(const double timeout)
+      processDatagrams(void)
       {
-        m_sms_tout = timeout;
+        std::string host;
+        unsigned port = 0;
+        double period = 0;
+        {
+          Concurrency::ScopedMutex l(m_udp_lock);
+          host = m_udp_host;
+          port = m_udp_port;
+          period = m_udp_period;
+        }
+
+        if (port == 0)
+          m_datagrams->clear();
+
+        //! Datagrams wait for the connection, up to the queue size.
+        if (m_modem_state != NETWORK_CONNECTION_OK || port == 0)
+        {
+          if (m_udp_socket >= 0)
+            closeSocket();
+          return;
+        }
+
+        if (m_udp_socket < 0)
+          openSocket();
+
+        std::string data;
+        unsigned msgs = 0;
+        while (m_datagrams->pop(period, data, msgs))
+        {
+          //! +USOST=<socket>,<remote_addr>,<remote_port>,<length>,<data>
+          sendAT(String::str("+USOST=%d,\"%s\",%u,%u,\"%s\"", m_udp_socket, host.c_str(), port,
+                             (unsigned)data.size(), String::toHex(data).c_str()));
+          std::string reply = readLine();
+          if (!String::startsWith(reply, "+USOST:"))
+          {
+            m_task->war(DTR("failed to send datagram: %s"), reply.c_str());
+            m_datagrams->addLost(msgs, data.size());
+            //! The socket may be gone, open a new one next time.
+            closeSocket();
+            break;
+          }
+          expectOK();
+        }
       }
 
+      //! Open a UDP socket with data exchanged in hexadecimal.
       void
-      setRssiTimer(const double rssi_timer)
+      openSocket(void)
       {
-        m_rssi_querry_timer.setTop(rssi_timer);
+        sendAT("+UDCONF=1,1");
+        expectOK();
+
+        //! +USOCR: <socket>
+        int socket = -1;
+        std::string line = readValue("+USOCR=17");
+        if (!Response(line, "+USOCR:").getInt(0, socket) || socket < 0)
+          throw std::runtime_error(DTR("failed to create datagram socket"));
+
+        m_udp_socket = socket;
+        m_task->debug("datagram socket %d open", socket);
       }
 
       void
-      setNtwkTimer(const double ntwk_timer)
+      closeSocket(void)
       {
-        m_ntwk_querry_timer.setTop(ntwk_timer);
+        sendAT(String::str("+USOCL=%d", m_udp_socket));
+        m_udp_socket = -1;
+        //! The socket may already be closed with the connection.
+        readLine();
       }
 
+      //! Read all pending datagrams and queue their IMC messages.
       void
-      sendSmsStatus(const SmsRequest* sms_req,IMC::SmsStatus::StatusEnum status,const std::string& info = "")
+      receiveDatagrams(void)
       {
-        IMC::SmsStatus sms_status;
-        sms_status.setDestination(sms_req->src_adr);
-        sms_status.setDestinationEntity(sms_req->src_eid);
-        sms_status.req_id = sms_req->req_id;
-        sms_status.info   = info;
-        sms_status.status = status;
-        m_task->dispatch(sms_status);
-      }
+        while (m_udp_socket >= 0)
+        {
+          //! +USORF: <socket>,<remote_ip_addr>,<remote_port>,<length>,<data>
+          sendAT(String::str("+USORF=%d,%u", m_udp_socket, (unsigned)c_udp_max_datagram));
+          std::string line = readLine();
+          Response usorf(line, "+USORF:");
+          int length = 0;
+          std::string hex;
+          if (!usorf.getInt(3, length) || !usorf.getString(4, hex))
+          {
+            //! Only the remaining length when there is nothing to read.
+            if (usorf.valid())
+              expectOK();
+            break;
+          }
+
+          expectOK();
+          if (length == 0)
+            break;
 
+          unsigned count = 0;
+          if (m_decoder.decodeHex(hex))
+            count = dispatchPackets("UDP");
+          else
+            m_task->war(DTR("discarding malformed datagram"));
 
-    private:
+          m_datagrams->addReceived(count, length);
+        }
+      }
+
+      //! Advance the upload in progress by one step: store a chunk of the
+      //! file in the modem file system, appending to it, then post it
+      //! with the HTTP client and wait for the result. An interrupted
+      //! upload resumes from the size stored in the modem.
       void
-      sendSMS(const std::string& number, const std::string& msg, double timeout)
+      processUpload(void)
       {
-        uint8_t bfr[16];
+        if (m_uploads == NULL)
+          return;
 
-        Time::Counter<double> timer(timeout);
+        UploadJob* job = m_uploads->current();
+        if (job == NULL)
+          return;
 
-        try
+        std::string server;
+        std::string path;
+        unsigned port = 0;
+        unsigned chunk = 0;
+        double timeout = 0;
         {
-          setReadMode(HayesModem::READ_MODE_RAW);
-          sendAT(String::str("+CMGS=\"%s\"", number.c_str()));
-          readRaw(timer, bfr, 4);
-          setReadMode(HayesModem::READ_MODE_LINE);
+          Concurrency::ScopedMutex l(m_upload_lock);
+          server = m_http_server;
+          port = m_http_port;
+          path = m_http_path;
+          chunk = m_upload_chunk;
+          timeout = m_upload_tout;
+        }
 
-          if (std::memcmp(bfr, c_sms_prompt, c_sms_prompt_size) != 0)
-            throw Hardware::UnexpectedReply();
+        if (server.empty())
+          return;
 
-          std::string data = msg;
-          data.push_back(c_sms_term);
-          sendRaw((uint8_t*)&data[0], data.size());
-        }
-        catch (...)
+        if (job->posting)
         {
-          setReadMode(HayesModem::READ_MODE_LINE);
-          throw;
+          if (m_http_result < 0 && Time::Clock::get() < m_http_deadline)
+            return;
+
+          if (m_http_result == 1)
+          {
+            m_task->inf(DTR("uploaded %s (%u bytes) in %.1f s"), job->name.c_str(),
+                        (unsigned)job->size, Time::Clock::get() - job->start);
+            deleteModemFile(job->name);
+            m_uploads->pop();
+          }
+          else
+          {
+            //! Start over, the server may hold a partial file.
+            std::string name = job->name;
+            unsigned attempts = job->retries + 1;
+            deleteModemFile(name);
+            m_uploads->setOffset(0);
+            if (m_uploads->requeue())
+              m_task->err(DTR("failed to upload %s, retrying later"), name.c_str());
+            else
+              m_task->err(DTR("failed to upload %s, giving up after %u attempts"), name.c_str(), attempts);
+          }
+          return;
         }
 
-        std::string reply = readLine(timer);
-        if (reply == "ERROR")
+        //! Writes append to an existing file, start from an empty one.
+        if (job->offset == 0 && !job->resync)
+          deleteModemFile(job->name);
+
+        if (job->resync)
         {
-          throw std::runtime_error(DTR("unknown error"));
+          m_uploads->setOffset(std::min(getModemFileSize(job->name), job->size));
+          job->resync = false;
+          m_task->debug("resuming upload of %s at %u bytes", job->name.c_str(), (unsigned)job->offset);
         }
-        else if (String::startsWith(reply, "+CMGS:"))
+
+        if (job->offset < job->size)
         {
-          setBusy(true);
+          std::string data;
+          if (!readFileChunk(job->path, job->offset, std::min<std::size_t>(chunk, job->size - job->offset), data))
+          {
+            m_task->err(DTR("failed to read %s"), job->path.c_str());
+            deleteModemFile(job->name);
+            m_uploads->pop();
+            return;
+          }
+
+          //! Cleared once the modem acknowledges the chunk.
+          job->resync = true;
+          writeModemFile(job->name, data);
+          job->resync = false;
+          m_uploads->setOffset(job->offset + data.size());
+          return;
         }
-        else if (String::startsWith(reply, "+CMS ERROR:"))
+
+        postFile(server, port, path + "/" + job->name, job->name);
+        job->posting = true;
+        m_http_result = -1;
+        m_http_deadline = Time::Clock::get() + timeout;
+      }
+
+      //! Read part of a local file.
+      //! @param[in] path file.
+      //! @param[in] offset first byte.
+      //! @param[in] size number of bytes.
+      //! @param[out] data file contents.
+      //! @return false if the file cannot be read.
+      bool
+      readFileChunk(const std::string& path, std::size_t offset, std::size_t size, std::string& data)
+      {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        data.resize(size);
+        if (!file.seekg(offset) || !file.read(&data[0], size))
+          return false;
+
+        return true;
+      }
+
+      //! Append data to a file in the modem file system.
+      //! @param[in] name file name.
+      //! @param[in] data file contents.
+      void
+      writeModemFile(const std::string& name, const std::string& data)
+      {
+        Time::Counter<double> timer(getTimeout());
+        uint8_t bfr = 0;
+
+        try
         {
-          int code = -1;
-          std::sscanf(reply.c_str(), "+CMS ERROR: %d", &code);
-          throw std::runtime_error(String::str(DTR("SMS transmission failed with error code %d"), code));
+          setReadMode(HayesModem::READ_MODE_RAW);
+          sendAT(String::str("+UDWNFILE=\"%s\",%u", name.c_str(), (unsigned)data.size()));
+          //! Wait for the input prompt.
+          while (bfr != '>')
+            readRaw(timer, &bfr, 1);
+          setReadMode(HayesModem::READ_MODE_LINE);
         }
-        else
+        catch (...)
         {
-          throw UnexpectedReply();
+          setReadMode(HayesModem::READ_MODE_LINE);
+          throw;
         }
 
+        sendRaw((uint8_t*)data.data(), data.size());
+        expectOK();
+      }
+
+      //! @param[in] name file name.
+      //! @return size of a file in the modem file system, zero if it
+      //! does not exist.
+      std::size_t
+      getModemFileSize(const std::string& name)
+      {
+        //! +ULSTFILE: <size>
+        sendAT(String::str("+ULSTFILE=2,\"%s\"", name.c_str()));
+        std::string line = readLine();
+        int size = 0;
+        if (!Response(line, "+ULSTFILE:").getInt(0, size))
+          return 0;
+
         expectOK();
+        return size;
       }
 
       void
-      checkMessages(void)
+      deleteModemFile(const std::string& name)
       {
-        IMC::TextMessage sms;
-        std::string location;
-        unsigned read_count = 0;
-        bool text_mode = true;
-        sendAT("+CMGL=\"ALL\"");
+        sendAT(String::str("+UDELFILE=\"%s\"", name.c_str()));
+        //! Fails if the file does not exist.
+        readLine();
+      }
 
-        //! Read all messages.
-        while (readSMS(location, sms.origin, sms.text,text_mode))
-        {
-          if ((location == "\"REC UNREAD\"") || (location == "\"REC READ\""))
-          {
-            ++read_count;
-            if(text_mode)
-            {
-              m_task->inf("Recieved sms from %s , Message %s " , sms.origin.c_str() , sms.text.c_str() );
-              m_task->dispatch(sms);
-            }
-          }
-        }
-        //! Remove read messages.
-        if (read_count > 0)
-        {
-          sendAT("+CMGD=0,3");
-          expectOK();
-        }
+      //! Post a file in the modem file system to an HTTP server. The
+      //! result is reported by +UUHTTPCR.
+      //! @param[in] server server address.
+      //! @param[in] port server port.
+      //! @param[in] path server path.
+      //! @param[in] name file name.
+      void
+      postFile(const std::string& server, unsigned port, const std::string& path, const std::string& name)
+      {
+        sendAT(String::str("+UHTTP=%d", c_http_profile));
+        expectOK();
+        sendAT(String::str("+UHTTP=%d,1,\"%s\"", c_http_profile, server.c_str()));
+        expectOK();
+        sendAT(String::str("+UHTTP=%d,5,%u", c_http_profile, port));
+        expectOK();
+        sendAT(String::str("+UHTTPC=%d,%d,\"%s\",\"%s\",\"%s\",%d", c_http_profile, c_http_post_file,
+                           path.c_str(), c_http_reply_file, name.c_str(), c_http_octet_stream));
+        expectOK();
       }
 
-      bool
-      readSMS(std::string& location, std::string& origin, std::string& text, bool& text_mode)
+      //! Set a failed request aside to be retried with exponential
+      //! backoff, other requests are sent meanwhile.
+      //! @param[in] sms_req failed request.
+      //! @param[in] error failure description.
+      void
+      retrySMS(SmsRequest& sms_req, const std::string& error)
       {
-        std::string header = readLine();
-        if (header == "OK")
-          return false;
+        double delay = std::min(c_sms_retry_delay * (1 << std::min<unsigned>(sms_req.retries, 16)),
+                                c_sms_retry_max_delay);
+        if (sms_req.retries < 255)
+          ++sms_req.retries;
+        sms_req.retry_time = Time::Clock::getSinceEpoch() + delay;
+        m_queue->push(sms_req);
+        //! Transient failures often come with a degrading link.
+        m_ntwk_period.shorten();
+
+        std::string info = String::str(DTR("%s, retry %u in %.0f s"), error.c_str(), sms_req.retries, delay);
+        sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_ERROR,info);
+        m_task->inf(DTR("Error sending SMS to recipient %s: %s"),sms_req.destination.c_str(), info.c_str());
+      }
 
-        if (!String::startsWith(header, "+CMGL:"))
-          throw Hardware::UnexpectedReply();
+      //! @param[in] sms_req request.
+      //! @param[in] info status description.
+      //! @return status description with the number of retries.
+      std::string
+      getRetryInfo(const SmsRequest& sms_req, const std::string& info)
+      {
+        if (sms_req.retries == 0)
+          return info;
 
-        std::vector<std::string> parts;
-        String::split(header, ",", parts);
-        if (parts.size() != 6)
-        {
-          if (parts.size() >= 2)
-          {
-            location = parts[1];
-            return true;
-          }
+        std::string retries = String::str(DTR("%u retries"), sms_req.retries);
+        return info.empty() ? retries : info + ", " + retries;
+      }
 
-          throw Hardware::UnexpectedReply();
+      //! Start a burst of pings to the next target.
+      void
+      startPing(void)
+      {
+        std::string target;
+        unsigned count = 0;
+        unsigned size = 0;
+        unsigned timeout = 0;
+        {
+          Concurrency::ScopedMutex l(m_latency_lock);
+          if (m_ping_targets.empty())
+            return;
+
+          m_ping_target %= m_ping_targets.size();
+          target = m_ping_targets[m_ping_target++];
+          count = m_ping_count;
+          size = m_ping_size;
+          timeout = m_ping_tout;
         }
 
-        if ((parts[2] != "\"\"") && (parts[2].size() <= 2))
-          throw Hardware::UnexpectedReply();
+        sendAT(String::str("+UPING=\"%s\",%u,%u,%u,255", target.c_str(), count, size, timeout));
+        expectOK();
+        m_ping_deadline = Time::Clock::get() + count * (timeout / 1000.0) + getTimeout();
+        m_ping_pending = count;
+        m_ping_replies = 0;
+      }
 
-        location = parts[1];
-        origin = std::string(parts[2], 1, parts[2].size() - 2);
-        std::string incoming_data = readLine();
+      void
+      handlePingReply(int rtt)
+      {
+        if (m_ping_pending == 0)
+          return;
 
-        if(Algorithms::Base64::validBase64(incoming_data))
         {
-          text_mode = false;
-          Utils::ByteBuffer bfr;
-          std::string decoded = Algorithms::Base64::decode(incoming_data);
-          std::copy(decoded.begin(),decoded.end(),bfr.getBuffer());
-          uint16_t length = decoded.size();
-          try
-          {
-            IMC::Message* msg_d = IMC::Packet::deserialize(bfr.getBuffer(), length);
-            m_task->inf(DTR("received IMC message of type %s via SMS"),msg_d->getName());
-            m_task->dispatch(msg_d);
-          }
-          catch(...) //InvalidSync || InvalidMessageId || InvalidCrc
-          {
-            m_task->war(DTR("Parsing unrecognized Base64 message as text"));
-            text.assign(incoming_data);
-            text_mode = true;
-            return true;
-          }
+          Concurrency::ScopedMutex l(m_latency_lock);
+          if (rtt >= 0)
+            m_latency.addReply(rtt);
+          else
+            m_latency.addLoss();
         }
-        else
+
+        if (rtt >= 0)
         {
-          text.assign(incoming_data);
-          text_mode = true;
+          ++m_ping_replies;
+          m_task->debug("Ping Value %d " , rtt);
         }
-        return true;
+
+        if (--m_ping_pending == 0)
+          finishPing();
       }
 
+      //! The modem may still be running the rest of the burst, so an
+      //! error counts as a single lost packet; the burst ends with its
+      //! last answer or its deadline.
       void
-      setMessageFormat(unsigned value)
+      handlePingError(int code)
       {
-        sendAT(String::str("+CMGF=%u", value));
-        expectOK();
+        m_task->err("Ping Error %d", code);
+        //! PSD not setup
+        if (code == c_ping_no_psd)
+          m_psd_setup = true;
+
+        handlePingReply(-1);
+      }
+
+      //! Count packets of a burst that never got an answer as lost.
+      void
+      checkPingTimeout(void)
+      {
+        if (m_ping_pending > 0 && Time::Clock::get() > m_ping_deadline)
+          abortPing();
       }
 
       void
-      processSMSQueue(void)
+      abortPing(void)
       {
-        if (m_queue.empty())
         {
-          return;
+          Concurrency::ScopedMutex l(m_latency_lock);
+          for (; m_ping_pending > 0; --m_ping_pending)
+            m_latency.addLoss();
         }
 
-        SmsRequest sms_req = m_queue.top();
-        m_queue.pop();
+        finishPing();
+      }
+
+      //! Ping Can fail when the connection is bad, after too many bursts
+      //! without replies check connection status again.
+      void
+      finishPing(void)
+      {
+        m_ping_pending = 0;
 
-        // Message is too old, discard it.
-        if (Time::Clock::getSinceEpoch() >= sms_req.deadline)
+        if (m_ping_replies > 0 || m_psd_setup)
         {
-          sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_INPUT_FAILURE,DTR("SMS timeout"));
-          m_task->war(DTR("discarded expired SMS to recipient %s"), sms_req.destination.c_str());
+          m_ping_errors = 0;
           return;
         }
 
-        try
+        if (++m_ping_errors > c_ping_max_errors)
         {
-          sendSMS(sms_req.destination, sms_req.sms_text, m_sms_tout);
-          //SMS successfully sent, otherwise driver throws error
-          sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_SENT);
+          m_ping_errors = 0;
+          if (m_modem_state == NETWORK_CONNECTION_OK)
+            m_modem_state = INITIAL_STATE;
         }
-        catch (...)
+      }
+
+      //! Read SIM, registration, access technology and PDP context
+      //! state with a single command line.
+      //! @return highest state whose preconditions hold.
+      uint8_t
+      probeStatus(void)
+      {
+        queryStatus(QUERY_SIM | QUERY_REG | QUERY_RAT | QUERY_PDP);
+
+        uint8_t state = INITIAL_STATE;
+        uint8_t pdp = 0, pdp_state = 0;
+        int reg = -1;
+        int rat = -1;
+        if (checkSIMStatus() == 1)
         {
-          m_queue.push(sms_req);
-          sendSmsStatus(&sms_req,IMC::SmsStatus::SMSSTAT_ERROR,
-                        DTR("Error sending message over GSM modem"));
-          m_task->inf(DTR("Error sending SMS to recipient %s"),sms_req.destination.c_str());
+          state = SIM_CARD_READY;
+          reg = checkNetworkRegistration();
+          if (reg == 1 || reg == 5)
+          {
+            state = NETWORK_REGISTRATION_DONE;
+            //! A connected modem only polls the PDP context, so the
+            //! probe is where LinkStatus gets the access technology and
+            //! operator from.
+            rat = getRATType();
+            if (checkPDPContext(&pdp, &pdp_state))
+            {
+              //! Map the PSD profile to the active context.
+              m_psd_setup = true;
+              state = NETWORK_CONNECTION_OK;
+            }
+          }
         }
+
+        m_task->inf("status probe: state %u, registration %d, access technology %d", state, reg, rat);
+        return state;
       }
 
-      int
-      pingRemote(std::string remote)
+      //! @param[in] watchdog watchdog period elapsed.
+      //! @return status queries needed by the current state and the
+      //! ones it may chain into.
+      unsigned
+      getStateQueries(bool watchdog)
       {
-        int round_trip_time = -1;
-        sendAT("+UPING=\""+remote+"\",1,32,5000,255");
-        std::string line = readLine();
-        if (line == "OK")
+        switch (m_modem_state)
         {
-          line = readLine();
-          //+UUPING: 1,32,\"www.google.com\","172.217.23.100",53,260
-          if (line.find("+UUPING:") != std::string::npos)
+          case INITIAL_STATE:
+            return QUERY_SIM | QUERY_REG | QUERY_RAT | QUERY_PDP;
+          case SIM_CARD_READY:
+            return QUERY_REG | QUERY_RAT | QUERY_PDP;
+          case NETWORK_REGISTRATION_DONE:
+            return QUERY_RAT | QUERY_PDP;
+          case PDP_CONTEXT_ATTACHED:
+            return QUERY_PDP;
+          default:
+            return (m_event_tracking && !watchdog) ? 0 : QUERY_PDP;
+        }
+      }
+
+      //! Run status queries not answered yet as one command line and
+      //! keep the answers for this update. Queries without an answer,
+      //! because the line was rejected or stopped at a failing command,
+      //! are run on their own when needed.
+      //! @param[in] queries StatusQuery flags.
+      void
+      queryStatus(unsigned queries)
+      {
+        queries &= ~m_status.answered;
+        //! A single query gains nothing from chaining.
+        if (!m_chaining || (queries & (queries - 1)) == 0)
+          return;
+
+        if (queries & QUERY_PDP)
+          m_status.pdp = false;
+
+        std::string chain;
+        if (queries & QUERY_SIM)
+          chain += ";+CPIN?";
+        if (queries & QUERY_REG)
+          chain += ";+CREG?";
+        if (queries & QUERY_RAT)
+          chain += ";+COPS?";
+        if (queries & QUERY_PDP)
+          chain += ";+CGACT?";
+        if (queries & QUERY_CSQ)
+          chain += ";+CSQ";
+
+        sendAT(chain.substr(1));
+
+        unsigned answered = 0;
+        int cid = -1, status = -1;
+        while (true)
+        {
+          std::string line = readLine();
+          if (line == "OK")
+          {
+            //! Commands without information response lines.
+            answered |= queries & QUERY_PDP;
+            m_chain_errors = 0;
+            break;
+          }
+
+          if (line == "ERROR")
+          {
+            //! Syntax error, the modem may not support chaining.
+            if (++m_chain_errors >= c_chain_max_errors)
+            {
+              m_task->war(DTR("disabling chained commands"));
+              m_chaining = false;
+            }
+            break;
+          }
+
+          if (String::startsWith(line, "+CME ERROR:"))
+            break;
+
+          Response cpin(line, "+CPIN:");
+          Response creg(line, "+CREG:");
+          Response cops(line, "+COPS:");
+          Response cgact(line, "+CGACT:");
+          Response csq(line, "+CSQ:");
+          if (cpin.valid())
+          {
+            m_status.sim = -1;
+            if (cpin.size() > 0 && cpin[0].equals("READY"))
+              m_status.sim = 1;
+            else if (cpin.size() > 0 && cpin[0].equals("SIM PIN"))
+              m_status.sim = -2;
+            answered |= QUERY_SIM;
+          }
+          else if (creg.valid())
+          {
+            m_status.reg = -1;
+            creg.getInt(1, m_status.reg);
+            updateRegistration(creg, 1);
+            answered |= QUERY_REG;
+          }
+          else if (cops.valid())
           {
-            std::vector<std::string> tokens;
-            String::split(line, ",", tokens);
-            if (tokens.size() > 4)
+            m_status.rat = -1;
+            cops.getInt(3, m_status.rat);
+            updateOperator(cops);
+            answered |= QUERY_RAT;
+          }
+          else if (cgact.valid())
+          {
+            if (!m_status.pdp && cgact.getInt(0, cid) && cgact.getInt(1, status) && status > 0)
             {
-              m_task->inf("Ping Value %s " , tokens[5].c_str());
-              std::istringstream iss (tokens[5]);
-              iss >> round_trip_time;
+              m_status.pdp = true;
+              m_status.pdp_cid = cid;
+              m_status.pdp_state = status;
             }
+            answered |= QUERY_PDP;
           }
-          else if (line.find("+UUPINGER: 17") != std::string::npos)
+          else if (csq.valid())
           {
-            //! PSD not setup
-            m_task->err("Ping Error");
-            return -2;
+            m_status.csq = -1;
+            csq.getInt(0, m_status.csq);
+            answered |= QUERY_CSQ;
           }
         }
-        return round_trip_time;
+
+        m_status.answered |= answered;
+      }
+
+      //! @return APN of the first PDP context definition.
+      std::string
+      getAPN(void)
+      {
+        std::string apn;
+        sendAT("+CGDCONT?");
+        //! +CGDCONT: 1,"IP","apn",...
+        while (true)
+        {
+          std::string line = readLine();
+          if (line == "OK")
+            break;
+
+          Response cgdcont(line, "+CGDCONT:");
+          int cid = -1;
+          if (apn.empty() && cgdcont.getInt(0, cid) && cid == 1)
+            cgdcont.getString(2, apn);
+        }
+        return apn;
       }
 
       void
       activatePDPContext()
       {
+        m_status.answered &= ~QUERY_PDP;
         sendAT("+CGACT=1,1");
         expectOK();
       }
@@ -523,35 +2464,33 @@ namespace Transports
       bool
       checkPDPContext(uint8_t* pdp_context , uint8_t* pdp_state)
       {
-        uint8_t ok = 0;
-        std::vector<std::string> arr;
+        if (m_status.answered & QUERY_PDP)
+        {
+          *pdp_context = m_status.pdp_cid;
+          *pdp_state = m_status.pdp_state;
+          return m_status.pdp;
+        }
+
+        bool active = false;
         sendAT("+CGACT?");
         //! +CGACT: 1,1
-        while (!ok)
+        while (true)
         {
           std::string line = readLine();
           if (line == "OK")
-          {
-            ok = 1;
-          }
-          else
-          {
-            arr.push_back(line);
-          }
-        }
+            break;
 
-        for (uint8_t i = 0 ; i < arr.size() ; i++)
-        {
+          Response cgact(line, "+CGACT:");
           int status = -1 , cid = -1;
-          if ((std::sscanf(arr[i].c_str(), "+CGACT: %d,%d", &cid, &status) == 2 ) && status > 0)
+          if (!active && cgact.getInt(0, cid) && cgact.getInt(1, status) && status > 0)
           {
             *pdp_context = cid;
             *pdp_state = status;
             //! Atleast one PDP context is active
-            return true;
+            active = true;
           }
         }
-        return false;
+        return active;
       }
 
       void
@@ -563,9 +2502,20 @@ namespace Transports
         {
           flushInput();
           //! Map PSD profile to which ever CGACT is active
-          std::stringstream at_command;
-          at_command << "+UPSD=0,100," << (unsigned int)pdp;
-          sendAT(at_command.str());
+          std::string profile = String::str("+UPSD=0,100,%u", (unsigned int)pdp);
+          if (m_chaining)
+          {
+            //! Map, set PDP Type IPv4 and activate in one command line.
+            sendAT(profile + ";+UPSD=0,0,0;+UPSDA=0,3");
+            line = readLine();
+            if (line == "OK")
+              line = readLine();
+
+            if (line != "ERROR")
+              return;
+          }
+
+          sendAT(profile);
           line = readLine();
           //! Set PDP Type IPv4
           sendAT("+UPSD=0,0,0");
@@ -603,6 +2553,9 @@ namespace Transports
       int
       checkSIMStatus()
       {
+        if (m_status.answered & QUERY_SIM)
+          return m_status.sim;
+
         std::string bfr = readValue("+CPIN?");
         if (bfr == "+CPIN: READY")
         {
@@ -618,14 +2571,16 @@ namespace Transports
       int
       getRATType()
       {
-        int number;
+        if (m_status.answered & QUERY_RAT)
+          return m_status.rat;
+
+        int number = -1;
+        //! +COPS: <mode>[,<format>,<oper>[,<AcT>]]
         std::string line = readValue("+COPS?");
-        if (line.find("+COPS") != std::string::npos)
+        Response cops(line, "+COPS:");
+        updateOperator(cops);
+        if (cops.getInt(3, number))
         {
-          std::vector<std::string> tokens;
-          String::split(line, ",", tokens);
-          std::istringstream iss (tokens[3]);
-          iss >> number;
           return number;
         }
         return -1;
@@ -634,15 +2589,65 @@ namespace Transports
       int
       checkNetworkRegistration()
       {
-        int n = -1 , stat = -1;
+        if (m_status.answered & QUERY_REG)
+          return m_status.reg;
+
+        int stat = -1;
         std::string line = readValue("+CREG?");
-        if (std::sscanf(line.c_str(), "+CREG: %d,%d", &n, &stat) == 2)
+        Response creg(line, "+CREG:");
+        updateRegistration(creg, 1);
+        if (creg.getInt(1, stat))
         {
           return stat;
         }
         return -1;
       }
 
+      //! Update the link picture from a registration status.
+      //! @param[in] creg +CREG reply or URC.
+      //! @param[in] first index of <stat>, followed by <lac> and <ci>.
+      void
+      updateRegistration(const Response& creg, unsigned first)
+      {
+        Concurrency::ScopedMutex l(m_link_lock);
+        m_link.reg = -1;
+        creg.getInt(first, m_link.reg);
+        if (m_link.reg != 1 && m_link.reg != 5)
+        {
+          m_link.lac.clear();
+          m_link.cell.clear();
+        }
+        else if (creg.size() > first + 2)
+        {
+          creg.getString(first + 1, m_link.lac);
+          creg.getString(first + 2, m_link.cell);
+        }
+      }
+
+      //! Update the link picture from the selected operator.
+      //! @param[in] cops +COPS reply.
+      void
+      updateOperator(const Response& cops)
+      {
+        Concurrency::ScopedMutex l(m_link_lock);
+        m_link.rat = -1;
+        cops.getInt(3, m_link.rat);
+        m_link.oper.clear();
+        cops.getString(2, m_link.oper);
+      }
+
+      //! Update the link picture from the connection state.
+      void
+      updateLinkStatus(void)
+      {
+        Concurrency::ScopedMutex l(m_link_lock);
+        m_link.state = m_modem_state;
+        m_link.pdp = m_modem_state >= PDP_CONTEXT_ATTACHED;
+        m_link.rssi = m_modem_state >= NETWORK_REGISTRATION_DONE ? m_rssi : -1;
+        m_polling_rssi = m_event_tracking ? 0 : m_rssi_period.getPeriod();
+        m_polling_ntwk = m_ntwk_period.getPeriod();
+      }
+
       void
       setAPN(const std::string apn)
       {
@@ -684,10 +2689,12 @@ namespace Transports
       double
       getRSSI()
       {
+        if (m_status.answered & QUERY_CSQ)
+          return m_status.csq < 0 ? -1 : convertRSSI(m_status.csq);
+
         int rssi = -1;
-        int ber = 0;
         std::string line = readValue("+CSQ");
-        if (std::sscanf(line.c_str(), "+CSQ: %d,%d", &rssi, &ber) == 2)
+        if (Response(line, "+CSQ:").getInt(0, rssi))
         {
           return convertRSSI(rssi);
         }
@@ -0,0 +1,211 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_UPLOADS_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_UPLOADS_INCLUDED
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <string>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! Maximum length of a file name in the modem file system.
+    static const std::size_t c_upload_max_name = 47;
+    //! Failed attempts before an upload is given up.
+    static const unsigned c_upload_max_retries = 5;
+    //! Delay before retrying a failed upload, doubled on each failure (s).
+    static const double c_upload_retry_delay = 30.0;
+    //! Maximum delay before retrying a failed upload (s).
+    static const double c_upload_retry_max_delay = 1800.0;
+
+    //! File to upload through the modem file system and HTTP client.
+    struct UploadJob
+    {
+      // Local file.
+      std::string path;
+      // File name in the modem file system and on the server.
+      std::string name;
+      // Local file size.
+      std::size_t size = 0;
+      // Bytes already stored in the modem file system.
+      std::size_t offset = 0;
+      // A write was interrupted, the stored size must be read back.
+      bool resync = false;
+      // File was handed to the HTTP client.
+      bool posting = false;
+      // Time the upload started.
+      double start = 0;
+      // Failed attempts.
+      unsigned retries = 0;
+      // Do not start before this time.
+      double retry_time = 0;
+    };
+
+    //! Uploads waiting and in progress. Owned by the task so that they
+    //! survive modem restarts, filled by the task thread and run by the
+    //! modem command engine.
+    class Uploads
+    {
+    public:
+      //! Progress of the upload in progress.
+      struct Progress
+      {
+        // File name, empty if idle.
+        std::string name;
+        // Fraction of the file stored in the modem or sent.
+        double progress;
+        // Average rate of transfer to the modem (bytes/s).
+        double rate;
+        // Uploads waiting.
+        unsigned queued;
+        // Uploads given up after too many failures.
+        unsigned failed;
+      };
+
+      Uploads(void):
+        m_failed(0)
+      { }
+
+      //! Queue a local file.
+      //! @param[in] path local file.
+      //! @param[in] name name on the server.
+      //! @return false if the file cannot be read.
+      bool
+      push(const std::string& path, const std::string& name)
+      {
+        std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+        if (!file)
+          return false;
+
+        UploadJob job;
+        job.path = path;
+        job.size = file.tellg();
+        //! The modem file system has short flat names.
+        job.name = name.substr(0, c_upload_max_name);
+        for (std::size_t i = 0; i < job.name.size(); ++i)
+        {
+          if (job.name[i] == '/' || job.name[i] == '"')
+            job.name[i] = '_';
+        }
+
+        Concurrency::ScopedMutex l(m_lock);
+        m_jobs.push_back(job);
+        return true;
+      }
+
+      //! Get the upload in progress, starting the next one due if idle.
+      //! @return upload or NULL if there is none due. Only the engine
+      //! thread may change it.
+      UploadJob*
+      current(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        if (m_jobs.empty())
+          return NULL;
+
+        double now = Clock::get();
+        if (m_jobs.front().start == 0)
+        {
+          //! Failed uploads wait for their retry time.
+          std::deque<UploadJob>::iterator itr = m_jobs.begin();
+          while (itr != m_jobs.end() && itr->retry_time > now)
+            ++itr;
+
+          if (itr == m_jobs.end())
+            return NULL;
+
+          if (itr != m_jobs.begin())
+          {
+            UploadJob job = *itr;
+            m_jobs.erase(itr);
+            m_jobs.push_front(job);
+          }
+
+          m_jobs.front().start = now;
+        }
+
+        return &m_jobs.front();
+      }
+
+      //! Finish the upload in progress.
+      void
+      pop(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        if (!m_jobs.empty())
+          m_jobs.pop_front();
+      }
+
+      //! Move the failed upload in progress to the end of the queue, to
+      //! start over after a backoff delay, or give it up after
+      //! c_upload_max_retries attempts.
+      //! @return false if the upload was given up.
+      bool
+      requeue(void)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        if (m_jobs.empty())
+          return false;
+
+        UploadJob job = m_jobs.front();
+        m_jobs.pop_front();
+        if (++job.retries >= c_upload_max_retries)
+        {
+          ++m_failed;
+          return false;
+        }
+
+        double delay = c_upload_retry_delay * (1 << (job.retries - 1));
+        job.posting = false;
+        job.start = 0;
+        job.retry_time = Clock::get() + std::min(delay, c_upload_retry_max_delay);
+        m_jobs.push_back(job);
+        return true;
+      }
+
+      //! Store the number of bytes written to the modem.
+      //! @param[in] offset bytes stored in the modem file system.
+      void
+      setOffset(std::size_t offset)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        if (!m_jobs.empty())
+          m_jobs.front().offset = offset;
+      }
+
+      void
+      getProgress(Progress& progress)
+      {
+        Concurrency::ScopedMutex l(m_lock);
+        progress.queued = m_jobs.size();
+        progress.failed = m_failed;
+        progress.name.clear();
+        progress.progress = 0;
+        progress.rate = 0;
+        if (m_jobs.empty() || m_jobs.front().start == 0)
+          return;
+
+        const UploadJob& job = m_jobs.front();
+        double elapsed = Clock::get() - job.start;
+        progress.name = job.name;
+        progress.progress = job.size ? (double)job.offset / job.size : 1.0;
+        progress.rate = elapsed > 0 ? job.offset / elapsed : 0;
+      }
+
+    private:
+      //! Uploads, the first one in progress.
+      std::deque<UploadJob> m_jobs;
+      //! Uploads given up.
+      unsigned m_failed;
+      //! Lock for uploads.
+      Concurrency::Mutex m_lock;
+    };
+  }
+}
+#endif
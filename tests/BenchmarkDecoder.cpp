@@ -0,0 +1,139 @@
+//***************************************************************************
+// Microbenchmark of PacketDecoder on an 8 KB bundle of IMC packets,
+// against the decoding it replaced: Base64::decode or String::fromHex
+// into a new string, then one allocated message per packet.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o benchmark-decoder
+//       $TASK/tests/BenchmarkDecoder.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   benchmark-decoder [iterations]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "../PacketDecoder.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Build a bundle of temperatures as close to the size limit as they
+  //! fit.
+  std::string
+  createBundle(unsigned& count)
+  {
+    IMC::Temperature temperature;
+    temperature.setTimeStamp(1.0);
+    std::string packet(temperature.getSerializationSize(), '\0');
+    count = c_bundle_max_size / packet.size();
+
+    std::string bundle;
+    for (unsigned i = 0; i < count; ++i)
+    {
+      temperature.value = i;
+      IMC::Packet::serialize(&temperature, (uint8_t*)&packet[0], packet.size());
+      bundle += packet;
+    }
+    return bundle;
+  }
+
+  //! Baseline: deserialize every packet of a bundle into a new message.
+  unsigned
+  deserializeAll(const std::string& bundle, long& checksum)
+  {
+    unsigned count = 0;
+    std::size_t offset = 0;
+    while (offset + c_imc_header_size + c_imc_footer_size <= bundle.size())
+    {
+      const uint8_t* ptr = (const uint8_t*)bundle.data() + offset;
+      std::size_t length = c_imc_header_size + (ptr[c_imc_size_offset] | (ptr[c_imc_size_offset + 1] << 8)) +
+                           c_imc_footer_size;
+      IMC::Message* msg = IMC::Packet::deserialize(ptr, length);
+      checksum += msg->getId();
+      delete msg;
+      offset += length;
+      ++count;
+    }
+    return count;
+  }
+
+  //! Read every packet loaded in the decoder.
+  unsigned
+  nextAll(PacketDecoder& decoder, long& checksum)
+  {
+    unsigned count = 0;
+    while (const IMC::Message* msg = decoder.next())
+    {
+      checksum += msg->getId();
+      ++count;
+    }
+    return count;
+  }
+
+  //! Time a decoding function.
+  //! @return nanoseconds per iteration.
+  template <typename Function>
+  double
+  run(Function function, unsigned iterations)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i)
+      function();
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned iterations = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 2000;
+  unsigned count = 0;
+  std::string bundle = createBundle(count);
+  std::string base64 = Algorithms::Base64::encode(bundle);
+  std::string hex = String::toHex(bundle);
+
+  PacketDecoder decoder;
+  long base_sum = 0;
+  long decoder_sum = 0;
+
+  double base64_old = run([&]() { base_sum += Algorithms::Base64::decode(base64).size(); }, iterations);
+  double base64_new = run([&]() { decoder_sum += decoder.decodeBase64(base64) ? bundle.size() : 0; }, iterations);
+  double hex_old = run([&]() { base_sum += String::fromHex(hex).size(); }, iterations);
+  double hex_new = run([&]() { decoder_sum += decoder.decodeHex(hex) ? bundle.size() : 0; }, iterations);
+  double next_old = run([&]() { deserializeAll(bundle, base_sum); }, iterations);
+  double next_new = run([&]()
+                        {
+                          decoder.assign((const uint8_t*)bundle.data(), bundle.size());
+                          nextAll(decoder, decoder_sum);
+                        }, iterations);
+
+  std::printf("%u packets, %u bytes\n", count, (unsigned)bundle.size());
+  std::printf("Base64::decode      %8.2f ns/byte\n", base64_old / base64.size());
+  std::printf("decodeBase64        %8.2f ns/byte  %6.2fx\n", base64_new / base64.size(), base64_old / base64_new);
+  std::printf("String::fromHex     %8.2f ns/byte\n", hex_old / hex.size());
+  std::printf("decodeHex           %8.2f ns/byte  %6.2fx\n", hex_new / hex.size(), hex_old / hex_new);
+  std::printf("deserialize         %8.1f ns/packet\n", next_old / count);
+  std::printf("next                %8.1f ns/packet  %6.2fx\n", next_new / count, next_old / next_new);
+
+  //! Both paths must have decoded the same bundles and messages.
+  if (base_sum != decoder_sum)
+  {
+    std::fprintf(stderr, "decoders disagree\n");
+    return 1;
+  }
+
+  return 0;
+}
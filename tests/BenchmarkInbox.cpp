@@ -0,0 +1,133 @@
+//***************************************************************************
+// Cost of an SMS storage poll against the AT simulator, with new message
+// indications disabled, for an empty, a half full and a full storage of
+// 255 locations: commands sent and time per poll. Checks that every
+// message is read and deleted and that the scan stops at the last stored
+// message rather than at the end of the storage. The exit status is
+// non-zero if any check fails.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o benchmark-inbox
+//       $TASK/tests/BenchmarkInbox.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   benchmark-inbox [script]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "TestHarness.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Time to wait for each step (s).
+  const double c_step_timeout = 60.0;
+  //! SMS storage locations.
+  const int c_storage = 255;
+  //! Messages stored before each poll.
+  const unsigned c_counts[] = {0, 50, 255};
+
+  //! @return index of the first storage poll logged from an index.
+  std::size_t
+  findPoll(const std::vector<ModemSimulator::Command>& log, std::size_t from)
+  {
+    for (; from < log.size(); ++from)
+    {
+      if (log[from].text == "+CPMS?")
+        break;
+    }
+    return from;
+  }
+
+  //! Wait for the next storage poll from a log index.
+  //! @return index of the poll in the log.
+  std::size_t
+  waitPoll(ModemSimulator& sim, Harness& h, std::size_t from)
+  {
+    std::size_t poll = 0;
+    h.waitFor([&]() { return (poll = findPoll(sim.getLog(), from)) < sim.getLog().size(); }, c_step_timeout);
+    return poll;
+  }
+
+  //! Store messages after a poll and measure the next poll.
+  //! @param[in] count messages stored.
+  //! @param[in] latency simulator reply delay (s).
+  void
+  benchmark(ModemSimulator& sim, Harness& h, unsigned count, double latency)
+  {
+    //! An empty poll is over as soon as it is logged.
+    std::size_t mark = waitPoll(sim, h, sim.getLog().size());
+    for (unsigned i = 0; i < count; ++i)
+      sim.receiveSMS("+351910000001", String::str("inbox benchmark %u", i));
+
+    std::size_t first = waitPoll(sim, h, mark + 1);
+    std::size_t last = waitPoll(sim, h, first + 1);
+    std::vector<ModemSimulator::Command> log = sim.getLog();
+
+    unsigned commands = 0;
+    int max_index = 0;
+    double end = log[first].time;
+    for (std::size_t i = first; i < last; ++i)
+    {
+      const std::string& text = log[i].text;
+      if (text != "+CPMS?" && text.compare(0, 6, "+CMGR=") != 0 && text.compare(0, 6, "+CMGD=") != 0)
+        continue;
+
+      ++commands;
+      end = log[i].time;
+      if (text.compare(0, 6, "+CMGR=") == 0)
+        max_index = std::max(max_index, std::atoi(text.c_str() + 6));
+    }
+
+    std::printf("%3u stored  %4u commands  %8.1f ms/poll\n", count, commands,
+                (end - log[first].time + latency) * 1000.0);
+    check(sim.getStored() == 0 && h.texts.size() >= count, String::str("%u messages read", count).c_str());
+    check(max_index == (int)count, String::str("scan stopped at index %u", count).c_str());
+    h.texts.clear();
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  SimulatorConfig config;
+  config.storage = c_storage;
+
+  try
+  {
+    if (argc > 1)
+      ModemSimulator::load(argv[1], config);
+
+    ModemSimulator sim(config);
+    Tasks::Context ctx;
+    TestTask task(ctx);
+    Harness h;
+
+    h.open(&task, sim.getDevice());
+    check(h.waitConnected(c_step_timeout), "bring-up");
+    //! Polls then go through the whole storage scan.
+    h.driver->setMessageIndications(false);
+    if (getFailures() == 0)
+    {
+      for (unsigned i = 0; i < sizeof(c_counts) / sizeof(c_counts[0]); ++i)
+        benchmark(sim, h, c_counts[i], config.latency);
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return getFailures() == 0 ? 0 : 1;
+}
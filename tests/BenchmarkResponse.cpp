@@ -0,0 +1,135 @@
+//***************************************************************************
+// Microbenchmark of the response line parser against the split and
+// sscanf parsing it replaced, on the lines the driver parses most.
+//
+// Build:
+//   g++ -std=c++11 -O2 -o benchmark-response BenchmarkResponse.cpp
+//
+// Usage:
+//   benchmark-response [iterations]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Local headers.
+#include "../Response.hpp"
+
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Response line and the fields read from it.
+  struct Sample
+  {
+    const char* line;
+    const char* prefix;
+    unsigned int_field;
+    unsigned str_field;
+  };
+
+  const Sample c_samples[] =
+  {
+    {"+CREG: 2,1,\"1A2B\",\"01C3D4E5\",7", "+CREG:", 1, 2},
+    {"+COPS: 0,0,\"Operator\",7", "+COPS:", 3, 2},
+    {"+CSQ: 20,99", "+CSQ:", 0, 1},
+    {"+UUPING: 1,32,\"www.google.com\",\"172.217.17.4\",55,48", "+UUPING:", 5, 3},
+    {"+CMGR: 0,,29", "+CMGR:", 0, 2},
+    {"+USORF: 0,\"10.0.0.1\",6002,4,\"FE540102\"", "+USORF:", 3, 4}
+  };
+
+  const unsigned c_sample_count = sizeof(c_samples) / sizeof(c_samples[0]);
+
+  //! Baseline: split on every comma into new strings, then convert
+  //! with sscanf, like the driver did before the parser.
+  bool
+  parseSplit(const std::string& line, const Sample& sample, int& value, std::string& str)
+  {
+    std::string prefix = sample.prefix;
+    if (line.compare(0, prefix.size(), prefix) != 0)
+      return false;
+
+    std::vector<std::string> fields;
+    std::string rest = line.substr(prefix.size());
+    std::size_t begin = 0;
+    while (true)
+    {
+      std::size_t end = rest.find(',', begin);
+      fields.push_back(rest.substr(begin, end - begin));
+      if (end == std::string::npos)
+        break;
+      begin = end + 1;
+    }
+
+    if (sample.int_field >= fields.size() || sample.str_field >= fields.size())
+      return false;
+
+    if (std::sscanf(fields[sample.int_field].c_str(), "%d", &value) != 1)
+      return false;
+
+    str = fields[sample.str_field];
+    if (str.size() >= 2 && str[0] == '"')
+      str = str.substr(1, str.size() - 2);
+    return true;
+  }
+
+  bool
+  parseResponse(const std::string& line, const Sample& sample, int& value, std::string& str)
+  {
+    Response r(line, sample.prefix);
+    return r.getInt(sample.int_field, value) && r.getString(sample.str_field, str);
+  }
+
+  //! Time a parser over all samples.
+  //! @return nanoseconds per line.
+  template <typename Parser>
+  double
+  run(Parser parser, const std::vector<std::string>& lines, unsigned iterations, long& checksum)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i)
+    {
+      for (unsigned j = 0; j < c_sample_count; ++j)
+      {
+        int value = 0;
+        std::string str;
+        if (parser(lines[j], c_samples[j], value, str))
+          checksum += value + str.size();
+      }
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ((double)iterations * c_sample_count);
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned iterations = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 200000;
+  std::vector<std::string> lines(c_sample_count);
+  for (unsigned i = 0; i < c_sample_count; ++i)
+    lines[i] = c_samples[i].line;
+
+  long split_sum = 0;
+  long parser_sum = 0;
+  double split = run(parseSplit, lines, iterations, split_sum);
+  double parser = run(parseResponse, lines, iterations, parser_sum);
+
+  std::printf("split + sscanf  %8.1f ns/line\n", split);
+  std::printf("Response        %8.1f ns/line\n", parser);
+  std::printf("speedup         %8.2fx\n", split / parser);
+
+  //! Both parsers must have read the same fields.
+  if (split_sum != parser_sum)
+  {
+    std::fprintf(stderr, "parsers disagree\n");
+    return 1;
+  }
+
+  return 0;
+}
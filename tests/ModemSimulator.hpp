@@ -0,0 +1,1281 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_MODEM_SIMULATOR_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_MODEM_SIMULATOR_INCLUDED
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    //! Behaviour of the simulated modem.
+    struct SimulatorConfig
+    {
+      // Delay before each reply (s).
+      double latency = 0.01;
+      // Fraction of command lines answered with ERROR, 'AT' probes excluded.
+      double error_rate = 0;
+      // Time from full functionality to network registration (s).
+      double register_delay = 1.0;
+      // SIM PIN, empty if the SIM is not locked.
+      std::string pin;
+      // Radio access technology reported by +COPS.
+      int rat = 7;
+      // Signal quality reported by +CSQ.
+      int csq = 20;
+      // Ping round trip time (ms).
+      int ping_rtt = 50;
+      // +UUPINGER code sent instead of ping replies, zero for none.
+      int ping_error = 0;
+      // Time to send each SMS (s).
+      double sms_delay = 0.5;
+      // Fraction of SMS refused with a transient +CMS ERROR.
+      double sms_error_rate = 0;
+      // Time from an HTTP request to its +UUHTTPCR result (s).
+      double http_delay = 1.0;
+      // Number of SMS storage locations.
+      int storage = 50;
+      // Stored SMS-DELIVER PDUs (hexadecimal).
+      std::vector<std::string> inbox;
+      // Periods without any answer: start after opening and duration (s).
+      std::vector<std::pair<double, double> > dropouts;
+      // Seed of the error generator, for repeatable runs.
+      unsigned seed = 1;
+    };
+
+    //! Toby L2 stand-in behind a pseudo-terminal, answering the AT
+    //! dialect used by the driver: SIM, registration, operator, PDP
+    //! context, signal quality, pings, PDU mode SMS, UDP sockets echoing
+    //! datagrams back, the file system and the HTTP client. Latency,
+    //! errors, dropouts and inbox contents are configurable. Command
+    //! lines may chain commands with ';', like the real modem.
+    class ModemSimulator
+    {
+    public:
+      //! File posted with the HTTP client.
+      struct Post
+      {
+        // Time of the request.
+        double time;
+        // Server path.
+        std::string path;
+        // File contents.
+        std::string data;
+        // Reported success.
+        bool success;
+      };
+
+      //! Command answered.
+      struct Command
+      {
+        // Time the command line was received.
+        double time;
+        // Command without 'AT'.
+        std::string text;
+      };
+
+      //! Open the pseudo-terminal and start answering.
+      //! @param[in] config modem behaviour.
+      ModemSimulator(const SimulatorConfig& config):
+        m_config(config),
+        m_start(now()),
+        m_echo(true),
+        m_cfun(1),
+        m_cfun_time(m_start),
+        m_sim_ready(config.pin.empty()),
+        m_creg(0),
+        m_events(false),
+        m_indications(false),
+        m_pdp(false),
+        m_forced_off(false),
+        m_powered(true),
+        m_registered(false),
+        m_dropout_end(0),
+        m_sms_input(false),
+        m_sms_ref(0),
+        m_next_socket(0),
+        m_udp_error(false),
+        m_file_size(0),
+        m_file_cut(-1),
+        m_file_silence(0),
+        m_http_failures(0),
+        m_commands(0),
+        m_stop(false)
+      {
+        m_master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (m_master < 0 || grantpt(m_master) != 0 || unlockpt(m_master) != 0)
+          throw std::runtime_error("failed to open pseudo-terminal");
+
+        m_device = ptsname(m_master);
+        //! Keep the slave open, so that the driver may close and open
+        //! it again without hanging up the terminal.
+        m_slave = ::open(m_device.c_str(), O_RDWR | O_NOCTTY);
+        if (m_slave < 0)
+          throw std::runtime_error("failed to open pseudo-terminal slave");
+
+        struct termios tio;
+        tcgetattr(m_slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(m_slave, TCSANOW, &tio);
+
+        std::srand(config.seed);
+        for (std::size_t i = 0; i < config.inbox.size(); ++i)
+          store(config.inbox[i]);
+
+        m_thread = std::thread(&ModemSimulator::run, this);
+      }
+
+      ~ModemSimulator(void)
+      {
+        {
+          std::lock_guard<std::mutex> l(m_lock);
+          m_stop = true;
+        }
+
+        m_thread.join();
+        ::close(m_slave);
+        ::close(m_master);
+      }
+
+      //! @return serial device to open.
+      const std::string&
+      getDevice(void) const
+      {
+        return m_device;
+      }
+
+      //! Store an incoming SMS, reported with +CMTI if indications are
+      //! enabled.
+      //! @param[in] origin originating address.
+      //! @param[in] text message, ASCII.
+      void
+      receiveSMS(const std::string& origin, const std::string& text)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        int index = store(encodeDeliver(origin, text));
+        if (m_indications)
+          m_urcs.push_back(std::make_pair(now(), format("+CMTI: \"ME\",%d", index)));
+      }
+
+      //! Lose or regain the network, reported with +CREG and +CGEV if
+      //! events are enabled.
+      //! @param[in] lost network is lost.
+      void
+      setNetworkLost(bool lost)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_forced_off = lost;
+        if (!lost)
+          m_cfun_time = now();
+      }
+
+      //! Stop answering for some time.
+      //! @param[in] duration time without answers (s).
+      void
+      dropout(double duration)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_dropout_end = now() + duration;
+      }
+
+      //! Switch the modem off or on. A modem switched on starts from its
+      //! power on state; stored files and SMS are kept.
+      //! @param[in] on power state.
+      void
+      setPower(bool on)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        if (on && !m_powered)
+        {
+          m_echo = true;
+          m_cfun = 1;
+          m_cfun_time = now();
+          m_sim_ready = m_config.pin.empty();
+          m_creg = 0;
+          m_events = false;
+          m_indications = false;
+          m_pdp = false;
+          m_registered = false;
+          m_dropout_end = 0;
+          m_sockets.clear();
+          m_urcs.clear();
+        }
+
+        m_powered = on;
+      }
+
+      //! Change the fraction of command lines answered with ERROR.
+      //! @param[in] rate fraction of command lines.
+      void
+      setErrorRate(double rate)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_config.error_rate = rate;
+      }
+
+      //! Answer datagram sends with ERROR or send them again.
+      //! @param[in] error fail datagram sends.
+      void
+      setDatagramError(bool error)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_udp_error = error;
+      }
+
+      //! @return datagrams sent so far (hexadecimal), each echoed back.
+      std::vector<std::string>
+      getDatagrams(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_datagrams;
+      }
+
+      //! @return number of open sockets.
+      unsigned
+      getSockets(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_sockets.size();
+      }
+
+      //! Interrupt file writes once a file reaches a size: drop the
+      //! rest of the write and stop answering for some time, as if the
+      //! modem was reset.
+      //! @param[in] size file size kept.
+      //! @param[in] duration time without answers (s).
+      void
+      interruptWrite(unsigned size, double duration)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_file_cut = size;
+        m_file_silence = duration;
+      }
+
+      //! Report the next HTTP requests as failed.
+      //! @param[in] count number of requests.
+      void
+      setHttpFailures(unsigned count)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_http_failures = count;
+      }
+
+      //! @param[in] name file name.
+      //! @param[out] data file contents.
+      //! @return false if the file does not exist.
+      bool
+      getFile(const std::string& name, std::string& data)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        std::map<std::string, std::string>::const_iterator itr = m_files.find(name);
+        if (itr == m_files.end())
+          return false;
+
+        data = itr->second;
+        return true;
+      }
+
+      //! @return files posted so far.
+      std::vector<Post>
+      getPosts(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_posts;
+      }
+
+      //! @return commands answered so far.
+      std::vector<Command>
+      getLog(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_log;
+      }
+
+      //! @return SMS-SUBMIT PDUs sent so far (hexadecimal).
+      std::vector<std::string>
+      getSent(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_sent;
+      }
+
+      //! @return number of SMS stored in the inbox.
+      unsigned
+      getStored(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_inbox.size();
+      }
+
+      //! @return number of command lines answered.
+      unsigned
+      getCommands(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_commands;
+      }
+
+      //! Encode an SMS-DELIVER PDU in the GSM 7 bit default alphabet.
+      //! Characters outside the basic table are replaced by '?'.
+      //! @param[in] origin originating address.
+      //! @param[in] text message, ASCII.
+      //! @return hexadecimal PDU.
+      static std::string
+      encodeDeliver(const std::string& origin, const std::string& text)
+      {
+        std::string digits = origin;
+        bool international = !digits.empty() && digits[0] == '+';
+        if (international)
+          digits.erase(0, 1);
+
+        //! No SMSC, SMS-DELIVER without more messages to send.
+        std::string pdu = "0004";
+        pdu += format("%02X%s", (unsigned)digits.size(), international ? "91" : "81");
+        for (std::size_t i = 0; i < digits.size(); i += 2)
+        {
+          pdu.push_back(i + 1 < digits.size() ? digits[i + 1] : 'F');
+          pdu.push_back(digits[i]);
+        }
+
+        //! PID, DCS and a fixed service centre time stamp.
+        pdu += "0000" "62016100000000";
+        pdu += format("%02X", (unsigned)text.size());
+
+        unsigned bits = 0;
+        unsigned count = 0;
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+          bits |= toGsm7(text[i]) << count;
+          count += 7;
+          while (count >= 8)
+          {
+            pdu += format("%02X", bits & 0xff);
+            bits >>= 8;
+            count -= 8;
+          }
+        }
+
+        if (count > 0)
+          pdu += format("%02X", bits & 0xff);
+
+        return pdu;
+      }
+
+      //! Load a simulator script. Each line holds a keyword and its
+      //! values, '#' starts a comment:
+      //!   latency <s>, errors <fraction>, register <s>, pin <pin>,
+      //!   rat <act>, csq <value>, ping <ms>, ping_error <code>,
+      //!   sms_delay <s>, sms_errors <fraction>, http_delay <s>,
+      //!   storage <locations>, seed <n>,
+      //!   dropout <start s> <duration s>, inbox <hex pdu>,
+      //!   sms <origin> <text...>
+      //! @param[in] path script file.
+      //! @param[out] config modem behaviour.
+      static void
+      load(const std::string& path, SimulatorConfig& config)
+      {
+        std::ifstream file(path.c_str());
+        if (!file)
+          throw std::runtime_error("failed to open script " + path);
+
+        std::string line;
+        unsigned number = 0;
+        while (std::getline(file, line))
+        {
+          ++number;
+          std::istringstream is(line.substr(0, line.find('#')));
+          std::string key;
+          if (!(is >> key))
+            continue;
+
+          bool ok = true;
+          if (key == "latency")
+            ok = (bool)(is >> config.latency);
+          else if (key == "errors")
+            ok = (bool)(is >> config.error_rate);
+          else if (key == "register")
+            ok = (bool)(is >> config.register_delay);
+          else if (key == "pin")
+            ok = (bool)(is >> config.pin);
+          else if (key == "rat")
+            ok = (bool)(is >> config.rat);
+          else if (key == "csq")
+            ok = (bool)(is >> config.csq);
+          else if (key == "ping")
+            ok = (bool)(is >> config.ping_rtt);
+          else if (key == "ping_error")
+            ok = (bool)(is >> config.ping_error);
+          else if (key == "sms_delay")
+            ok = (bool)(is >> config.sms_delay);
+          else if (key == "sms_errors")
+            ok = (bool)(is >> config.sms_error_rate);
+          else if (key == "http_delay")
+            ok = (bool)(is >> config.http_delay);
+          else if (key == "storage")
+            ok = (bool)(is >> config.storage);
+          else if (key == "seed")
+            ok = (bool)(is >> config.seed);
+          else if (key == "dropout")
+          {
+            std::pair<double, double> dropout;
+            ok = (bool)(is >> dropout.first >> dropout.second);
+            config.dropouts.push_back(dropout);
+          }
+          else if (key == "inbox")
+          {
+            std::string pdu;
+            ok = (bool)(is >> pdu);
+            config.inbox.push_back(pdu);
+          }
+          else if (key == "sms")
+          {
+            std::string origin;
+            std::string text;
+            ok = (bool)(is >> origin);
+            std::getline(is >> std::ws, text);
+            config.inbox.push_back(encodeDeliver(origin, text));
+          }
+          else
+          {
+            ok = false;
+          }
+
+          if (!ok)
+            throw std::runtime_error(format("%s:%u: invalid line", path.c_str(), number));
+        }
+      }
+
+    private:
+      //! Stored SMS.
+      struct Stored
+      {
+        // 0 received unread, 1 received read.
+        int stat;
+        // Hexadecimal PDU.
+        std::string pdu;
+      };
+
+      //! Modem behaviour.
+      SimulatorConfig m_config;
+      //! Pseudo-terminal master and slave.
+      int m_master;
+      int m_slave;
+      //! Slave device.
+      std::string m_device;
+      //! Time the simulator started.
+      double m_start;
+      //! Command echo.
+      bool m_echo;
+      //! Functionality level (+CFUN).
+      int m_cfun;
+      //! Time full functionality was set.
+      double m_cfun_time;
+      //! SIM unlocked.
+      bool m_sim_ready;
+      //! Registration URC mode (+CREG=<n>).
+      int m_creg;
+      //! Packet domain and indicator events enabled.
+      bool m_events;
+      //! New message indications enabled.
+      bool m_indications;
+      //! PDP context activated with +CGACT.
+      bool m_pdp;
+      //! Network lost on request.
+      bool m_forced_off;
+      //! Switched on.
+      bool m_powered;
+      //! Registration reported last.
+      bool m_registered;
+      //! End of the current dropout.
+      double m_dropout_end;
+      //! Waiting for an SMS PDU after the prompt.
+      bool m_sms_input;
+      //! Next SMS reference.
+      int m_sms_ref;
+      //! Next socket.
+      int m_next_socket;
+      //! Open sockets and the datagrams waiting to be read from each.
+      std::map<int, std::deque<std::string> > m_sockets;
+      //! Datagrams sent (hexadecimal).
+      std::vector<std::string> m_datagrams;
+      //! Fail datagram sends.
+      bool m_udp_error;
+      //! Files by name.
+      std::map<std::string, std::string> m_files;
+      //! File being written, empty if none.
+      std::string m_file_name;
+      //! Bytes left to write.
+      std::size_t m_file_size;
+      //! File size at which a write is interrupted, -1 for none.
+      int m_file_cut;
+      //! Time without answers after an interrupted write (s).
+      double m_file_silence;
+      //! HTTP requests left to fail.
+      unsigned m_http_failures;
+      //! Files posted.
+      std::vector<Post> m_posts;
+      //! Commands answered.
+      std::vector<Command> m_log;
+      //! SMS storage by index.
+      std::map<int, Stored> m_inbox;
+      //! Sent PDUs.
+      std::vector<std::string> m_sent;
+      //! Pending URCs and their due time.
+      std::vector<std::pair<double, std::string> > m_urcs;
+      //! Received bytes not yet handled.
+      std::string m_input;
+      //! Command lines answered.
+      unsigned m_commands;
+      //! APN of the first PDP context.
+      std::string m_apn;
+      //! Stop the thread.
+      bool m_stop;
+      //! Lock for modem state.
+      std::mutex m_lock;
+      //! Thread answering commands.
+      std::thread m_thread;
+
+      static double
+      now(void)
+      {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+      }
+
+      static std::string
+      format(const char* fmt, ...) __attribute__((format(printf, 1, 2)))
+      {
+        char bfr[1024];
+        va_list ap;
+        va_start(ap, fmt);
+        std::vsnprintf(bfr, sizeof(bfr), fmt, ap);
+        va_end(ap);
+        return bfr;
+      }
+
+      static unsigned
+      toGsm7(char c)
+      {
+        switch (c)
+        {
+          case '@':
+            return 0x00;
+          case '$':
+            return 0x02;
+          case '_':
+            return 0x11;
+          case '[': case '\\': case ']': case '^': case '`':
+          case '{': case '|': case '}': case '~':
+            return '?';
+          default:
+            return (c >= 0x20 && c < 0x7f) || c == '\n' || c == '\r' ? c : '?';
+        }
+      }
+
+      //! Store a PDU at the lowest free index.
+      //! @return storage index, -1 if the storage is full.
+      int
+      store(const std::string& pdu)
+      {
+        for (int index = 1; index <= m_config.storage; ++index)
+        {
+          if (m_inbox.count(index) == 0)
+          {
+            m_inbox[index].stat = 0;
+            m_inbox[index].pdu = pdu;
+            return index;
+          }
+        }
+
+        return -1;
+      }
+
+      bool
+      isRegistered(double time) const
+      {
+        return m_sim_ready && m_cfun == 1 && !m_forced_off && time - m_cfun_time >= m_config.register_delay;
+      }
+
+      bool
+      isConnected(double time) const
+      {
+        return isRegistered(time) && (m_pdp || m_config.rat == 7);
+      }
+
+      bool
+      inDropout(double time) const
+      {
+        if (time < m_dropout_end)
+          return true;
+
+        for (std::size_t i = 0; i < m_config.dropouts.size(); ++i)
+        {
+          double start = m_start + m_config.dropouts[i].first;
+          if (time >= start && time < start + m_config.dropouts[i].second)
+            return true;
+        }
+
+        return false;
+      }
+
+      void
+      write(const std::string& data)
+      {
+        std::size_t offset = 0;
+        while (offset < data.size())
+        {
+          ssize_t rv = ::write(m_master, data.data() + offset, data.size() - offset);
+          if (rv <= 0)
+            return;
+          offset += rv;
+        }
+      }
+
+      void
+      run(void)
+      {
+        while (true)
+        {
+          struct pollfd pfd;
+          pfd.fd = m_master;
+          pfd.events = POLLIN;
+          pfd.revents = 0;
+          poll(&pfd, 1, 10);
+
+          char bfr[512];
+          ssize_t rv = 0;
+          if (pfd.revents & POLLIN)
+            rv = ::read(m_master, bfr, sizeof(bfr));
+
+          std::string reply;
+          double delay = 0;
+          {
+            std::lock_guard<std::mutex> l(m_lock);
+            if (m_stop)
+              return;
+
+            double time = now();
+            //! A silent modem loses whatever it is sent.
+            if (!m_powered || inDropout(time))
+            {
+              m_input.clear();
+              m_sms_input = false;
+              m_file_name.clear();
+              continue;
+            }
+
+            if (rv > 0)
+              m_input.append(bfr, rv);
+
+            reply = processInput(time, delay);
+            reply += processEvents(time);
+          }
+
+          if (delay > 0)
+            usleep(delay * 1e6);
+
+          write(reply);
+        }
+      }
+
+      //! Handle complete command lines and SMS input.
+      std::string
+      processInput(double time, double& delay)
+      {
+        std::string reply;
+        while (true)
+        {
+          if (!m_file_name.empty())
+          {
+            if (m_input.empty())
+              break;
+
+            reply += writeFile(time, delay);
+            continue;
+          }
+
+          if (m_sms_input)
+          {
+            std::size_t end = m_input.find_first_of("\x1a\x1b");
+            if (end == std::string::npos)
+              break;
+
+            std::string pdu = m_input.substr(0, end);
+            bool send = m_input[end] == 0x1a;
+            m_input.erase(0, end + 1);
+            m_sms_input = false;
+            delay += m_config.latency;
+            if (!send)
+              reply += "\r\nOK\r\n";
+            else
+              reply += sendSMS(time, pdu, delay);
+            continue;
+          }
+
+          std::size_t end = m_input.find('\r');
+          if (end == std::string::npos)
+            break;
+
+          std::string line = m_input.substr(0, end);
+          m_input.erase(0, end + 1);
+          //! Line feeds left over by CR LF terminated lines.
+          while (!line.empty() && (line[0] == '\n' || line[0] == ' '))
+            line.erase(0, 1);
+
+          if (line.empty())
+            continue;
+
+          if (m_echo)
+            reply += line + "\r";
+
+          if (line.size() < 2 || (line.compare(0, 2, "AT") != 0 && line.compare(0, 2, "at") != 0))
+            continue;
+
+          ++m_commands;
+          Command command;
+          command.time = time;
+          command.text = line.substr(2);
+          m_log.push_back(command);
+          delay += m_config.latency;
+          reply += runLine(time, line.substr(2));
+        }
+
+        return reply;
+      }
+
+      //! Report registration changes and due URCs.
+      std::string
+      processEvents(double time)
+      {
+        std::string reply;
+        bool registered = isRegistered(time);
+        if (registered != m_registered)
+        {
+          m_registered = registered;
+          if (m_creg > 0)
+            reply += "\r\n" + getRegistration(time, false) + "\r\n";
+          if (m_events && !registered)
+            reply += "\r\n+CGEV: NW DETACH\r\n";
+          if (!registered)
+            m_pdp = false;
+        }
+
+        std::vector<std::pair<double, std::string> >::iterator itr = m_urcs.begin();
+        while (itr != m_urcs.end())
+        {
+          if (itr->first <= time)
+          {
+            reply += "\r\n" + itr->second + "\r\n";
+            itr = m_urcs.erase(itr);
+          }
+          else
+          {
+            ++itr;
+          }
+        }
+
+        return reply;
+      }
+
+      //! Run the commands of a command line, stopping at the first error.
+      std::string
+      runLine(double time, const std::string& line)
+      {
+        std::vector<std::string> commands;
+        std::string command;
+        bool quote = false;
+        for (std::size_t i = 0; i < line.size(); ++i)
+        {
+          if (line[i] == '"')
+            quote = !quote;
+
+          if (line[i] == ';' && !quote)
+          {
+            commands.push_back(command);
+            command.clear();
+          }
+          else
+          {
+            command.push_back(line[i]);
+          }
+        }
+        commands.push_back(command);
+
+        if (!line.empty() && std::rand() < m_config.error_rate * RAND_MAX)
+          return "\r\nERROR\r\n";
+
+        std::string reply;
+        for (std::size_t i = 0; i < commands.size(); ++i)
+        {
+          std::string result;
+          if (!runCommand(time, commands[i], result))
+            return reply + "\r\n" + result + "\r\n";
+
+          reply += result;
+          if (m_sms_input || !m_file_name.empty())
+            return reply;
+        }
+
+        return reply + "\r\nOK\r\n";
+      }
+
+      //! Run one command.
+      //! @param[in] time current time.
+      //! @param[in] cmd command without 'AT'.
+      //! @param[out] result information lines, or the error result code.
+      //! @return false on error.
+      bool
+      runCommand(double time, const std::string& cmd, std::string& result)
+      {
+        result = "ERROR";
+        std::string args;
+        std::size_t eq = cmd.find('=');
+        if (eq != std::string::npos)
+          args = cmd.substr(eq + 1);
+        std::string name = cmd.substr(0, eq);
+
+        if (name.empty() || name[0] != '+')
+        {
+          //! Basic commands: echo, reset, result codes.
+          if (name == "E0")
+            m_echo = false;
+          else if (name == "E1" || name == "E")
+            m_echo = true;
+          else if (name == "Z" || name == "&F")
+            m_echo = true;
+          result.clear();
+          return true;
+        }
+
+        int a = -1;
+        int b = -1;
+        std::sscanf(args.c_str(), "%d,%d", &a, &b);
+        bool registered = isRegistered(time);
+
+        if (name == "+CPIN?")
+        {
+          result = m_sim_ready ? line("+CPIN: READY") : line("+CPIN: SIM PIN");
+        }
+        else if (name == "+CPIN")
+        {
+          std::string pin = args;
+          if (pin.size() >= 2 && pin[0] == '"')
+            pin = pin.substr(1, pin.size() - 2);
+
+          if (m_sim_ready || pin != m_config.pin)
+          {
+            result = "+CME ERROR: 16";
+            return false;
+          }
+
+          m_sim_ready = true;
+          m_cfun_time = time;
+          result.clear();
+        }
+        else if (name == "+CREG?")
+        {
+          result = line(getRegistration(time, true));
+        }
+        else if (name == "+CREG")
+        {
+          m_creg = a;
+          result.clear();
+        }
+        else if (name == "+COPS?")
+        {
+          result = registered ? line(format("+COPS: 0,0,\"SIMULATED\",%d", m_config.rat)) : line("+COPS: 0");
+        }
+        else if (name == "+CGACT?")
+        {
+          result = line(format("+CGACT: 1,%d", isConnected(time) ? 1 : 0));
+        }
+        else if (name == "+CGACT")
+        {
+          if (!registered)
+          {
+            result = "+CME ERROR: 30";
+            return false;
+          }
+
+          m_pdp = a == 1;
+          result.clear();
+        }
+        else if (name == "+CGATT")
+        {
+          result.clear();
+        }
+        else if (name == "+CGDCONT?")
+        {
+          result = line(format("+CGDCONT: 1,\"IP\",\"%s\",\"0.0.0.0\",0,0", m_apn.c_str()));
+        }
+        else if (name == "+CGDCONT")
+        {
+          std::size_t first = args.find('"', args.find(',', args.find(',') + 1));
+          std::size_t last = args.find('"', first + 1);
+          if (first != std::string::npos && last != std::string::npos)
+            m_apn = args.substr(first + 1, last - first - 1);
+          result.clear();
+        }
+        else if (name == "+CFUN")
+        {
+          if (a == 1 && m_cfun != 1)
+            m_cfun_time = time;
+          m_cfun = a;
+          result.clear();
+        }
+        else if (name == "+CFUN?")
+        {
+          result = line(format("+CFUN: %d", m_cfun));
+        }
+        else if (name == "+CGSN" || name == "+GSN")
+        {
+          result = line("356938035643809");
+        }
+        else if (name == "+CIMI")
+        {
+          result = line("268010000000001");
+        }
+        else if (name == "+CSQ")
+        {
+          result = line(format("+CSQ: %d,99", registered ? m_config.csq : 99));
+        }
+        else if (name == "+CGEREP" || name == "+CMER")
+        {
+          m_events = a > 0;
+          result.clear();
+        }
+        else if (name == "+CNMI")
+        {
+          m_indications = a > 0;
+          result.clear();
+        }
+        else if (name == "+CMEE" || name == "+CMGF" || name == "+UCGDFLT" ||
+                 name == "+UPSD" || name == "+UDCONF")
+        {
+          result.clear();
+        }
+        else if (name == "+UPSDA")
+        {
+          //! +UPSDA=<profile>,3 activates the profile, reported once up.
+          if (b == 3)
+            m_urcs.push_back(std::make_pair(time + m_config.latency, format("+UUPSDA: %d,\"10.0.0.2\"", a)));
+          result.clear();
+        }
+        else if (name == "+UPING")
+        {
+          return startPing(time, args, result);
+        }
+        else if (name == "+CMGS")
+        {
+          if (!registered)
+          {
+            result = "+CMS ERROR: 331";
+            return false;
+          }
+
+          m_sms_input = true;
+          result = "\r\n> ";
+        }
+        else if (name == "+CPMS?")
+        {
+          unsigned used = m_inbox.size();
+          result = line(format("+CPMS: \"ME\",%u,%d,\"ME\",%u,%d,\"ME\",%u,%d", used, m_config.storage,
+                               used, m_config.storage, used, m_config.storage));
+        }
+        else if (name == "+CMGR")
+        {
+          result.clear();
+          std::map<int, Stored>::iterator itr = m_inbox.find(a);
+          if (itr != m_inbox.end())
+          {
+            result = line(format("+CMGR: %d,,%u", itr->second.stat, getTpduSize(itr->second.pdu)));
+            result += line(itr->second.pdu);
+            itr->second.stat = 1;
+          }
+        }
+        else if (name == "+CMGL")
+        {
+          result.clear();
+          std::map<int, Stored>::iterator itr = m_inbox.begin();
+          for (; itr != m_inbox.end(); ++itr)
+          {
+            result += line(format("+CMGL: %d,%d,,%u", itr->first, itr->second.stat,
+                                  getTpduSize(itr->second.pdu)));
+            result += line(itr->second.pdu);
+            itr->second.stat = 1;
+          }
+        }
+        else if (name == "+CMGD")
+        {
+          if (b > 0)
+            m_inbox.clear();
+          else
+            m_inbox.erase(a);
+          result.clear();
+        }
+        else if (name == "+USOCR")
+        {
+          if (!isConnected(time))
+            return false;
+
+          int socket = m_next_socket++ % 7;
+          m_sockets[socket].clear();
+          result = line(format("+USOCR: %d", socket));
+        }
+        else if (name == "+USOST")
+        {
+          //! +USOST=<socket>,"<addr>",<port>,<length>,"<data>"
+          std::vector<std::string> fields = splitArgs(args);
+          if (fields.size() != 5 || m_sockets.count(a) == 0 || !isConnected(time) || m_udp_error)
+            return false;
+
+          //! Sent back by the remote end.
+          m_datagrams.push_back(fields[4]);
+          m_sockets[a].push_back(fields[4]);
+          m_urcs.push_back(std::make_pair(time + m_config.latency,
+                                          format("+UUSORF: %d,%u", a, (unsigned)fields[4].size() / 2)));
+          result = line(format("+USOST: %d,%s", a, fields[3].c_str()));
+        }
+        else if (name == "+USORF")
+        {
+          std::map<int, std::deque<std::string> >::iterator itr = m_sockets.find(a);
+          if (itr == m_sockets.end())
+            return false;
+
+          if (itr->second.empty())
+          {
+            result = line(format("+USORF: %d,0", a));
+          }
+          else
+          {
+            std::string hex = itr->second.front();
+            itr->second.pop_front();
+            result = line(format("+USORF: %d,\"10.0.0.1\",6002,%u,\"%s\"", a, (unsigned)hex.size() / 2,
+                                 hex.c_str()));
+          }
+        }
+        else if (name == "+USOCL")
+        {
+          if (m_sockets.erase(a) == 0)
+            return false;
+
+          result.clear();
+        }
+        else if (name == "+UDWNFILE")
+        {
+          //! +UDWNFILE="<name>",<size>
+          std::vector<std::string> fields = splitArgs(args);
+          if (fields.size() != 2 || fields[0].empty() || std::atoi(fields[1].c_str()) <= 0)
+            return false;
+
+          m_file_name = fields[0];
+          m_file_size = std::atoi(fields[1].c_str());
+          m_files[m_file_name];
+          result = "\r\n>";
+        }
+        else if (name == "+ULSTFILE")
+        {
+          //! +ULSTFILE=2,"<name>"
+          std::vector<std::string> fields = splitArgs(args);
+          if (fields.size() != 2 || m_files.count(fields[1]) == 0)
+          {
+            result = "+CME ERROR: FILE NOT FOUND";
+            return false;
+          }
+
+          result = line(format("+ULSTFILE: %u", (unsigned)m_files[fields[1]].size()));
+        }
+        else if (name == "+UDELFILE")
+        {
+          std::vector<std::string> fields = splitArgs(args);
+          if (fields.size() != 1 || m_files.erase(fields[0]) == 0)
+          {
+            result = "+CME ERROR: FILE NOT FOUND";
+            return false;
+          }
+
+          result.clear();
+        }
+        else if (name == "+UHTTP")
+        {
+          result.clear();
+        }
+        else if (name == "+UHTTPC")
+        {
+          return postFile(time, args, result);
+        }
+        else
+        {
+          return false;
+        }
+
+        return true;
+      }
+
+      //! Split command arguments at commas outside quotes, removing the
+      //! quotes.
+      static std::vector<std::string>
+      splitArgs(const std::string& args)
+      {
+        std::vector<std::string> fields(1);
+        bool quote = false;
+        for (std::size_t i = 0; i < args.size(); ++i)
+        {
+          if (args[i] == '"')
+            quote = !quote;
+          else if (args[i] == ',' && !quote)
+            fields.push_back(std::string());
+          else
+            fields.back().push_back(args[i]);
+        }
+
+        return fields;
+      }
+
+      //! Append input bytes to the file being written.
+      std::string
+      writeFile(double time, double& delay)
+      {
+        std::string& file = m_files[m_file_name];
+        std::size_t size = std::min(m_file_size, m_input.size());
+        if (m_file_cut >= 0)
+          size = std::min(size, (std::size_t)std::max(m_file_cut - (int)file.size(), 0));
+
+        file.append(m_input, 0, size);
+        m_input.erase(0, size);
+        m_file_size -= size;
+
+        if (m_file_cut >= 0 && (int)file.size() >= m_file_cut && m_file_size > 0)
+        {
+          //! Whatever follows is lost with the modem.
+          m_file_cut = -1;
+          m_file_name.clear();
+          m_dropout_end = time + m_file_silence;
+          m_input.clear();
+          return "";
+        }
+
+        if (m_file_size > 0)
+          return "";
+
+        m_file_name.clear();
+        delay += m_config.latency;
+        return line("OK");
+      }
+
+      //! +UHTTPC=<profile>,4,"<path>","<reply file>","<file>",<type>
+      bool
+      postFile(double time, const std::string& args, std::string& result)
+      {
+        std::vector<std::string> fields = splitArgs(args);
+        if (fields.size() != 6 || fields[1] != "4")
+          return false;
+
+        Post post;
+        post.time = time;
+        post.path = fields[2];
+        std::map<std::string, std::string>::const_iterator itr = m_files.find(fields[4]);
+        post.success = itr != m_files.end() && isConnected(time) && m_http_failures == 0;
+        if (itr != m_files.end())
+          post.data = itr->second;
+        if (m_http_failures > 0)
+          --m_http_failures;
+
+        m_posts.push_back(post);
+        m_urcs.push_back(std::make_pair(time + m_config.http_delay,
+                                        format("+UUHTTPCR: %s,4,%d", fields[0].c_str(), post.success ? 1 : 0)));
+        result.clear();
+        return true;
+      }
+
+      static std::string
+      line(const std::string& str)
+      {
+        return "\r\n" + str + "\r\n";
+      }
+
+      //! @return TPDU size of a PDU without SMSC address.
+      static unsigned
+      getTpduSize(const std::string& pdu)
+      {
+        unsigned smsc = std::strtoul(pdu.substr(0, 2).c_str(), NULL, 16);
+        return pdu.size() / 2 - 1 - smsc;
+      }
+
+      std::string
+      getRegistration(double time, bool query)
+      {
+        int stat = isRegistered(time) ? 1 : (m_cfun == 1 && m_sim_ready ? 2 : 0);
+        std::string str = query ? format("+CREG: %d,%d", m_creg, stat) : format("+CREG: %d", stat);
+        if (m_creg == 2 && stat == 1)
+          str += ",\"1A2B\",\"01C3D4E5\"";
+        return str;
+      }
+
+      //! +UPING="<host>",<count>,<size>,<timeout>,<ttl>
+      bool
+      startPing(double time, const std::string& args, std::string& result)
+      {
+        char host[256] = {0};
+        int count = 1;
+        int size = 32;
+        if (std::sscanf(args.c_str(), "\"%255[^\"]\",%d,%d", host, &count, &size) < 1)
+          return false;
+
+        if (!isConnected(time))
+        {
+          result = "+CME ERROR: 3";
+          return false;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+          double due = time + (i + 1) * std::max(m_config.ping_rtt, 0) / 1000.0;
+          if (m_config.ping_error != 0)
+            m_urcs.push_back(std::make_pair(due, format("+UUPINGER: %d", m_config.ping_error)));
+          else
+            m_urcs.push_back(std::make_pair(due, format("+UUPING: %d,%d,\"%s\",\"10.0.0.1\",55,%d",
+                                                        i + 1, size, host, m_config.ping_rtt)));
+        }
+
+        result.clear();
+        return true;
+      }
+
+      std::string
+      sendSMS(double time, const std::string& pdu, double& delay)
+      {
+        delay += m_config.sms_delay;
+        if (!isRegistered(time))
+          return line("+CMS ERROR: 331");
+
+        if (std::rand() < m_config.sms_error_rate * RAND_MAX)
+          return line("+CMS ERROR: 38");
+
+        m_sent.push_back(pdu);
+        return line(format("+CMGS: %d", m_sms_ref++ & 0xff)) + line("OK");
+      }
+    };
+  }
+}
+#endif
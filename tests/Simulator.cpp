@@ -0,0 +1,103 @@
+//***************************************************************************
+// Toby L2 AT simulator on a pseudo-terminal, for bench testing the
+// driver without hardware.
+//
+// Build:
+//   g++ -std=c++11 -O2 -pthread -o toby-l2-sim Simulator.cpp
+//
+// Usage:
+//   toby-l2-sim [script] [link]
+//
+// The slave device is printed on start and, if given, symlinked at
+// 'link', so that the task's 'Serial Port - Device' can point to a fixed
+// path. See ModemSimulator::load() for the script keywords. Lines read
+// from the standard input while running are simulator commands:
+//   sms <origin> <text>   deliver an SMS
+//   lose | regain         lose or regain the network
+//   dropout <s>           stop answering for some time
+//   errors <fraction>     change the error rate
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <iostream>
+
+// POSIX headers.
+#include <unistd.h>
+
+// Local headers.
+#include "ModemSimulator.hpp"
+
+using namespace Transports::GSMTobyL2;
+
+int
+main(int argc, char** argv)
+{
+  SimulatorConfig config;
+
+  try
+  {
+    if (argc > 1)
+      ModemSimulator::load(argv[1], config);
+
+    ModemSimulator sim(config);
+    std::string link;
+    if (argc > 2)
+    {
+      link = argv[2];
+      ::unlink(link.c_str());
+      if (::symlink(sim.getDevice().c_str(), link.c_str()) != 0)
+        throw std::runtime_error("failed to create link " + link);
+    }
+
+    std::cout << sim.getDevice() << std::endl;
+
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+      std::istringstream is(line);
+      std::string cmd;
+      is >> cmd;
+      if (cmd == "sms")
+      {
+        std::string origin;
+        std::string text;
+        is >> origin;
+        std::getline(is >> std::ws, text);
+        sim.receiveSMS(origin, text);
+      }
+      else if (cmd == "lose" || cmd == "regain")
+      {
+        sim.setNetworkLost(cmd == "lose");
+      }
+      else if (cmd == "dropout")
+      {
+        double duration = 0;
+        is >> duration;
+        sim.dropout(duration);
+      }
+      else if (cmd == "errors")
+      {
+        double rate = 0;
+        is >> rate;
+        sim.setErrorRate(rate);
+      }
+      else if (!cmd.empty())
+      {
+        std::cerr << "unknown command: " << cmd << std::endl;
+      }
+
+      std::cout << "commands " << sim.getCommands() << ", sent " << sim.getSent().size()
+                << ", stored " << sim.getStored() << std::endl;
+    }
+
+    if (!link.empty())
+      ::unlink(link.c_str());
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
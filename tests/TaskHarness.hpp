@@ -0,0 +1,247 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_TASK_HARNESS_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_TASK_HARNESS_INCLUDED
+// ISO C++ 11 headers.
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Task under test, without its registration.
+#undef DUNE_TASK
+#define DUNE_TASK
+#include "../Task.cpp"
+
+// Local headers.
+#include "TestHarness.hpp"
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    //! Name of the task under test.
+    static const char* c_task_name = "Transports.GSM";
+
+    //! Configure the task under test for simulated modems: one serial
+    //! device and power channel per modem, short polling periods and
+    //! reports, SMS journal in the log directory.
+    //! @param[in] ctx context.
+    //! @param[in] devices serial devices.
+    //! @param[in] channels power channel names.
+    inline void
+    configureTask(Tasks::Context& ctx, const std::vector<std::string>& devices,
+                  const std::vector<std::string>& channels)
+    {
+      std::string dev;
+      std::string pwr;
+      for (std::size_t i = 0; i < devices.size(); ++i)
+      {
+        dev += (i ? "," : "") + devices[i];
+        pwr += (i ? "," : "") + channels[i];
+      }
+
+      ctx.config.set(c_task_name, "Serial Port - Device", dev);
+      ctx.config.set(c_task_name, "Power Channel - Name", pwr);
+      ctx.config.set(c_task_name, "Power Channel - Ready Timeout", "10");
+      ctx.config.set(c_task_name, "Turn GSM ON", "true");
+      ctx.config.set(c_task_name, "APN", "internet");
+      ctx.config.set(c_task_name, "RSSI Querry Periodicity", "1");
+      ctx.config.set(c_task_name, "RSSI Querry Maximum Periodicity", "1");
+      ctx.config.set(c_task_name, "Network Querry Periodicity", "1");
+      ctx.config.set(c_task_name, "Network Querry Maximum Periodicity", "1");
+      ctx.config.set(c_task_name, "Network Reports Periodicity", "1");
+      ctx.config.set(c_task_name, "SMS New Message Indications", "true");
+      ctx.config.set(c_task_name, "Persistent SMS Queue", "true");
+      ctx.config.set(c_task_name, "Ping - Targets", "");
+    }
+
+    //! Peer of the task under test on the message bus: switches power
+    //! channels on request, sends requests and records what the task
+    //! dispatches.
+    class ProbeTask: public Tasks::Task
+    {
+    public:
+      //! Called with the channel name and its new state.
+      typedef std::function<void(const std::string&, bool)> PowerHandler;
+
+      //! Channel operation requested by the task.
+      struct PowerRequest
+      {
+        // Time of the request.
+        double time;
+        // Channel name.
+        std::string name;
+        // Requested state.
+        bool on;
+      };
+
+      //! @param[in] ctx context.
+      //! @param[in] power called when a channel is switched.
+      ProbeTask(Tasks::Context& ctx, const PowerHandler& power):
+        Tasks::Task("TobyL2Probe", ctx),
+        m_power(power)
+      {
+        bind<IMC::PowerChannelControl>(this);
+        bind<IMC::SmsStatus>(this);
+        bind<IMC::TextMessage>(this);
+        bind<IMC::EntityParameters>(this);
+        bind<IMC::Temperature>(this);
+      }
+
+      //! Request an SMS.
+      //! @param[in] req_id request identifier.
+      //! @param[in] destination recipient.
+      //! @param[in] text message.
+      //! @param[in] timeout delivery timeout (s).
+      void
+      requestSMS(unsigned req_id, const std::string& destination, const std::string& text, double timeout)
+      {
+        IMC::SmsRequest sms_req;
+        sms_req.req_id = req_id;
+        sms_req.destination = destination;
+        sms_req.sms_text = text;
+        sms_req.timeout = timeout;
+        dispatch(sms_req);
+      }
+
+      //! @param[in] req_id request identifier.
+      //! @param[in] status request status.
+      //! @return time the status was received, negative if it was not.
+      double
+      getStatusTime(unsigned req_id, unsigned status)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        std::map<std::pair<unsigned, unsigned>, double>::const_iterator itr;
+        itr = m_statuses.find(std::make_pair(req_id, status));
+        return itr == m_statuses.end() ? -1 : itr->second;
+      }
+
+      //! @param[in] status request status.
+      //! @return number of requests that reached a status.
+      unsigned
+      countStatus(unsigned status)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        unsigned count = 0;
+        std::map<std::pair<unsigned, unsigned>, double>::const_iterator itr = m_statuses.begin();
+        for (; itr != m_statuses.end(); ++itr)
+        {
+          if (itr->first.second == status)
+            ++count;
+        }
+        return count;
+      }
+
+      //! @return text messages received.
+      std::vector<std::string>
+      getTexts(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_texts;
+      }
+
+      //! @return temperatures received.
+      std::vector<float>
+      getTemperatures(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_temperatures;
+      }
+
+      //! @return channel operations requested.
+      std::vector<PowerRequest>
+      getPowerRequests(void)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_requests;
+      }
+
+      //! @param[in] name entity parameter name.
+      //! @return last value reported, empty if none.
+      std::string
+      getParameter(const std::string& name)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        return m_params[name];
+      }
+
+      void
+      consume(const IMC::PowerChannelControl* msg)
+      {
+        bool on = msg->op == IMC::PowerChannelControl::PCC_OP_TURN_ON;
+        {
+          std::lock_guard<std::mutex> l(m_lock);
+          PowerRequest request = {Clock::get(), msg->name, on};
+          m_requests.push_back(request);
+        }
+
+        if (m_power)
+          m_power(msg->name, on);
+
+        IMC::PowerChannelState state;
+        state.name = msg->name;
+        state.state = on ? 1 : 0;
+        dispatch(state);
+      }
+
+      void
+      consume(const IMC::SmsStatus* msg)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        std::pair<unsigned, unsigned> key(msg->req_id, msg->status);
+        if (m_statuses.count(key) == 0)
+          m_statuses[key] = Clock::get();
+      }
+
+      void
+      consume(const IMC::TextMessage* msg)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_texts.push_back(msg->text);
+      }
+
+      void
+      consume(const IMC::EntityParameters* msg)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        IMC::MessageList<IMC::EntityParameter>::const_iterator itr = msg->params.begin();
+        for (; itr != msg->params.end(); ++itr)
+          m_params[(*itr)->name] = (*itr)->value;
+      }
+
+      void
+      consume(const IMC::Temperature* msg)
+      {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_temperatures.push_back(msg->value);
+      }
+
+      void
+      onMain(void)
+      {
+        while (!stopping())
+          waitForMessages(0.05);
+      }
+
+    private:
+      //! Channel switch handler.
+      PowerHandler m_power;
+      //! Time each request status was first received.
+      std::map<std::pair<unsigned, unsigned>, double> m_statuses;
+      //! Text messages received.
+      std::vector<std::string> m_texts;
+      //! Temperatures received.
+      std::vector<float> m_temperatures;
+      //! Channel operations requested.
+      std::vector<PowerRequest> m_requests;
+      //! Last entity parameter values.
+      std::map<std::string, std::string> m_params;
+      //! Lock for records.
+      std::mutex m_lock;
+    };
+  }
+}
+#endif
@@ -0,0 +1,176 @@
+//***************************************************************************
+// Tests of IMC over UDP against the AT simulator, which sends every
+// datagram back: a bundle round trip decoded through PacketDecoder, and
+// a send error closing the socket and counting the datagram as lost.
+// Results are printed as one line per measurement; the exit status is
+// non-zero if any check fails.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o test-datagrams
+//       $TASK/tests/TestDatagrams.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   test-datagrams [script]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <cstdio>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "TestHarness.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Time to wait for each step (s).
+  const double c_step_timeout = 60.0;
+  //! Messages in the bundle.
+  const unsigned c_bundle_count = 8;
+  //! Datagram batching period (s).
+  const double c_batch_period = 0.1;
+
+  //! @return number of temperatures received so far.
+  unsigned
+  countTemperatures(Harness& h)
+  {
+    unsigned count = 0;
+    for (std::size_t i = 0; i < h.messages.size(); ++i)
+    {
+      if (h.messages[i]->getId() == IMC::Temperature::getIdStatic())
+        ++count;
+    }
+    return count;
+  }
+
+  //! Queue temperatures, sent as one datagram.
+  //! @param[in] h harness.
+  //! @param[in] count number of messages.
+  //! @param[in] first value of the first message.
+  void
+  pushTemperatures(Harness& h, unsigned count, float first)
+  {
+    for (unsigned i = 0; i < count; ++i)
+    {
+      IMC::Temperature temperature;
+      temperature.value = first + i;
+      temperature.setTimeStamp(1.0);
+      h.datagrams.push(&temperature);
+    }
+  }
+
+  //! Send a bundle and check it comes back whole, both through the
+  //! driver and decoding the datagram sent with PacketDecoder.
+  void
+  testEcho(ModemSimulator& sim, Harness& h)
+  {
+    double start = Clock::get();
+    pushTemperatures(h, c_bundle_count, 10.0f);
+    bool echoed = h.waitFor([&]() { return countTemperatures(h) >= c_bundle_count; }, c_step_timeout);
+    check(echoed, "bundle echoed");
+    report("datagram round trip", Clock::get() - start, "s");
+
+    unsigned matched = 0;
+    for (std::size_t i = 0; i < h.messages.size(); ++i)
+    {
+      IMC::Temperature* temperature = dynamic_cast<IMC::Temperature*>(h.messages[i]);
+      if (temperature != NULL && temperature->value == 10.0f + matched)
+        ++matched;
+    }
+    check(matched == c_bundle_count, "bundle decoded by the driver");
+
+    std::vector<std::string> sent = sim.getDatagrams();
+    check(sent.size() == 1, "bundle sent as one datagram");
+
+    PacketDecoder decoder;
+    unsigned decoded = 0;
+    bool valid = !sent.empty() && decoder.decodeHex(sent.front());
+    while (const IMC::Message* msg = decoder.next())
+    {
+      const IMC::Temperature* temperature = dynamic_cast<const IMC::Temperature*>(msg);
+      if (temperature != NULL && temperature->value == 10.0f + decoded)
+        ++decoded;
+    }
+    check(valid && decoded == c_bundle_count && decoder.getRejected() == 0, "bundle decoded by PacketDecoder");
+
+    Datagrams::Statistics stats;
+    h.datagrams.getStatistics(stats);
+    check(stats.msgs_out == c_bundle_count && stats.msgs_in == c_bundle_count && stats.dropped == 0,
+          "traffic counted");
+  }
+
+  //! Fail a send and check the socket is closed and the datagram lost,
+  //! then that the next datagram goes through a new socket.
+  void
+  testSendError(ModemSimulator& sim, Harness& h)
+  {
+    Datagrams::Statistics stats;
+    h.datagrams.getStatistics(stats);
+    std::size_t commands = sim.getLog().size();
+
+    sim.setDatagramError(true);
+    pushTemperatures(h, 2, 50.0f);
+    h.waitFor([&]()
+              {
+                std::vector<ModemSimulator::Command> log = sim.getLog();
+                for (std::size_t i = commands; i < log.size(); ++i)
+                {
+                  if (log[i].text.compare(0, 7, "+USOCL=") == 0)
+                    return true;
+                }
+                return false;
+              }, c_step_timeout);
+
+    bool closed = false;
+    std::vector<ModemSimulator::Command> log = sim.getLog();
+    for (std::size_t i = commands; i + 1 < log.size() && !closed; ++i)
+      closed = log[i].text.compare(0, 7, "+USOST=") == 0 && log[i + 1].text.compare(0, 7, "+USOCL=") == 0;
+    check(closed, "socket closed after send error");
+
+    h.datagrams.getStatistics(stats);
+    check(stats.msgs_out == 0 && stats.dropped == 2, "datagram counted lost");
+
+    sim.setDatagramError(false);
+    std::size_t received = countTemperatures(h);
+    pushTemperatures(h, 1, 60.0f);
+    bool echoed = h.waitFor([&]() { return countTemperatures(h) > received; }, c_step_timeout);
+    check(echoed && sim.getSockets() == 1, "datagram sent on a new socket");
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  SimulatorConfig config;
+
+  try
+  {
+    if (argc > 1)
+      ModemSimulator::load(argv[1], config);
+
+    ModemSimulator sim(config);
+    Tasks::Context ctx;
+    TestTask task(ctx);
+    Harness h;
+
+    h.open(&task, sim.getDevice());
+    check(h.waitConnected(c_step_timeout), "bring-up");
+    h.driver->setDatagramConfig("10.0.0.1", 6002, c_batch_period);
+    if (getFailures() == 0)
+    {
+      testEcho(sim, h);
+      testSendError(sim, h);
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return getFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+#ifndef TRANSPORTS_GSM_TOBY_L2_TEST_HARNESS_INCLUDED
+#define TRANSPORTS_GSM_TOBY_L2_TEST_HARNESS_INCLUDED
+// ISO C++ 11 headers.
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "../TobyL2.hpp"
+#include "ModemSimulator.hpp"
+
+namespace Transports
+{
+  namespace GSMTobyL2
+  {
+    using DUNE_NAMESPACES;
+
+    //! @return number of checks failed so far.
+    inline unsigned&
+    getFailures(void)
+    {
+      static unsigned failures = 0;
+      return failures;
+    }
+
+    //! Print the outcome of a check.
+    //! @param[in] condition check passed.
+    //! @param[in] what check description.
+    inline void
+    check(bool condition, const char* what)
+    {
+      std::printf("%-40s %s\n", what, condition ? "ok" : "FAILED");
+      if (!condition)
+        ++getFailures();
+    }
+
+    //! Print a measurement.
+    //! @param[in] what measurement description.
+    //! @param[in] value measured value.
+    //! @param[in] unit value unit.
+    inline void
+    report(const char* what, double value, const char* unit)
+    {
+      std::printf("%-40s %.2f %s\n", what, value, unit);
+    }
+
+    //! Poll a condition until it holds.
+    //! @param[in] condition condition.
+    //! @param[in] timeout maximum time to wait (s).
+    //! @param[in] poll called before each evaluation, may be empty.
+    //! @return false on timeout.
+    inline bool
+    waitFor(const std::function<bool(void)>& condition, double timeout,
+            const std::function<void(void)>& poll = std::function<void(void)>())
+    {
+      Time::Counter<double> timer(timeout);
+      while (true)
+      {
+        if (poll)
+          poll();
+
+        if (condition())
+          return true;
+
+        if (timer.overflow())
+          return false;
+
+        Delay::wait(0.05);
+      }
+    }
+
+    //! Host for a driver: logs and parameters only.
+    class TestTask: public Tasks::Task
+    {
+    public:
+      TestTask(Tasks::Context& ctx):
+        Tasks::Task("TobyL2Test", ctx)
+      { }
+
+      void
+      onMain(void)
+      { }
+    };
+
+    //! Driver under test and its shared queues.
+    struct Harness
+    {
+      SmsQueue queue;
+      Datagrams datagrams;
+      Uploads uploads;
+      IO::Handle* uart;
+      TobyL2* driver;
+      //! Recovery action in progress.
+      int tier;
+      //! Text messages received.
+      std::vector<std::string> texts;
+      //! Other messages received.
+      std::vector<IMC::Message*> messages;
+
+      Harness(void):
+        uart(NULL),
+        driver(NULL),
+        tier(RECOVERY_NONE)
+      { }
+
+      ~Harness(void)
+      {
+        close();
+      }
+
+      //! Bring a driver up on a serial device and start its engine with
+      //! short polling periods.
+      //! @param[in] task host task.
+      //! @param[in] device serial device.
+      void
+      open(Tasks::Task* task, const std::string& device)
+      {
+        open(task, new SerialPort(device, 115200));
+      }
+
+      //! Bring a driver up on a handle and start its engine with short
+      //! polling periods.
+      //! @param[in] task host task.
+      //! @param[in] handle serial port, owned by the harness.
+      void
+      open(Tasks::Task* task, IO::Handle* handle)
+      {
+        uart = handle;
+        driver = new TobyL2(task, uart, &queue, &datagrams, &uploads, 10.0);
+        driver->initTobyL2("internet", "");
+        driver->setNtwkTimer(1.0, 1.0);
+        driver->setRssiTimer(1.0, 1.0);
+        driver->setSMSTimeout(60.0);
+        driver->setMessageIndications(true);
+        driver->startEngine();
+      }
+
+      //! Stop the driver and close its serial port.
+      void
+      close(void)
+      {
+        if (driver != NULL)
+        {
+          driver->stopEngine();
+          driver->stopAndJoin();
+        }
+
+        Memory::clear(driver);
+        Memory::clear(uart);
+        for (std::size_t i = 0; i < messages.size(); ++i)
+          delete messages[i];
+        messages.clear();
+      }
+
+      //! Recover from engine failures with escalating tiers like the
+      //! task does, up to a soft reset.
+      void
+      recover(void)
+      {
+        std::string error;
+        if (driver->getFailure(error))
+        {
+          if (tier < RECOVERY_SOFT_RESET)
+            ++tier;
+          std::printf("engine failed (%s), recovery tier %d\n", error.c_str(), tier);
+          driver->recover((RecoveryTier)tier);
+        }
+
+        if (driver->isRecovered())
+          tier = RECOVERY_NONE;
+      }
+
+      //! Take the messages produced by the driver.
+      void
+      drain(void)
+      {
+        while (IMC::Message* msg = driver->popMessage())
+        {
+          IMC::TextMessage* text = dynamic_cast<IMC::TextMessage*>(msg);
+          if (text != NULL)
+          {
+            texts.push_back(text->text);
+            delete msg;
+          }
+          else
+          {
+            messages.push_back(msg);
+          }
+        }
+      }
+
+      //! @return true if the link is up.
+      bool
+      isConnected(void)
+      {
+        TobyL2::LinkStatus link = TobyL2::LinkStatus();
+        driver->getLinkStatus(link);
+        return link.state == NETWORK_CONNECTION_OK;
+      }
+
+      //! Wait for a condition while draining the driver messages.
+      //! @param[in] condition condition.
+      //! @param[in] timeout maximum time to wait (s).
+      //! @param[in] recovery recover from engine failures meanwhile.
+      //! @return false on timeout.
+      bool
+      waitFor(const std::function<bool(void)>& condition, double timeout, bool recovery = false)
+      {
+        return GSMTobyL2::waitFor(condition, timeout, [this, recovery]()
+                                  {
+                                    if (recovery)
+                                      recover();
+                                    drain();
+                                  });
+      }
+
+      //! Wait for the link to come up, recovering from engine failures.
+      //! @param[in] timeout maximum time to wait (s).
+      //! @return false on timeout.
+      bool
+      waitConnected(double timeout)
+      {
+        return waitFor([this]() { return tier == RECOVERY_NONE && isConnected(); }, timeout, true);
+      }
+    };
+  }
+}
+#endif
@@ -0,0 +1,211 @@
+//***************************************************************************
+// Tests of the GSM task with several modems, each an AT simulator on its
+// own power channel: aggregate SMS throughput with 1, 2 and 3 modems
+// sharing the SMS queue, and SMS still going out through the other
+// modems while one of them stops answering. Results are printed as one
+// line per measurement; the exit status is non-zero if any check fails.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o test-modems
+//       $TASK/tests/TestModems.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   test-modems [script]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "TaskHarness.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Time to wait for each step (s).
+  const double c_step_timeout = 60.0;
+  //! Largest number of modems.
+  const unsigned c_max_modems = 3;
+  //! Number of SMS sent in each throughput test.
+  const unsigned c_sms_count = 18;
+  //! Time a modem stays silent in the dropout test (s).
+  const double c_dropout = 600.0;
+  //! Recipient of test SMS.
+  const char* c_recipient = "+351910000000";
+
+  //! Task under test with its simulated modems and probe.
+  struct Fixture
+  {
+    std::vector<std::unique_ptr<ModemSimulator> > sims;
+    Tasks::Context ctx;
+    std::unique_ptr<ProbeTask> probe;
+    std::unique_ptr<Transports::GSMTobyL2::Task> task;
+    //! Next SMS request identifier.
+    unsigned req_id;
+
+    //! @param[in] config simulator behaviour.
+    //! @param[in] count number of modems.
+    Fixture(const SimulatorConfig& config, unsigned count):
+      req_id(1)
+    {
+      char dir[] = "/tmp/test-modems-XXXXXX";
+      if (mkdtemp(dir) == NULL)
+        throw std::runtime_error("failed to create log directory");
+      ctx.dir_log = Path(dir);
+
+      std::vector<std::string> devices;
+      std::vector<std::string> channels;
+      for (unsigned i = 0; i < count; ++i)
+      {
+        sims.push_back(std::unique_ptr<ModemSimulator>(new ModemSimulator(config)));
+        devices.push_back(sims[i]->getDevice());
+        channels.push_back(String::str("GSM%u", i));
+      }
+
+      configureTask(ctx, devices, channels);
+      probe.reset(new ProbeTask(ctx, [this](const std::string& name, bool on)
+                                {
+                                  sims[std::atoi(name.c_str() + 3)]->setPower(on);
+                                }));
+      probe->start();
+      task.reset(new Transports::GSMTobyL2::Task(c_task_name, ctx));
+      task->start();
+    }
+
+    ~Fixture(void)
+    {
+      task->stopAndJoin();
+      probe->stopAndJoin();
+    }
+
+    //! @return connection state reported for a modem.
+    std::string
+    getState(unsigned index)
+    {
+      if (sims.size() < 2)
+        return probe->getParameter("Connection State");
+      return probe->getParameter(String::str("Modem %u Connection State", index));
+    }
+
+    //! @return true if all modems are connected.
+    bool
+    isConnected(void)
+    {
+      for (unsigned i = 0; i < sims.size(); ++i)
+      {
+        if (getState(i) != "connected")
+          return false;
+      }
+      return true;
+    }
+
+    //! Request SMS and wait until they are all reported sent.
+    //! @param[in] count number of SMS.
+    //! @return time to send them (s), negative on timeout.
+    double
+    sendSms(unsigned count)
+    {
+      unsigned first = req_id;
+      double start = Clock::get();
+      for (unsigned i = 0; i < count; ++i, ++req_id)
+        probe->requestSMS(req_id, c_recipient, String::str("modems test message %u", req_id), c_step_timeout);
+
+      bool sent = waitFor([&]()
+                          {
+                            for (unsigned id = first; id < req_id; ++id)
+                            {
+                              if (probe->getStatusTime(id, IMC::SmsStatus::SMSSTAT_SENT) < 0)
+                                return false;
+                            }
+                            return true;
+                          }, c_step_timeout);
+      return sent ? Clock::get() - start : -1;
+    }
+  };
+
+  //! Send SMS through a number of modems and measure the aggregate
+  //! throughput.
+  //! @return throughput (SMS/min), zero on failure.
+  double
+  testThroughput(const SimulatorConfig& config, unsigned count)
+  {
+    Fixture f(config, count);
+    bool connected = waitFor([&]() { return f.isConnected(); }, c_step_timeout);
+    check(connected, String::str("%u modems connected", count).c_str());
+    if (!connected)
+      return 0;
+
+    double elapsed = f.sendSms(c_sms_count);
+    check(elapsed > 0, String::str("SMS sent through %u modems", count).c_str());
+    if (elapsed <= 0)
+      return 0;
+
+    //! Every modem takes SMS from the shared queue.
+    bool shared = true;
+    for (unsigned i = 0; i < count; ++i)
+      shared = shared && !f.sims[i]->getSent().empty();
+    check(shared, String::str("queue shared by %u modems", count).c_str());
+
+    double throughput = c_sms_count * 60.0 / elapsed;
+    report(String::str("SMS throughput with %u modems", count).c_str(), throughput, "SMS/min");
+    return throughput;
+  }
+
+  //! Silence one modem and check that SMS go out through the others,
+  //! well before the silent modem is power cycled.
+  void
+  testDropout(const SimulatorConfig& config)
+  {
+    Fixture f(config, c_max_modems);
+    check(waitFor([&]() { return f.isConnected(); }, c_step_timeout), "modems connected before dropout");
+
+    f.sims[0]->dropout(c_dropout);
+    std::size_t dropped_sent = f.sims[0]->getSent().size();
+    double elapsed = f.sendSms(c_sms_count);
+    check(elapsed > 0, "SMS sent during a modem dropout");
+    check(f.sims[0]->getSent().size() == dropped_sent, "no SMS sent by the silent modem");
+    report("SMS delivery during dropout", elapsed, "s");
+    report("SMS throughput during dropout", elapsed > 0 ? c_sms_count * 60.0 / elapsed : 0, "SMS/min");
+
+    bool lost = waitFor([&]() { return f.getState(0) != "connected"; }, c_step_timeout);
+    check(lost && f.getState(1) == "connected" && f.getState(2) == "connected", "only the silent modem lost");
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  SimulatorConfig config;
+
+  try
+  {
+    if (argc > 1)
+      ModemSimulator::load(argv[1], config);
+
+    double single = 0;
+    for (unsigned count = 1; count <= c_max_modems; ++count)
+    {
+      double throughput = testThroughput(config, count);
+      if (count == 1)
+        single = throughput;
+      else
+        check(throughput > single * (count - 0.5), String::str("throughput scales to %u modems", count).c_str());
+    }
+
+    testDropout(config);
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return getFailures() == 0 ? 0 : 1;
+}
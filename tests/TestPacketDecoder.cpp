@@ -0,0 +1,208 @@
+//***************************************************************************
+// Tests of PacketDecoder on bundles that do not split exactly into IMC
+// packets: truncated packets, trailing bytes, payload sizes overrunning
+// the bundle, bad synchronization numbers and the bundle size limit, in
+// binary, hexadecimal and Base64. A rejected bundle must yield no
+// messages, while a packet with a bad CRC in a well formed bundle is
+// skipped and counted. The exit status is non-zero if any check fails.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o test-packet-decoder
+//       $TASK/tests/TestPacketDecoder.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   test-packet-decoder
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <cstdio>
+#include <string>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "../PacketDecoder.hpp"
+#include "TestHarness.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Temperatures in the test bundles.
+  const unsigned c_count = 4;
+
+  //! Append a serialized message to a bundle.
+  void
+  append(std::string& bundle, const IMC::Message& msg)
+  {
+    std::string packet(msg.getSerializationSize(), '\0');
+    IMC::Packet::serialize(&msg, (uint8_t*)&packet[0], packet.size());
+    bundle += packet;
+  }
+
+  //! @return bundle of temperatures.
+  std::string
+  createBundle(unsigned count)
+  {
+    std::string bundle;
+    for (unsigned i = 0; i < count; ++i)
+    {
+      IMC::Temperature temperature;
+      temperature.value = i;
+      temperature.setTimeStamp(1.0);
+      append(bundle, temperature);
+    }
+    return bundle;
+  }
+
+  //! @return bundle of a given size: temperatures and a text message
+  //! filling the rest.
+  std::string
+  createBundleOfSize(std::size_t size)
+  {
+    IMC::TextMessage text;
+    text.setTimeStamp(1.0);
+    std::size_t temperature = IMC::Temperature().getSerializationSize();
+    std::string bundle = createBundle((size - text.getSerializationSize()) / temperature - 1);
+    text.text.assign(size - bundle.size() - text.getSerializationSize(), 'x');
+    append(bundle, text);
+    return bundle;
+  }
+
+  //! Load a binary bundle and count the messages decoded.
+  //! @param[in] decoder decoder.
+  //! @param[in] bundle binary bundle.
+  //! @param[in] encoding 0 binary, 1 hexadecimal, 2 Base64.
+  //! @param[out] count messages decoded.
+  //! @return true if the bundle was accepted.
+  bool
+  decode(PacketDecoder& decoder, const std::string& bundle, unsigned encoding, unsigned& count)
+  {
+    bool valid = false;
+    if (encoding == 0)
+      valid = decoder.assign((const uint8_t*)bundle.data(), bundle.size());
+    else if (encoding == 1)
+      valid = decoder.decodeHex(String::toHex(bundle));
+    else
+      valid = decoder.decodeBase64(Algorithms::Base64::encode(bundle));
+
+    count = 0;
+    while (decoder.next() != NULL)
+      ++count;
+
+    return valid;
+  }
+
+  //! Check that a bundle is rejected in every encoding, after a valid
+  //! bundle was loaded, and that it yields no messages.
+  void
+  checkRejected(PacketDecoder& decoder, const std::string& bundle, const char* what)
+  {
+    bool rejected = true;
+    for (unsigned encoding = 0; encoding < 3; ++encoding)
+    {
+      unsigned count = 0;
+      decode(decoder, createBundle(1), encoding, count);
+      bool valid = decode(decoder, bundle, encoding, count);
+      rejected = rejected && !valid && count == 0;
+    }
+    check(rejected, what);
+  }
+
+  void
+  testExact(PacketDecoder& decoder)
+  {
+    bool exact = true;
+    for (unsigned encoding = 0; encoding < 3; ++encoding)
+    {
+      unsigned count = 0;
+      exact = exact && decode(decoder, createBundle(c_count), encoding, count) && count == c_count;
+    }
+    check(exact && decoder.getRejected() == 0, "whole bundle decoded");
+  }
+
+  void
+  testMalformed(PacketDecoder& decoder)
+  {
+    std::string bundle = createBundle(c_count);
+    std::size_t packet = bundle.size() / c_count;
+
+    checkRejected(decoder, bundle.substr(0, bundle.size() - 1), "truncated footer rejected");
+    checkRejected(decoder, bundle.substr(0, bundle.size() - packet + 10), "truncated header rejected");
+    checkRejected(decoder, bundle + std::string(3, '\0'), "trailing bytes rejected");
+    checkRejected(decoder, bundle + bundle.substr(0, c_imc_header_size + 1), "trailing partial packet rejected");
+
+    std::string overrun = bundle;
+    overrun[overrun.size() - packet + c_imc_size_offset] += 1;
+    checkRejected(decoder, overrun, "payload size overrun rejected");
+
+    std::string sync = bundle;
+    sync[packet] ^= 0xff;
+    checkRejected(decoder, sync, "bad sync number rejected");
+
+    checkRejected(decoder, "", "empty bundle rejected");
+  }
+
+  void
+  testLimit(PacketDecoder& decoder)
+  {
+    std::string bundle = createBundleOfSize(c_bundle_max_size);
+    bool accepted = bundle.size() == c_bundle_max_size;
+    for (unsigned encoding = 0; encoding < 3; ++encoding)
+    {
+      unsigned count = 0;
+      accepted = accepted && decode(decoder, bundle, encoding, count) && count > 1;
+    }
+    check(accepted, "bundle at the size limit decoded");
+
+    bundle = createBundleOfSize(c_bundle_max_size + 1);
+    checkRejected(decoder, bundle, "bundle over the size limit rejected");
+  }
+
+  void
+  testCorruptPacket(PacketDecoder& decoder)
+  {
+    std::string bundle = createBundle(c_count);
+    std::size_t packet = bundle.size() / c_count;
+    bundle[packet + c_imc_header_size] ^= 0xff;
+
+    unsigned count = 0;
+    bool valid = decode(decoder, bundle, 0, count);
+    check(valid && count == c_count - 1 && decoder.getRejected() == 1, "corrupt packet skipped and counted");
+  }
+
+  void
+  testBase64(PacketDecoder& decoder)
+  {
+    std::string text = Algorithms::Base64::encode(createBundle(c_count));
+    std::string wrapped;
+    for (std::size_t i = 0; i < text.size(); i += 76)
+      wrapped += text.substr(i, 76) + "\r\n";
+
+    unsigned count = 0;
+    bool valid = decoder.decodeBase64(wrapped);
+    while (decoder.next() != NULL)
+      ++count;
+    check(valid && count == c_count, "line breaks ignored in Base64");
+
+    check(!decoder.decodeBase64(text.substr(0, text.size() - 1)) && decoder.next() == NULL,
+          "truncated Base64 rejected");
+    check(!decoder.decodeBase64("=" + text.substr(1)) && decoder.next() == NULL, "misplaced padding rejected");
+    check(!decoder.decodeHex(String::toHex(createBundle(c_count)) + "0") && decoder.next() == NULL,
+          "odd hexadecimal length rejected");
+  }
+}
+
+int
+main(void)
+{
+  PacketDecoder decoder;
+  testExact(decoder);
+  testMalformed(decoder);
+  testLimit(decoder);
+  testCorruptPacket(decoder);
+  testBase64(decoder);
+  return getFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+//***************************************************************************
+// End to end tests of the GSM task: the task runs through onMain against
+// the AT simulator, with a probe task on the message bus standing for
+// the power controller and the SMS clients. Covers the power channel and
+// bring-up phases, SMS requests and their status, inbox delivery,
+// datagrams echoed back through the outbox, recovery through the tiers
+// up to a power cycle and the SMS journal across task restarts. Results
+// are printed as one line per measurement; the exit status is non-zero
+// if any check fails.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o test-task
+//       $TASK/tests/TestTask.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   test-task [script]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "TaskHarness.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Time to wait for each step (s).
+  const double c_step_timeout = 60.0;
+  //! Time to wait for a recovery up to a power cycle (s).
+  const double c_recovery_timeout = 120.0;
+  //! Number of SMS sent in the throughput test.
+  const unsigned c_sms_count = 10;
+  //! Number of SMS queued across the task restart.
+  const unsigned c_journal_count = 3;
+  //! Number of messages sent as datagrams.
+  const unsigned c_udp_count = 5;
+  //! Recipient of test SMS.
+  const char* c_recipient = "+351910000000";
+
+  //! Task under test and its probe.
+  struct Fixture
+  {
+    Tasks::Context& ctx;
+    ProbeTask& probe;
+    std::unique_ptr<Transports::GSMTobyL2::Task> task;
+
+    Fixture(Tasks::Context& c, ProbeTask& p):
+      ctx(c),
+      probe(p)
+    { }
+
+    void
+    start(void)
+    {
+      task.reset(new Transports::GSMTobyL2::Task(c_task_name, ctx));
+      task->start();
+    }
+
+    void
+    stop(void)
+    {
+      if (task)
+        task->stopAndJoin();
+      task.reset();
+    }
+
+    //! @return connection state reported by the task.
+    std::string
+    getState(void)
+    {
+      return probe.getParameter("Connection State");
+    }
+  };
+
+  //! Start the task and wait for it to power the modem on and connect.
+  void
+  testBringUp(Fixture& f)
+  {
+    double start = Clock::get();
+    f.start();
+    bool connected = waitFor([&]() { return f.getState() == "connected"; }, c_step_timeout);
+    check(connected, "bring-up");
+
+    std::vector<ProbeTask::PowerRequest> requests = f.probe.getPowerRequests();
+    check(!requests.empty() && requests.front().on, "power channel requested on");
+    report("bring-up time", Clock::get() - start, "s");
+  }
+
+  //! Request SMS through the bus and wait until all are reported sent.
+  void
+  testSms(Fixture& f)
+  {
+    double start = Clock::get();
+    for (unsigned i = 1; i <= c_sms_count; ++i)
+      f.probe.requestSMS(i, c_recipient, String::str("task test message %u", i), c_step_timeout);
+
+    bool sent = waitFor([&]() { return f.probe.countStatus(IMC::SmsStatus::SMSSTAT_SENT) >= c_sms_count; },
+                        c_step_timeout);
+    double elapsed = Clock::get() - start;
+    check(f.probe.countStatus(IMC::SmsStatus::SMSSTAT_QUEUED) == c_sms_count, "SMS requests queued");
+    check(sent, "SMS requests sent");
+    report("SMS throughput", f.probe.countStatus(IMC::SmsStatus::SMSSTAT_SENT) * 60.0 / elapsed, "SMS/min");
+
+    //! Invalid requests are answered at once.
+    f.probe.requestSMS(100, c_recipient, "", c_step_timeout);
+    f.probe.requestSMS(101, c_recipient, "no timeout", 0);
+    bool refused = waitFor([&]() { return f.probe.getStatusTime(100, IMC::SmsStatus::SMSSTAT_INPUT_FAILURE) > 0 &&
+                                          f.probe.getStatusTime(101, IMC::SmsStatus::SMSSTAT_INPUT_FAILURE) > 0; },
+                           c_step_timeout);
+    check(refused, "invalid SMS requests refused");
+  }
+
+  //! Deliver an SMS to the modem and wait for the text message.
+  void
+  testInbox(ModemSimulator& sim, Fixture& f)
+  {
+    const std::string text = "task inbox message";
+    double start = Clock::get();
+    sim.receiveSMS("+351910000001", text);
+    bool received = waitFor([&]()
+                            {
+                              std::vector<std::string> texts = f.probe.getTexts();
+                              return std::find(texts.begin(), texts.end(), text) != texts.end();
+                            }, c_step_timeout);
+    check(received, "SMS received");
+    check(sim.getStored() == 0, "SMS deleted");
+    report("SMS delivery time", Clock::get() - start, "s");
+  }
+
+  //! Publish messages forwarded as datagrams, echoed back by the
+  //! simulator and dispatched from the modem outbox.
+  void
+  testDatagrams(ModemSimulator& sim, Fixture& f)
+  {
+    double start = Clock::get();
+    for (unsigned i = 0; i < c_udp_count; ++i)
+    {
+      IMC::Temperature temperature;
+      temperature.value = 20.0f + i;
+      f.probe.dispatch(temperature);
+    }
+
+    bool echoed = waitFor([&]() { return f.probe.getTemperatures().size() >= c_udp_count; }, c_step_timeout);
+    std::vector<float> values = f.probe.getTemperatures();
+    check(echoed && values.front() == 20.0f && values.back() == 20.0f + c_udp_count - 1, "datagrams echoed");
+    report("datagrams sent", sim.getDatagrams().size(), "datagrams");
+    report("datagram round trip", Clock::get() - start, "s");
+  }
+
+  //! Silence the modem until the task power cycles it, then send an SMS.
+  void
+  testRecovery(ModemSimulator& sim, Fixture& f)
+  {
+    std::size_t requests = f.probe.getPowerRequests().size();
+    double start = Clock::get();
+    sim.dropout(c_recovery_timeout * 10);
+
+    bool lost = waitFor([&]() { return f.getState() != "connected"; }, c_step_timeout);
+    bool recovered = waitFor([&]() { return f.getState() == "connected"; }, c_recovery_timeout);
+    check(lost && recovered, "recovery");
+
+    std::vector<ProbeTask::PowerRequest> power = f.probe.getPowerRequests();
+    bool cycled = power.size() >= requests + 2 && !power[requests].on && power.back().on;
+    check(cycled, "recovery by power cycle");
+    if (cycled)
+      report("time to power cycle", power[requests].time - start, "s");
+    report("recovery time after dropout", Clock::get() - start, "s");
+
+    f.probe.requestSMS(200, c_recipient, "after recovery", c_step_timeout);
+    bool sent = waitFor([&]() { return f.probe.getStatusTime(200, IMC::SmsStatus::SMSSTAT_SENT) > 0; },
+                        c_step_timeout);
+    check(sent, "SMS sent after recovery");
+  }
+
+  //! Queue SMS while the network is lost, restart the task and check
+  //! that the new instance sends them from the journal.
+  void
+  testJournal(ModemSimulator& sim, Fixture& f)
+  {
+    sim.setNetworkLost(true);
+    waitFor([&]() { return f.getState() != "connected"; }, c_step_timeout);
+
+    unsigned queued = f.probe.countStatus(IMC::SmsStatus::SMSSTAT_QUEUED) + c_journal_count;
+    for (unsigned i = 0; i < c_journal_count; ++i)
+      f.probe.requestSMS(300 + i, c_recipient, String::str("journal message %u", i), c_recovery_timeout);
+
+    waitFor([&]() { return f.probe.countStatus(IMC::SmsStatus::SMSSTAT_QUEUED) >= queued; }, c_step_timeout);
+    f.stop();
+    check(Path(f.ctx.dir_log / (std::string(c_task_name) + ".sms")).exists(), "SMS journal written");
+
+    sim.setNetworkLost(false);
+    double start = Clock::get();
+    f.start();
+    bool sent = waitFor([&]()
+                        {
+                          for (unsigned i = 0; i < c_journal_count; ++i)
+                          {
+                            if (f.probe.getStatusTime(300 + i, IMC::SmsStatus::SMSSTAT_SENT) < 0)
+                              return false;
+                          }
+                          return true;
+                        }, c_step_timeout);
+    check(sent, "journal SMS sent after restart");
+    report("journal SMS delivery after restart", Clock::get() - start, "s");
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  SimulatorConfig config;
+
+  try
+  {
+    if (argc > 1)
+      ModemSimulator::load(argv[1], config);
+
+    char dir[] = "/tmp/test-task-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+      throw std::runtime_error("failed to create log directory");
+
+    ModemSimulator sim(config);
+    Tasks::Context ctx;
+    ctx.dir_log = Path(dir);
+    configureTask(ctx, std::vector<std::string>(1, sim.getDevice()), std::vector<std::string>(1, "GSM"));
+    ctx.config.set(c_task_name, "IMC over UDP - Messages", "Temperature");
+    ctx.config.set(c_task_name, "IMC over UDP - Address", "10.0.0.1");
+    ctx.config.set(c_task_name, "IMC over UDP - Port", "6002");
+
+    ProbeTask probe(ctx, [&sim](const std::string&, bool on) { sim.setPower(on); });
+    probe.start();
+    Fixture f(ctx, probe);
+
+    testBringUp(f);
+    if (getFailures() == 0)
+    {
+      testSms(f);
+      testInbox(sim, f);
+      testDatagrams(sim, f);
+      testRecovery(sim, f);
+      testJournal(sim, f);
+    }
+
+    f.stop();
+    probe.stopAndJoin();
+    std::printf("%u commands answered\n", sim.getCommands());
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return getFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+//***************************************************************************
+// End to end tests of the Toby L2 driver against the AT simulator:
+// bring-up time, SMS throughput, inbox delivery and recovery time after
+// a dropout. Results are printed as one line per measurement; the exit
+// status is non-zero if any check fails.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o test-toby-l2
+//       $TASK/tests/TestTobyL2.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   test-toby-l2 [script]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <cstdio>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "TestHarness.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Time to wait for each step (s).
+  const double c_step_timeout = 60.0;
+  //! Number of SMS sent in the throughput test.
+  const unsigned c_sms_count = 10;
+  //! Duration of the simulated dropout (s).
+  const double c_dropout = 10.0;
+
+  //! Open the simulated modem and wait for the connection.
+  void
+  testBringUp(TestTask& task, ModemSimulator& sim, Harness& h)
+  {
+    double start = Clock::get();
+    h.open(&task, sim.getDevice());
+
+    bool connected = h.waitConnected(c_step_timeout);
+    check(connected, "bring-up");
+    report("bring-up time", Clock::get() - start, "s");
+  }
+
+  //! Queue SMS and wait until the simulator has sent them all.
+  void
+  testThroughput(ModemSimulator& sim, Harness& h)
+  {
+    std::size_t sent = sim.getSent().size();
+    double start = Clock::get();
+    for (unsigned i = 0; i < c_sms_count; ++i)
+    {
+      SmsRequest sms_req;
+      sms_req.req_id = i;
+      sms_req.src_adr = 0;
+      sms_req.src_eid = 0;
+      sms_req.destination = "+351910000000";
+      sms_req.sms_text = String::str("throughput test message %u", i);
+      sms_req.deadline = Clock::getSinceEpoch() + c_step_timeout;
+      h.queue.push(sms_req);
+    }
+
+    h.waitFor([&]() { return sim.getSent().size() >= sent + c_sms_count; }, c_step_timeout);
+    double elapsed = Clock::get() - start;
+    check(sim.getSent().size() == sent + c_sms_count, "SMS sent");
+    report("SMS throughput", (sim.getSent().size() - sent) * 60.0 / elapsed, "SMS/min");
+  }
+
+  //! Deliver an SMS to the simulator and wait for the text message.
+  void
+  testInbox(ModemSimulator& sim, Harness& h)
+  {
+    const std::string text = "inbox test message";
+    double start = Clock::get();
+    sim.receiveSMS("+351910000001", text);
+
+    bool received = h.waitFor([&]() { return std::find(h.texts.begin(), h.texts.end(), text) != h.texts.end(); },
+                              c_step_timeout);
+
+    check(received, "SMS received");
+    check(sim.getStored() == 0, "SMS deleted");
+    report("SMS delivery time", Clock::get() - start, "s");
+  }
+
+  //! Silence the modem and measure the time to connect again from the
+  //! failure.
+  void
+  testRecovery(ModemSimulator& sim, Harness& h)
+  {
+    sim.dropout(c_dropout);
+    std::string error;
+    h.waitFor([&]() { return h.driver->getFailure(error); }, c_step_timeout);
+    double start = Clock::get();
+    bool connected = h.waitConnected(c_step_timeout);
+    check(connected, "recovery");
+    report("recovery time after dropout", Clock::get() - start, "s");
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  SimulatorConfig config;
+
+  try
+  {
+    if (argc > 1)
+      ModemSimulator::load(argv[1], config);
+
+    ModemSimulator sim(config);
+    Tasks::Context ctx;
+    TestTask task(ctx);
+    Harness h;
+
+    testBringUp(task, sim, h);
+    if (getFailures() == 0)
+    {
+      testThroughput(sim, h);
+      testInbox(sim, h);
+      testRecovery(sim, h);
+    }
+
+    std::printf("%u commands answered\n", sim.getCommands());
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return getFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,223 @@
+//***************************************************************************
+// Tests of serial traces: a driver session against the AT simulator is
+// recorded and replayed through a new driver, which must write exactly
+// what was recorded, and a replay skips ahead at a gap marker to the
+// next command the modem writes. Results are printed as one line per
+// measurement; the exit status is non-zero if any check fails.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o test-trace
+//       $TASK/tests/TestTrace.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   test-trace [script]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "../SerialTrace.hpp"
+#include "TestHarness.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Time to wait for each step (s).
+  const double c_step_timeout = 60.0;
+  //! Number of SMS sent in the recorded session.
+  const unsigned c_sms_count = 3;
+  //! Time the recorded session keeps polling once done (s).
+  const double c_idle_time = 3.0;
+  //! Inbox text of the recorded session.
+  const char* c_inbox_text = "trace test message";
+
+  //! Queue the SMS sent in the recorded session.
+  void
+  pushSms(Harness& h)
+  {
+    for (unsigned i = 0; i < c_sms_count; ++i)
+    {
+      SmsRequest sms_req;
+      sms_req.req_id = i;
+      sms_req.src_adr = 0;
+      sms_req.src_eid = 0;
+      sms_req.destination = "+351910000000";
+      sms_req.sms_text = String::str("trace test message %u", i);
+      sms_req.deadline = Clock::getSinceEpoch() + c_step_timeout * 10;
+      h.queue.push(sms_req);
+    }
+  }
+
+  //! @return true if the inbox text was received.
+  bool
+  isReceived(Harness& h)
+  {
+    return std::find(h.texts.begin(), h.texts.end(), c_inbox_text) != h.texts.end();
+  }
+
+  //! Write a trace file.
+  //! @param[in] path trace file.
+  //! @param[in] records records, an empty sent record is a gap marker.
+  void
+  writeTrace(const std::string& path, const SerialTrace::Records& records)
+  {
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    file.write((const char*)&c_trace_magic, sizeof(c_trace_magic));
+    for (std::size_t i = 0; i < records.size(); ++i)
+    {
+      uint32_t delta = 1000;
+      uint16_t header = records[i].data.size() | (records[i].sent ? 0x8000 : 0);
+      file.write((const char*)&delta, sizeof(delta));
+      file.write((const char*)&header, sizeof(header));
+      file.write(records[i].data.data(), records[i].data.size());
+    }
+  }
+
+  //! @return record.
+  SerialTrace::Record
+  record(bool sent, const std::string& data)
+  {
+    SerialTrace::Record rec;
+    rec.time = 0;
+    rec.sent = sent;
+    rec.data = data;
+    return rec;
+  }
+
+  //! Write to a replay and read its answer.
+  //! @param[in] replay replay.
+  //! @param[in] command bytes written.
+  //! @param[in] answer text expected in the answer.
+  //! @return true if the answer was read.
+  bool
+  exchange(TraceReplay& replay, const std::string& command, const std::string& answer)
+  {
+    replay.write((const uint8_t*)command.data(), command.size());
+    std::string input;
+    return waitFor([&]()
+                   {
+                     uint8_t bfr[64];
+                     std::size_t rv = replay.read(bfr, sizeof(bfr));
+                     input.append((const char*)bfr, rv);
+                     return input.find(answer) != std::string::npos;
+                   }, c_step_timeout);
+  }
+
+  //! Record a driver session with SMS sent and received, then replay it
+  //! through a new driver and compare what it writes.
+  void
+  testRecordReplay(ModemSimulator& sim, TestTask& task, const std::string& path)
+  {
+    SerialTrace trace;
+    trace.setWindow(c_step_timeout * 10);
+    trace.startSession();
+
+    std::size_t records = 0;
+    {
+      Harness h;
+      pushSms(h);
+      h.open(&task, new TraceRecorder(new SerialPort(sim.getDevice(), 115200), &trace));
+      check(h.waitConnected(c_step_timeout), "recorded session bring-up");
+      h.waitFor([&]() { return sim.getSent().size() >= c_sms_count; }, c_step_timeout);
+      sim.receiveSMS("+351910000001", c_inbox_text);
+      bool received = h.waitFor([&]() { return isReceived(h); }, c_step_timeout);
+      check(sim.getSent().size() == c_sms_count && received, "recorded session SMS sent and received");
+      h.waitFor([]() { return false; }, c_idle_time);
+      h.close();
+      records = trace.save(path);
+    }
+
+    report("records saved", records, "");
+
+    double start = Clock::get();
+    TraceReplay* replay = new TraceReplay(path, 1.0);
+    replay->start();
+    Harness h;
+    pushSms(h);
+    h.open(&task, replay);
+
+    unsigned mismatches = 0;
+    bool done = h.waitFor([&]() { return replay->isDone(mismatches); }, c_step_timeout);
+    check(done, "trace replayed");
+    check(done && mismatches == 0, "replay writes match the trace");
+    check(isReceived(h), "replayed inbox SMS received");
+    report("replay time", Clock::get() - start, "s");
+    report("mismatched bytes", mismatches, "");
+  }
+
+  //! Replay a trace with a gap marker, writing commands that are not in
+  //! the trace after the gap, then the same trace without the marker.
+  void
+  testGapResync(const std::string& path)
+  {
+    SerialTrace::Records records;
+    records.push_back(record(true, "ATE0\r"));
+    records.push_back(record(false, "\r\nOK\r\n"));
+    records.push_back(record(true, ""));
+    records.push_back(record(true, "AT+CSQ\r"));
+    records.push_back(record(false, "\r\n+CSQ: 20,99\r\n\r\nOK\r\n"));
+    writeTrace(path, records);
+
+    unsigned mismatches = 0;
+    {
+      TraceReplay replay(path, 0);
+      replay.start();
+      bool first = exchange(replay, "ATE0\r", "OK");
+      //! Commands of the dropped records, before the next in the trace.
+      bool second = exchange(replay, "AT+CREG?\rAT+CSQ\r", "+CSQ: 20,99");
+      bool done = waitFor([&]() { return replay.isDone(mismatches); }, c_step_timeout);
+      check(first && second && done, "replay resumed after the gap");
+      check(mismatches == 0, "commands in the gap ignored");
+    }
+
+    records.erase(records.begin() + 2);
+    writeTrace(path, records);
+    {
+      TraceReplay replay(path, 0);
+      replay.start();
+      exchange(replay, "ATE0\r", "OK");
+      replay.write((const uint8_t*)"AT+CREG?\r", 9);
+      waitFor([&]() { replay.isDone(mismatches); return mismatches > 0; }, 1.0);
+      check(mismatches > 0, "commands without a gap mismatched");
+    }
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  SimulatorConfig config;
+
+  try
+  {
+    if (argc > 1)
+      ModemSimulator::load(argv[1], config);
+
+    char dir[] = "/tmp/test-trace-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+      throw std::runtime_error("failed to create trace directory");
+
+    testGapResync(std::string(dir) + "/gap.trace");
+
+    ModemSimulator sim(config);
+    Tasks::Context ctx;
+    TestTask task(ctx);
+    testRecordReplay(sim, task, std::string(dir) + "/session.trace");
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return getFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+//***************************************************************************
+// Tests of file uploads through the modem file system and HTTP client
+// against the AT simulator: an upload interrupted mid-file resumes from
+// the size stored in the modem, failed posts back off before the next
+// attempt and an upload is given up after the retry cap. Results are
+// printed as one line per measurement; the exit status is non-zero if
+// any check fails.
+//
+// Build (from a DUNE build tree, with this task's directory as $TASK):
+//   g++ -std=c++11 -O2 -pthread -I$DUNE/src -I$BUILD/DUNE -o test-uploads
+//       $TASK/tests/TestUploads.cpp -L$BUILD -ldune-core
+//
+// Usage:
+//   test-uploads [script]
+//***************************************************************************
+
+// ISO C++ 11 headers.
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "TestHarness.hpp"
+
+using DUNE_NAMESPACES;
+using namespace Transports::GSMTobyL2;
+
+namespace
+{
+  //! Time to wait for each step (s).
+  const double c_step_timeout = 60.0;
+  //! Size of the uploaded file (bytes).
+  const unsigned c_file_size = 20000;
+  //! Bytes written to the modem at a time.
+  const unsigned c_chunk = 4096;
+  //! File size in the modem when the write is interrupted, mid chunk.
+  const unsigned c_cut = c_chunk + 1000;
+  //! Time the modem stays silent after the interruption (s).
+  const double c_silence = 2.0;
+  //! Maximum time to post a file (s).
+  const double c_post_timeout = 10.0;
+
+  //! Write a local file with pseudo-random contents.
+  //! @param[in] path file.
+  //! @param[in] size file size.
+  //! @return file contents.
+  std::string
+  createFile(const std::string& path, unsigned size)
+  {
+    std::string data(size, '\0');
+    for (unsigned i = 0; i < size; ++i)
+      data[i] = std::rand() & 0xff;
+
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file.write(data.data(), data.size());
+    return data;
+  }
+
+  //! @return commands of the log starting with a prefix.
+  std::vector<ModemSimulator::Command>
+  filterLog(ModemSimulator& sim, const std::string& prefix)
+  {
+    std::vector<ModemSimulator::Command> log = sim.getLog();
+    std::vector<ModemSimulator::Command> commands;
+    for (std::size_t i = 0; i < log.size(); ++i)
+    {
+      if (log[i].text.compare(0, prefix.size(), prefix) == 0)
+        commands.push_back(log[i]);
+    }
+    return commands;
+  }
+
+  //! Interrupt the upload in the middle of a chunk and check that it
+  //! resumes from the size stored in the modem.
+  void
+  testResume(ModemSimulator& sim, Harness& h, const std::string& dir)
+  {
+    std::string path = dir + "/resume.lsf";
+    std::string data = createFile(path, c_file_size);
+    sim.interruptWrite(c_cut, c_silence);
+
+    double start = Clock::get();
+    h.uploads.push(path, "resume.lsf");
+    bool posted = h.waitFor([&]() { return !sim.getPosts().empty() && h.uploads.current() == NULL; },
+                            c_step_timeout, true);
+    check(posted, "interrupted upload posted");
+    report("upload time", Clock::get() - start, "s");
+
+    std::vector<ModemSimulator::Post> posts = sim.getPosts();
+    check(posts.size() == 1 && posts.back().success && posts.back().data == data, "posted file intact");
+    check(posts.size() == 1 && posts.back().path == "/upload/resume.lsf", "posted to the server path");
+
+    //! The write following the size query resumes at the stored size.
+    std::vector<ModemSimulator::Command> log = sim.getLog();
+    int resumed = -1;
+    for (std::size_t i = 0; i + 1 < log.size(); ++i)
+    {
+      if (log[i].text == "+ULSTFILE=2,\"resume.lsf\"" && log[i + 1].text.compare(0, 10, "+UDWNFILE=") == 0)
+        resumed = std::atoi(log[i + 1].text.substr(log[i + 1].text.find(',') + 1).c_str());
+    }
+    check(resumed == (int)std::min(c_chunk, c_file_size - c_cut), "resumed at the stored size");
+
+    unsigned written = 0;
+    std::vector<ModemSimulator::Command> writes = filterLog(sim, "+UDWNFILE=");
+    for (std::size_t i = 0; i < writes.size(); ++i)
+      written += std::atoi(writes[i].text.substr(writes[i].text.find(',') + 1).c_str());
+    check(written == c_file_size + 2 * c_chunk - c_cut, "only the lost chunk part sent again");
+
+    std::string stored;
+    check(!sim.getFile("resume.lsf", stored), "modem file deleted");
+    Uploads::Progress progress;
+    h.uploads.getProgress(progress);
+    check(progress.queued == 0 && progress.failed == 0, "upload done");
+  }
+
+  //! Fail the first post and measure the time to the next attempt.
+  void
+  testBackoff(ModemSimulator& sim, Harness& h, const std::string& dir)
+  {
+    std::string path = dir + "/backoff.lsf";
+    std::string data = createFile(path, c_chunk);
+    std::size_t posts = sim.getPosts().size();
+    sim.setHttpFailures(1);
+
+    h.uploads.push(path, "backoff.lsf");
+    double timeout = c_upload_retry_delay + c_step_timeout;
+    bool posted = h.waitFor([&]() { return sim.getPosts().size() >= posts + 2; }, timeout, true);
+    check(posted, "failed upload retried");
+    h.waitFor([&]() { return h.uploads.current() == NULL; }, c_step_timeout, true);
+
+    std::vector<ModemSimulator::Post> all = sim.getPosts();
+    if (!posted)
+      return;
+
+    double delay = all[posts + 1].time - all[posts].time;
+    check(!all[posts].success && all[posts + 1].success && all[posts + 1].data == data, "retry posted file intact");
+    check(delay >= c_upload_retry_delay && delay < c_upload_retry_delay + c_post_timeout, "retry backed off");
+    report("time between attempts", delay, "s");
+  }
+
+  //! Fail an upload repeatedly and check that it waits for its retry
+  //! time after each failure and is given up at the retry cap.
+  void
+  testRetryCap(const std::string& dir)
+  {
+    std::string path = dir + "/cap.lsf";
+    createFile(path, 100);
+
+    Uploads uploads;
+    uploads.push(path, "cap.lsf");
+    bool started = uploads.current() != NULL;
+    unsigned attempts = 1;
+    bool waiting = true;
+    while (uploads.requeue())
+    {
+      waiting = waiting && uploads.current() == NULL;
+      ++attempts;
+    }
+
+    Uploads::Progress progress;
+    uploads.getProgress(progress);
+    check(started && waiting, "failed upload waits for its retry time");
+    check(attempts == c_upload_max_retries, "upload given up at the retry cap");
+    check(progress.queued == 0 && progress.failed == 1, "given up upload counted");
+    report("attempts before giving up", attempts, "");
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  SimulatorConfig config;
+  config.http_delay = 0.2;
+
+  try
+  {
+    if (argc > 1)
+      ModemSimulator::load(argv[1], config);
+
+    char dir[] = "/tmp/test-uploads-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+      throw std::runtime_error("failed to create upload directory");
+
+    testRetryCap(dir);
+
+    ModemSimulator sim(config);
+    Tasks::Context ctx;
+    TestTask task(ctx);
+    Harness h;
+
+    h.open(&task, sim.getDevice());
+    check(h.waitConnected(c_step_timeout), "bring-up");
+    h.driver->setUploadConfig("10.0.0.1", 80, "/upload", c_chunk, c_post_timeout);
+    if (getFailures() == 0)
+    {
+      testResume(sim, h, dir);
+      testBackoff(sim, h, dir);
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return getFailures() == 0 ? 0 : 1;
+}